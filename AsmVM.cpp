@@ -1,6 +1,5 @@
 // AsmVM.cpp : Defines the entry point for the console application.
 //
-//add multiple returns perhaps?
 
 #include <stdio.h>
 
@@ -24,6 +23,8 @@ typedef wchar_t     _TCHAR;
 #include <Windows.h>
 #endif
 #include <functional>
+#include <thread>
+#include <chrono>
 
 using namespace Jet;
 
@@ -116,7 +117,7 @@ void CTest()
 	QueryPerformanceCounter((LARGE_INTEGER *)&end);
 	INT64 diff = end - start;
 	double dt = ((double)diff) / ((double)rate);
-	printf("%I64d,CԺʱ: %lf \n",v, dt);
+	printf("%I64d,C语言耗时: %lf 秒\n",v, dt);
 }
 
 int main(int argc, char* argv[])
@@ -497,6 +498,365 @@ int main(int argc, char* argv[])
 					throw CompilerException("", 0, "ForEach Loop test failed!\n");
 				}
 
+				//native foreach test, arrays, objects, generators and iterator metamethods
+				try
+				{
+					Value out = tcontext.Script(
+						"local s = 0; for (local v in [1,2,3]) s += v;"
+						"local o = {a = 10, b = 20}; for (local v in o) s += v;"
+						"fun g(n) { for (local i = 0; i < n; i++) yield i; return 100; }"
+						"for (local v in g(4)) s += v;"
+						"fun g2() { yield 5; yield 6; } for (local v in g2) s += v;"
+						"local R = { iterator = fun(self) { local r = {i = 0, n = self.n};"
+						" r.advance = fun(r) { r.i = (r.i) + 1; return (r.i) <= (r.n); };"
+						" r.current = fun(r) { return (r.i) * 100; }; return r; } };"
+						"local range = {n = 3}; setprototype(range, R); for (local v in range) s += v;"
+						"for (local v in [1,2,3,4,5]) { if (v == 2) continue; if (v == 4) break; s += v * 1000; }"
+						"local n = 0; for (local a in [1,2]) for (local b in {x = 1, y = 2, z = 3}) n += a * b;"
+						"for (local v in []) s = 0; for (local v in {}) s = 0;"
+						"local gg = g(2); for (local v in gg) s += v; for (local v in gg) s = 0;"
+						"return s * 100 + n;");
+					if ((int)out != 465418)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Native ForEach test failed!\n");
+				}
+
+				//counting for loop test, ForIntPrep/ForIntLoop
+				try
+				{
+					Value out = tcontext.Script(
+						"local s = 0; for (local i = 0; i < 10; i++) s += i;"
+						"for (local j = 10; j > 0; j -= 3) s += j;"
+						"for (local k = 1; k <= 4; ++k) s += k * 100;"
+						"for (local l = 5; l >= 5; l--) s += 10000;"
+						"local n = 3; for (local m = 0; m < n; m += 1) { if (m == 0) n = 5; s += 1; }"
+						"for (local o = 0; o < 10; o++) { if (o % 2 == 0) continue; if (o > 6) break; s += o * 1000000; }"
+						"local c = 0; for (local p = 0; p < 3; p++) { p = p + 0.5; c += 1; }"
+						"for (local q = 5; q < 5; q++) s = 0;"
+						"return s * 10 + c;");
+					if ((int)out != 90110722)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Int for loop test failed!\n");
+				}
+
+				//stack overflow test, runaway recursion has to stop at the call instead of overrunning the stack
+				try
+				{
+					JetContext scontext;
+					bool threw = false;
+					try
+					{
+						scontext.Script("fun r() { return 1 + (2 + (3 + r())); } return r();");
+					}
+					catch(RuntimeException e)
+					{
+						threw = true;
+					}
+					if (threw == false)
+						throw 7;
+
+					Value out = scontext.Script("fun sum(n) { if (n == 0) return 0; return n + sum(n - 1); } return sum(100);");
+					if ((int)out != 5050)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Stack overflow test failed!\n");
+				}
+
+				//tail call test, tail recursion past the call depth limit and captures closed before the frame is reused
+				try
+				{
+					Value out = tcontext.Script(
+						"fun loop(n, acc) { if (n == 0) return acc; return loop(n - 1, acc + n); }"
+						"fun even(n) { if (n == 0) return 1; return odd(n - 1); }"
+						"fun odd(n) { if (n == 0) return 0; return even(n - 1); }"
+						"fun mk(n, keep) { local f = fun() { return n; }; if (n == 0) return keep; return mk(n - 1, f); }"
+						"local o = {v = 3}; o.get = fun(self, n) { if (n == 0) return self.v; return self:get(n - 1); };"
+						"fun ts(x) { return tostring(x); } local g = o:get(2000);"
+						"return loop(5000, 0) + even(3001) * 100 + mk(5, 0)() * 1000 + g * 10000 + (ts(4) == \"4\");");
+					if ((int)out != 12533501)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Tail call test failed!\n");
+				}
+
+				//call frame test, arguments become locals in place and frames unwind properly through natives and errors
+				try
+				{
+					JetContext fcontext;
+					Value out = fcontext.Script(
+						"fun add(a, b) { local c = a + b; return c; }"
+						"fun gen(n) { for (local i = 0; i < n; i++) yield i + 1; return 100; }"
+						"local g = gen(2); local r = (resume g) * 1000 + (resume g) * 100 + (resume g);"
+						"local h = gen(1); local it = h:iterator(); it:advance();"
+						"fun bad() { local x = 1; error(\"boom\"); }"
+						"pcall(bad);"
+						"return r * 10 + add(1, 2, 3) + add(it:current(), 0);");
+					if ((int)out != 13004)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Call frame test failed!\n");
+				}
+
+				//varargs test, read and forwarded in place, or put in an array when they escape
+				try
+				{
+					Value out = tcontext.Script(
+						"fun count(...rest) { return rest:size(); }"
+						"fun second(a, ...rest) { return rest[1]; }"
+						"fun sum(...rest) { local s = 0; local n = rest:size(); for (local i = 0; i < n; i++) s += rest[i]; return s; }"
+						"fun fwd(x, ...rest) { return sum(x, ...rest); }"
+						"fun tl(n, ...rest) { if (n == 0) return rest:size(); return tl(n - 1, ...rest); }"
+						"fun esc(...rest) { return rest; }"
+						"fun each(...rest) { local s = 0; for (local v in rest) s += v; return s; }"
+						"local e = esc(1, 2); local a = e:size(); e = esc(); local b = e:size();"
+						"return count(1, 2, 3) + second(1, 2, 3) * 10 + fwd(10, 1, 2) * 100 + each(4, 5) * 10000 + (a + b) * 100000 + tl(1000, 1, 2) * 1000000;");
+					if ((int)out != 2291333)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Varargs test failed!\n");
+				}
+
+				//multiple returns test, values come back on the stack and missing ones are null
+				try
+				{
+					Value out = tcontext.Script(
+						"fun three(a) { return a, a + 1, a + 2; }"
+						"fun pass(...rest) { return three(...rest); }"
+						"fun one() { return 7; }"
+						"local a, b = three(1); local c, d = one(); local e, f, g = pass(10);"
+						"return a + b * 10 + (d == null) * 100 + c * 1000 + g * 10000 + three(3);");
+					if ((int)out != 127124)
+						throw 7;
+
+					std::vector<Value> results;
+					Value three = tcontext["three"];
+					Value arg = 5;
+					tcontext.Call(&three, &arg, 1, &results);
+					if (results.size() != 3 || (int)results[0] != 5 || (int)results[2] != 7)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Multiple returns test failed!\n");
+				}
+
+				//budget test, runaway scripts get stopped by the budget, deadline or an interrupt from another thread
+				try
+				{
+					JetContext bcontext;
+					int stopped = 0;
+					bcontext.SetBudget(10000);
+					try
+					{
+						bcontext.Script("while (1) { pcall(fun() { while (1) { } }); }");
+					}
+					catch(RuntimeException e)
+					{
+						stopped++;
+					}
+
+					bcontext.SetBudget(-1);
+					bcontext.SetDeadline(20000000);
+					try
+					{
+						bcontext.Script("fun spin(n) { return spin(n + 1); } spin(0);");
+					}
+					catch(RuntimeException e)
+					{
+						stopped++;
+					}
+
+					bcontext.SetDeadline(-1);
+					std::thread stopper([&bcontext]() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); bcontext.Interrupt(); });
+					try
+					{
+						bcontext.Script("local i = 0; for (local j = 0; j >= 0; j++) i++;");
+					}
+					catch(RuntimeException e)
+					{
+						stopped++;
+					}
+					stopper.join();
+					bcontext.Interrupt(false);
+
+					Value out = bcontext.Script("local s = 0; for (local i = 0; i < 100; i++) s += i; return s;");
+					if (stopped != 3 || (int)out != 4950)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Budget test failed!\n");
+				}
+
+				//stack growth test, deep recursion grows the stacks and open captures follow them when they move
+				try
+				{
+					JetContext gcontext;
+					Value out = gcontext.Script(
+						"fun deep(n) { if (n == 0) return 0; return 1 + deep(n - 1); }"
+						"fun cap() { local x = 1; local f = fun() { x += 1; return x; }; deep(5000); f(); local y = x; deep(20000); f(); return x * 100 + y; }"
+						"return deep(30000) + cap();");
+					if ((int)out != 30302)
+						throw 7;
+
+					JetContext lcontext;
+					lcontext.SetStackLimits(4096, 64);
+					lcontext.Script("fun deep(n) { if (n == 0) return 0; return 1 + deep(n - 1); }");
+					bool threw = false;
+					try
+					{
+						lcontext.Script("return deep(100);");
+					}
+					catch(RuntimeException e)
+					{
+						threw = true;
+					}
+					out = lcontext.Script("return deep(50);");
+					if (threw == false || (int)out != 50)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Stack growth test failed!\n");
+				}
+
+				//memory quota test, garbage gets collected to stay under the quota but live data that doesn't fit throws
+				try
+				{
+					JetContext mcontext;
+					mcontext.Script("fun grow(n) { local a = []; for (local i = 0; i < n; i++) a:add(\"item\" + i); return a; }");
+					mcontext.SetMemoryQuota(mcontext.GetMemoryUsage() + 1024*1024);
+					Value out = mcontext.Script("local n = 0; for (local i = 0; i < 20000; i++) { local s = \"\"; for (local j = 0; j < 10; j++) s += \"0123456789\"; n += s:length(); } return n;");
+					if ((int)out != 2000000)
+						throw 7;
+
+					bool threw = false;
+					try
+					{
+						mcontext.Script("local keep = grow(1000000); return keep:size();");
+					}
+					catch(RuntimeException e)
+					{
+						threw = true;
+					}
+					size_t peak = mcontext.GetPeakMemoryUsage();
+					out = mcontext.Script("local keep = grow(1000); return keep:size();");
+					if (threw == false || (int)out != 1000 || peak > mcontext.GetMemoryUsage() + 2*1024*1024 || peak < mcontext.GetMemoryUsage())
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Memory quota test failed!\n");
+				}
+
+				//generator frame test, locals stay in the generator so captures of them survive yields, stack growth and the generator being freed
+				try
+				{
+					JetContext gcontext;
+					Value out = gcontext.Script(
+						"fun deep(n) { if (n == 0) return 0; return 1 + deep(n - 1); }"
+						"fun g() { local x = 1; local f = fun() { return x; }; yield f; x = 5; deep(20000); local y = pcall(fun() { return x; }); yield f() + y; x = 7; yield f(); }"
+						"local gen = g(); local f = gen(); local a = f(); local b = gen(); local c = f(); local d = gen(); local e = f();"
+						"fun h() { local gg = g(); return gg(); }"
+						"local f2 = h(); gc(); gc(); gc(); gc(); local z = f2();"
+						"return a + b * 10 + c * 1000 + d * 10000 + e * 100000 + z * 1000000;");
+					if ((int)out != 1775101)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Generator frame test failed!\n");
+				}
+
+				//flat capture test, nested closures share the captures of the ones they were made in, generators those of their function
+				try
+				{
+					JetContext ccontext;
+					Value out = ccontext.Script(
+						"fun a() { local x = 1; local b = fun() { local y = 10; local c = fun() { local d = fun() { x += y; y += 1; return x * 100 + y; }; return d; }; return c(); };"
+						"  local dd = b(); local r1 = dd(); x = 1000; local r2 = dd(); return r1 * 1000 + r2 % 1000; }"
+						"fun mk() { local bb = 100; return fun(n) { for (local i = 0; i < n; i++) yield bb + i; }; }"
+						"local s = 0; for (local v in mk()(3)) s += v;"
+						"return a() * 1000 + s;");
+					if ((int)out != 1111112303)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Flat capture test failed!\n");
+				}
+
+				//open capture test, each loop pass gets its own capture and frames unwound by an error close theirs
+				try
+				{
+					JetContext ocontext;
+					Value out = ocontext.Script(
+						"local fs = []; for (local i = 0; i < 5; i++) { local j = i * 2; fs:add(fun() { return j; }); }"
+						"local s = 0; for (local k = 0; k < 5; k++) s += fs[k]();"
+						"local kept = null; fun bad(f) { local x = 3; local g = fun() { return x; }; f(g); error(\"boom\"); }"
+						"pcall(bad, fun(g) { kept = g; });"
+						"fun clobber(a, b, c, d) { local e = 99; return a + b + c + d + e; } clobber(7, 7, 7, 7);"
+						"fun two() { local x = 1; local a = fun() { x += 1; return x; }; local b = fun() { x += 10; return x; }; a(); return b(); }"
+						"fun none(n) { return n + 1; }"
+						"return s * 10000 + kept() * 1000 + two() * 10 + none(0);");
+					if ((int)out != 203121)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Open capture test failed!\n");
+				}
+
+				//escape test, closures without captures are shared and object literals only used through their fields live in locals
+				try
+				{
+					JetContext econtext;
+					Value out = econtext.Script(
+						"fun mk() { return fun(n) { return n + 1; }; }"
+						"local a = mk(); a = null; gc(); gc(); gc(); local b = mk();"
+						"fun sc(n) { local p = {x = 0, y = n}; for (local i = 0; i < n; i++) p.x += p.y; local g = fun() { return 1; }; local px = p.x; return px + g(); }"
+						"fun esc() { local p = {x = 1}; local g = fun() { p.x += 1; return p.x; }; g(); return p; }"
+						"local e = esc(); local ex = e.x;"
+						"return b(1) * 10000 + sc(4) * 10 + ex;");
+					if ((int)out != 20172)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Escape test failed!\n");
+				}
+
+				//static type test, typed instructions are only used while a local keeps one type through every path
+				try
+				{
+					JetContext scontext;
+					Value out = scontext.Script(
+						"fun f(n) { local s = 0; local r = 0.5; for (local i = 0; i < n; i++) { s = s + i * 2; r = r * 2.0; if (i == 2) s = s + 0.5; } return s + r; }"
+						"fun g(n) { local x = 1; local h = fun() { x = 0.25; }; local i = 0; while (i < n) { x = x + 1; if (i == 1) h(); i++; } return x; }"
+						"fun k() { local a = 3; local b = 1.5; a <> b; local c = 0; while (c < 3) { a = a - 1; c = c + 1; } return a * 2.0 + b; }"
+						"return f(4) * 100 + g(3) * 4 + k();");
+					if (out.type != ValueType::Real || out.value != 2055.0)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Static type test failed!\n");
+				}
+
 				//closure test
 				try
 				{
@@ -523,6 +883,168 @@ int main(int argc, char* argv[])
 					throw CompilerException("", 0, "Closure test failed!\n");
 				}
 
+				//register instruction test
+				try
+				{
+					JetContext rcontext;
+					rcontext.SetRegisterCode(true);
+					Value out = rcontext.Script(
+						"local a = 5; local b = 7; local c = a + b * 2 - 1;"
+						"local d = 0; for (local i = 0; i < 10; i++) { d += i; d = d - 1; }"
+						"local e = 2.5; e *= 2.0; e--;"
+						"local f = a < b; local g = c % 4 == 2;"
+						"fun sq(x) { local y = x * x; return y; }"
+						"return c * 1000 + d * 10 + e + f + g + sq(3);");
+					if ((int)out != 18365)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Register instruction test failed!\n");
+				}
+
+				//superinstruction test
+				try
+				{
+					Value out = tcontext.Script(
+						"fun cmp(a, b) { local n = 0; if (a == b) n += 1; if (a != b) n += 2; if (a < b) n += 4; if (a > b) n += 8; if (a <= b) n += 16; if (a >= b) n += 32; return n; }"
+						"local x = 10; local y = 3;"
+						"local s = x + y; local t = x - y; local u = x * y; local v = x + 5 - 2; local w = y * 4;"
+						"x++; y--;"
+						"return cmp(3, 4) + cmp(4, 4) * 100 + (s + t + u + v + w) * 10000 + x * 1000000 + y * 10000000;");
+					if ((int)out != 31754922)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Superinstruction test failed!\n");
+				}
+
+				//quickening test, each site is quickened on its first call and has to fall back on the later ones
+				try
+				{
+					JetContext qcontext;
+					Value out = qcontext.Script(
+						"fun add(a, b) { return a + b; }"
+						"fun lt(a, b) { if (a < b) return 1; return 0; }"
+						"fun lt2(a, b) { if (a < b) return 1; return 0; }"
+						"fun mul(a, b) { return (a + b) * (a - b); }"
+						"local r = add(1, 2) + add(1, 2); local s = add(1.5, 2.0); local u = add(\"a\", 1);"
+						"local n = lt(1, 2) + lt(2, 1) + lt(1.5, 2.5) + lt(2.5, 1.5) + lt(1, 2.5);"
+						"local m = lt2(1.5, 2.5) + lt2(-3, -2) + lt2(2, 1.5);"
+						"return r * 1000 + s * 100.0 + n + m * 10 + (u == \"a1\") + (mul(3, 2) + mul(1.5, 0.5)) * 10000.0;");
+					if ((int)out != 76374)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Quickening test failed!\n");
+				}
+
+				//object shape test, shared shapes and objects that fall back to their own
+				try
+				{
+					Value out = tcontext.Script(
+						"local a = {x = 1, y = 2}; local b = {x = 3, y = 4}; b.z = 5; a.z = 6;"
+						"local d = {}; for (local i = 0; i < 100; i++) d[\"k\" + i] = i;"
+						"local e = {}; e[1] = 10; e[2] = 20; e.name = 5;"
+						"local n = 0; for (local v in d) n = n + v;"
+						"return n * 10000 + (a.z) * 1000 + (b.z) * 100 + (b.x) * 10 + (a.y) + (e[1]) + (e[2]) + (e.name) + (d.k99);");
+					if ((int)out != 49506666)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Object shape test failed!\n");
+				}
+
+				//inline cache test, cached inherited keys have to notice when something shadows them
+				try
+				{
+					Value out = tcontext.Script(
+						"local root = {kind = 1}; local mid = {}; setprototype(mid, root);"
+						"fun make(v) { local o = {v = v}; setprototype(o, mid); return o; }"
+						"fun read(o) { return (o.kind) * 100 + (o.v); }"
+						"local a = make(1); local b = make(2);"
+						"local r = read(a) + read(b);"
+						"mid.kind = 5; r = r * 10000 + read(a);"
+						"a.kind = 7; r = r * 1000 + read(a) + (b.missing == null);"
+						"return r;");
+					if ((int)out != 2030501702)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Inline cache test failed!\n");
+				}
+
+				//mixed arithmetic test, reals combined with ints in place
+				try
+				{
+					Value out = tcontext.Script("local r = 0.5; r *= 4; r -= 1; r /= 2; local i = 3; i *= 0.5; return r + i;");
+					if ((double)out != 2.0)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "Mixed arithmetic test failed!\n");
+				}
+
+				//string test, runtime built strings have to find interned keys and constants stay constant
+				try
+				{
+					Value out = tcontext.Script(
+						"local s = \"ab\" + \"c\"; local o = {abc = 1}; o[s] = (o[s]) + 1;"
+						"local t = \"x\" + \"yz\"; t[0] = 97; local p = {}; p[t] = 3;"
+						"for (local i = 0; i < 300; i++) { local q = {}; q[\"k\" + i] = i; } gc();"
+						"local q = {}; q[\"k\" + 299] = 4;"
+						"return (o.abc) * 10000 + (p.ayz) * 1000 + (q.k299) * 100 + (s == \"abc\") * 10 + (t == \"ayz\");");
+					if ((int)out != 23411)
+						throw 7;
+
+					bool threw = false;
+					try
+					{
+						tcontext.Script("local c = \"abc\"; c[0] = 97;");
+					}
+					catch(RuntimeException e)
+					{
+						threw = true;
+					}
+					if (threw == false)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "String test failed!\n");
+				}
+
+				//JIT test, hot functions have to give the same results as the interpreter
+				try
+				{
+					const char* source =
+						"fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+						"fun mix(n) { local s = 0; local r = 0.5; local t = \"\"; for (local i = 0; i < n; i++) { local j = i % 7; if (j < 3) s = s + j * 2; else s--; r = r * 1.0001 + i / 4; if (i % 500 == 0) t = t + i; } return [s, r, t]; }"
+						"fun counter() { local c = 0; return fun(d) { c = c + d; return c; }; }"
+						"g = 0; local inc = counter(); local o = {n = 0};"
+						"for (local i = 0; i < 3000; i++) { g = g + inc(2) % 3; o.n = o.n + (i >= 1500); }"
+						"fun bad(n) { local s = 0; for (local i = 0; i < n; i++) { s = s + i; if (i == 2500) error(\"boom\"); } return s; }"
+						"local m = mix(5000); pcall(bad, 3000);"
+						"return ((fib(20) * 100000 + (m[0])) * 10000 + g + (o.n)) + \" \" + (m[1]) + (m[2]);";
+
+					JetContext icontext;
+					JetContext jcontext;
+					jcontext.SetJIT(true);
+					Value expected = icontext.Script(source);
+					Value out = jcontext.Script(source);
+					if (out.ToString() != expected.ToString() || out.ToString().find("6765014304500 3714569.875") != 0)
+						throw 7;
+				}
+				catch(...)
+				{
+					throw CompilerException("", 0, "JIT test failed!\n");
+				}
+
 				//== operator test
 				try
 				{
@@ -561,6 +1083,11 @@ int main(int argc, char* argv[])
 				printf("%s\n",E.reason.c_str());
 			}
 		}
+		else if (strcmp(command2, "jit") == 0 && arg[0] == 0)
+		{
+			context.SetJIT(!context.GetJIT());
+			printf("JIT %s\n", context.GetJIT() ? "on" : "off");
+		}
 		else if (strcmp(command2, "quit") == 0 && arg[0] == 0)
 		{
 			break;
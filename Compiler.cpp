@@ -7,11 +7,15 @@ CompilerContext::CompilerContext(void)
 {
 	this->vararg = false;
 	this->isgenerator = false;
+	this->varargescapes = false;
 	this->closures = 0;
+	this->captured = -1;
 	this->parent = 0;
 	this->uuid = 0;
 	this->localindex = 0;
 	this->lastline = 0;
+	this->tempsused = 0;
+	this->registers = false;
 	this->scope = new CompilerContext::Scope;
 	this->scope->level = 0;
 	this->scope->previous = this->scope->next = 0;
@@ -90,6 +94,7 @@ std::vector<IntermediateInstruction> CompilerContext::Compile(BlockExpression* e
 		//may want to correct number of locals here
 		this->FunctionLabel("{Entry Point}", 0, 0, 0, this->vararg);
 
+		this->CaptureNames(expr);
 		expr->Compile(this);
 
 		//add a return to signify end of global code
@@ -99,6 +104,8 @@ std::vector<IntermediateInstruction> CompilerContext::Compile(BlockExpression* e
 			this->Return();
 		}
 
+		this->LoadConstants(1);
+
 		this->Compile();
 
 		if (localindex > 255)
@@ -134,6 +141,14 @@ std::vector<IntermediateInstruction> CompilerContext::Compile(BlockExpression* e
 
 		this->localindex = 0;
 		this->closures = 0;
+		this->captured = -1;
+		this->temps.clear();
+		this->tempsused = 0;
+		this->intconstants.clear();
+		this->realconstants.clear();
+		this->types.clear();
+		this->untyped.clear();
+		this->capturednames.clear();
 
 		throw e;
 	}
@@ -158,6 +173,14 @@ std::vector<IntermediateInstruction> CompilerContext::Compile(BlockExpression* e
 	//add custom operators
 	this->localindex = 0;
 	this->closures = 0;
+	this->captured = -1;
+	this->temps.clear();
+	this->tempsused = 0;
+	this->intconstants.clear();
+	this->realconstants.clear();
+	this->types.clear();
+	this->untyped.clear();
+	this->capturednames.clear();
 
 	//this->PrintAssembly();
 
@@ -166,6 +189,127 @@ std::vector<IntermediateInstruction> CompilerContext::Compile(BlockExpression* e
 	return std::move(temp);
 }
 
+void CompilerContext::Optimize(std::vector<IntermediateInstruction>& code)
+{
+	std::vector<IntermediateInstruction> out;
+	out.reserve(code.size());
+	for (unsigned int i = 0; i < code.size(); i++)
+	{
+		//labels and other dummy instructions never match, so nothing gets fused across a jump target
+		auto next = [&](unsigned int n) { return i + n < code.size() ? code[i+n].type : InstructionType::Label; };
+
+		IntermediateInstruction ins = code[i];
+		switch (ins.type)
+		{
+		case InstructionType::LLoad:
+			{
+				if (next(1) == InstructionType::LLoad)
+				{
+					IntermediateInstruction fused(InstructionType::LLoadLLoad);
+					fused.a = code[i].first;
+					fused.b = code[i+1].first;
+					i++;
+					switch (next(1))
+					{
+					case InstructionType::Add:
+						fused.type = InstructionType::LLoadLLoadAdd;
+						i++;
+						break;
+					case InstructionType::Sub:
+						fused.type = InstructionType::LLoadLLoadSub;
+						i++;
+						break;
+					case InstructionType::Mul:
+						fused.type = InstructionType::LLoadLLoadMul;
+						i++;
+						break;
+					case InstructionType::AddInt:
+					case InstructionType::SubInt:
+					case InstructionType::MulInt:
+						fused.type = (InstructionType)((int)InstructionType::LLoadLLoadAddInt + (int)next(1) - (int)InstructionType::AddInt);
+						i++;
+						break;
+					case InstructionType::AddReal:
+					case InstructionType::SubReal:
+					case InstructionType::MulReal:
+						fused.type = (InstructionType)((int)InstructionType::LLoadLLoadAddReal + (int)next(1) - (int)InstructionType::AddReal);
+						i++;
+						break;
+					default:
+						break;
+					}
+					ins = fused;
+				}
+				else if ((next(1) == InstructionType::Incr || next(1) == InstructionType::Decr) && next(2) == InstructionType::LStore)
+				{
+					ins = IntermediateInstruction(next(1) == InstructionType::Incr ? InstructionType::LLoadIncrLStore : InstructionType::LLoadDecrLStore, code[i+2].first);
+					ins.a = code[i].first;
+					i += 2;
+				}
+				break;
+			}
+		case InstructionType::LdInt:
+			{
+				switch (next(1))
+				{
+				case InstructionType::Add:
+					ins.type = InstructionType::LdIntAdd;
+					i++;
+					break;
+				case InstructionType::Sub:
+					ins.type = InstructionType::LdIntSub;
+					i++;
+					break;
+				case InstructionType::Mul:
+					ins.type = InstructionType::LdIntMul;
+					i++;
+					break;
+				case InstructionType::AddInt:
+				case InstructionType::SubInt:
+				case InstructionType::MulInt:
+					ins.type = (InstructionType)((int)InstructionType::LdIntAddInt + (int)next(1) - (int)InstructionType::AddInt);
+					i++;
+					break;
+				default:
+					break;
+				}
+				break;
+			}
+		case InstructionType::Eq:
+		case InstructionType::NotEq:
+		case InstructionType::Lt:
+		case InstructionType::Gt:
+		case InstructionType::LtE:
+		case InstructionType::GtE:
+			{
+				if (next(1) == InstructionType::JumpFalse)
+				{
+					//the fused jump takes over the label string
+					ins = code[++i];
+					ins.type = (InstructionType)((int)InstructionType::EqJumpFalse + (int)code[i-1].type - (int)InstructionType::Eq);
+				}
+				break;
+			}
+		case InstructionType::LtInt: case InstructionType::GtInt:
+		case InstructionType::LtEInt: case InstructionType::GtEInt:
+		case InstructionType::LtReal: case InstructionType::GtReal:
+		case InstructionType::LtEReal: case InstructionType::GtEReal:
+			{
+				if (next(1) == InstructionType::JumpFalse)
+				{
+					ins = code[++i];
+					ins.type = (InstructionType)((int)InstructionType::LtIntJumpFalse + (int)code[i-1].type - (int)InstructionType::LtInt);
+				}
+				break;
+			}
+		default:
+			break;
+		}
+		out.push_back(ins);
+	}
+	code = std::move(out);
+}
+
 bool CompilerContext::RegisterLocal(const std::string name)
 {
 	//neeed to store locals in a contiguous array, even with different scopes
@@ -178,13 +322,657 @@ bool CompilerContext::RegisterLocal(const std::string name)
 	LocalVariable var;
 	var.local = this->localindex++;
 	var.name = name;
+	var.scalar = false;
 	this->scope->localvars.push_back(var);
 
+	this->types.resize(this->localindex, StaticType::Unknown);
+	this->types[var.local] = StaticType::Unknown;
+	this->untyped.resize(this->localindex, false);
+	this->untyped[var.local] = this->capturednames.count(name) > 0;
+
 	out.push_back(IntermediateInstruction(InstructionType::Local, var.name, 0));
 
 	return true;
 }
 
+bool CompilerContext::RegisterObject(const std::string& name, const std::vector<std::string>& keys)
+{
+	//the object keeps its own local so redeclaring it is still caught, nothing ever gets stored in it
+	if (this->RegisterLocal(name) == false)
+		return false;
+	this->scope->localvars.back().scalar = true;
+
+	//the dot keeps these from clashing with anything declared in the script
+	for (auto& key: keys)
+		this->RegisterLocal(name + "." + key);
+	return true;
+}
+
+int CompilerContext::GetField(const std::string& object, const std::string& key)
+{
+	//the innermost declaration of the name decides, it can be shadowed by a real local
+	Scope* ptr = this->scope;
+	while (ptr)
+	{
+		for (unsigned int i = 0; i < ptr->localvars.size(); i++)
+		{
+			if (ptr->localvars[i].name != object)
+				continue;
+			if (ptr->localvars[i].scalar == false)
+				return -1;
+
+			std::string field = object + "." + key;
+			for (unsigned int f = i + 1; f < ptr->localvars.size(); f++)
+			{
+				if (ptr->localvars[f].name == field)
+					return ptr->localvars[f].local;
+			}
+			return -1;
+		}
+		ptr = ptr->previous;
+	}
+	return -1;
+}
+
+//register instruction for a binary operator, returns false if it doesnt have one
+static bool GetRegisterInstruction(TokenType operation, InstructionType& instruction)
+{
+	switch (operation)
+	{
+	case TokenType::Plus:
+	case TokenType::AddAssign:
+		instruction = InstructionType::RAdd;
+		return true;
+	case TokenType::Minus:
+	case TokenType::SubtractAssign:
+		instruction = InstructionType::RSub;
+		return true;
+	case TokenType::Asterisk:
+	case TokenType::MultiplyAssign:
+		instruction = InstructionType::RMul;
+		return true;
+	case TokenType::Slash:
+	case TokenType::DivideAssign:
+		instruction = InstructionType::RDiv;
+		return true;
+	case TokenType::Modulo:
+		instruction = InstructionType::RModulus;
+		return true;
+	case TokenType::Equals:
+		instruction = InstructionType::REq;
+		return true;
+	case TokenType::NotEqual:
+		instruction = InstructionType::RNotEq;
+		return true;
+	case TokenType::LessThan:
+		instruction = InstructionType::RLt;
+		return true;
+	case TokenType::GreaterThan:
+		instruction = InstructionType::RGt;
+		return true;
+	case TokenType::LessThanEqual:
+		instruction = InstructionType::RLtE;
+		return true;
+	case TokenType::GreaterThanEqual:
+		instruction = InstructionType::RGtE;
+		return true;
+	default:
+		return false;
+	}
+}
+
+int CompilerContext::GetLocal(const std::string& variable)
+{
+	Scope* ptr = this->scope;
+	while (ptr)
+	{
+		for (unsigned int i = 0; i < ptr->localvars.size(); i++)
+		{
+			if (ptr->localvars[i].name == variable)
+			{
+				//whoever asks uses it as a plain value
+				if (this->vararg && ptr->localvars[i].local == (int)this->arguments)
+					this->varargescapes = true;
+				return ptr->localvars[i].local;
+			}
+		}
+		ptr = ptr->previous;
+	}
+	return -1;
+}
+
+int CompilerContext::TypedLocal(const std::string& name)
+{
+	size_t dot = name.find('.');
+	if (dot != std::string::npos)
+		return this->GetField(name.substr(0, dot), name.substr(dot + 1));
+
+	Scope* ptr = this->scope;
+	while (ptr)
+	{
+		for (unsigned int i = 0; i < ptr->localvars.size(); i++)
+		{
+			if (ptr->localvars[i].name == name)
+				return ptr->localvars[i].scalar ? -1 : ptr->localvars[i].local;
+		}
+		ptr = ptr->previous;
+	}
+	return -1;
+}
+
+//the name a store to the expression goes to, if it can be a local
+static std::string TargetName(Expression* target)
+{
+	if (auto name = dynamic_cast<NameExpression*>(target))
+		return name->GetName();
+
+	auto index = dynamic_cast<IndexExpression*>(target);
+	auto object = index ? dynamic_cast<NameExpression*>(index->left) : 0;
+	auto key = index ? dynamic_cast<StringExpression*>(index->GetIndex()) : 0;
+	if (object && key && index->token.type == TokenType::Dot)
+		return object->GetName() + "." + key->GetValue();
+	return "";
+}
+
+static void FindNames(Expression* expr, std::unordered_set<std::string>& names)
+{
+	if (auto name = dynamic_cast<NameExpression*>(expr))
+		names.insert(name->GetName());
+
+	std::vector<Expression*> children;
+	expr->Children(children);
+	for (auto ii: children)
+	{
+		if (ii)
+			FindNames(ii, names);
+	}
+}
+
+void CompilerContext::CaptureNames(Expression* body)
+{
+	//anything a closure mentions could be one of our locals it changes whenever it gets called
+	if (dynamic_cast<FunctionExpression*>(body))
+	{
+		FindNames(body, this->capturednames);
+		return;
+	}
+
+	std::vector<Expression*> children;
+	body->Children(children);
+	for (auto ii: children)
+	{
+		if (ii)
+			this->CaptureNames(ii);
+	}
+}
+
+StaticType CompilerContext::Arithmetic(TokenType operation, StaticType left, StaticType right)
+{
+	bool numbers = left != StaticType::Unknown && right != StaticType::Unknown;
+	bool ints = left == StaticType::Int && right == StaticType::Int;
+	switch (operation)
+	{
+	case TokenType::Plus:
+	case TokenType::AddAssign:
+	case TokenType::Minus:
+	case TokenType::SubtractAssign:
+	case TokenType::Asterisk:
+	case TokenType::MultiplyAssign:
+	case TokenType::Slash:
+	case TokenType::DivideAssign:
+	case TokenType::Modulo:
+		//ints stay ints, anything else with a real in it becomes a real
+		return ints ? StaticType::Int : (numbers ? StaticType::Real : StaticType::Unknown);
+	case TokenType::Equals:
+	case TokenType::NotEqual:
+	case TokenType::LessThan:
+	case TokenType::GreaterThan:
+	case TokenType::LessThanEqual:
+	case TokenType::GreaterThanEqual:
+		return StaticType::Int;
+	default:
+		return StaticType::Unknown;
+	}
+}
+
+StaticType CompilerContext::TypeOf(Expression* expr, const LoopScan* scan)
+{
+	if (dynamic_cast<IntNumberExpression*>(expr))
+		return StaticType::Int;
+	if (dynamic_cast<RealNumberExpression*>(expr))
+		return StaticType::Real;
+
+	std::string name = TargetName(expr);
+	if (name.length())
+	{
+		if (scan)
+		{
+			auto resolved = scan->names.find(expr);
+			if (resolved != scan->names.end())
+				name = resolved->second;
+			auto type = scan->assumed.find(name);
+			if (type != scan->assumed.end())
+				return type->second;
+			if (name.find('#') != std::string::npos)
+				return StaticType::Unknown;
+		}
+		return this->Type(this->TypedLocal(name));
+	}
+
+	//anything that stores something while it gets computed is left unknown, the types could change halfway through
+	if (auto op = dynamic_cast<OperatorExpression*>(expr))
+		return Arithmetic(op->_operator.type, this->TypeOf(op->left, scan), this->TypeOf(op->right, scan));
+
+	auto prefix = dynamic_cast<PrefixExpression*>(expr);
+	if (prefix && prefix->_operator.type == TokenType::Minus)
+		return this->TypeOf(prefix->right, scan);
+
+	return StaticType::Unknown;
+}
+
+void CompilerContext::Assigned(Expression* target, StaticType type)
+{
+	std::string name = TargetName(target);
+	if (name.length())
+		this->Assigned(name, type);
+}
+
+void CompilerContext::Assigned(const std::string& name, StaticType type)
+{
+	int local = this->TypedLocal(name);
+	if (local >= 0 && local < (int)this->types.size())
+		this->types[local] = type;
+}
+
+void CompilerContext::Scan(Expression* expr, LoopScan& scan)
+{
+	//goes through the loop in the order it gets compiled, with the same scopes, so every name refers to what it will then
+	auto declare = [&](const std::string& name, Expression* value, ObjectExpression* object)
+	{
+		std::string key = name + "#" + std::to_string(scan.declarations++);
+		scan.scopes.back()[name] = key;
+		LoopScan::Assignment assignment = { key, value, TokenType::Assign, true };
+		scan.assignments.push_back(assignment);
+
+		//the fields only have types of their own if the object lives in locals
+		if (object)
+		{
+			for (auto& ii: *object->inits)
+			{
+				LoopScan::Assignment field = { key + "." + ii.first, ii.second, TokenType::Assign, true };
+				scan.assignments.push_back(field);
+			}
+		}
+	};
+	auto store = [&](Expression* target, Expression* value, TokenType operation)
+	{
+		auto name = scan.names.find(target);
+		if (name != scan.names.end())
+		{
+			LoopScan::Assignment assignment = { name->second, value, operation, false };
+			scan.assignments.push_back(assignment);
+		}
+	};
+	auto children = [&](Expression* parent)
+	{
+		std::vector<Expression*> children;
+		parent->Children(children);
+		for (auto ii: children)
+		{
+			if (ii)
+				this->Scan(ii, scan);
+		}
+	};
+
+	if (auto function = dynamic_cast<FunctionExpression*>(expr))
+	{
+		//what is inside runs some other time, only the name gets stored here
+		if (function->name)
+		{
+			this->Scan(function->name, scan);
+			store(function->name, 0, TokenType::Assign);
+		}
+		return;
+	}
+	if (auto local = dynamic_cast<LocalExpression*>(expr))
+	{
+		std::vector<std::string> keys;
+		auto object = local->ScalarObject(keys);
+		for (auto& define: *local->defines)
+		{
+			if (define.m_Experssion)
+				this->Scan(define.m_Experssion, scan);
+			declare(define.m_Name.text, define.m_Experssion, object);
+		}
+		return;
+	}
+	if (auto foreach = dynamic_cast<ForEachExpression*>(expr))
+	{
+		scan.scopes.push_back(std::map<std::string, std::string>());
+		declare(foreach->name.text, 0, 0);
+		this->Scan(foreach->container, scan);
+		this->Scan(foreach->block, scan);
+		scan.scopes.pop_back();
+		return;
+	}
+	if (dynamic_cast<ScopeExpression*>(expr))
+	{
+		scan.scopes.push_back(std::map<std::string, std::string>());
+		children(expr);
+		scan.scopes.pop_back();
+		return;
+	}
+
+	if (auto name = dynamic_cast<NameExpression*>(expr))
+		scan.names[expr] = scan.Resolve(name->GetName());
+
+	auto index = dynamic_cast<IndexExpression*>(expr);
+	auto object = index ? dynamic_cast<NameExpression*>(index->left) : 0;
+	auto key = index ? dynamic_cast<StringExpression*>(index->GetIndex()) : 0;
+	if (object && key && index->token.type == TokenType::Dot)
+		scan.names[expr] = scan.Resolve(object->GetName()) + "." + key->GetValue();
+
+	children(expr);
+
+	if (auto assign = dynamic_cast<AssignExpression*>(expr))
+		store(assign->left, assign->right, TokenType::Assign);
+	else if (auto assign = dynamic_cast<OperatorAssignExpression*>(expr))
+		store(assign->left, assign->right, assign->token.type);
+	else if (auto prefix = dynamic_cast<PrefixExpression*>(expr))
+	{
+		if (prefix->_operator.type == TokenType::Increment || prefix->_operator.type == TokenType::Decrement)
+			store(prefix->right, prefix->right, TokenType::Increment);
+	}
+	else if (auto postfix = dynamic_cast<PostfixExpression*>(expr))
+	{
+		if (postfix->_operator.type == TokenType::Increment || postfix->_operator.type == TokenType::Decrement)
+			store(postfix->left, postfix->left, TokenType::Increment);
+	}
+	else if (auto swap = dynamic_cast<SwapExpression*>(expr))
+	{
+		store(swap->left, swap->right, TokenType::Assign);
+		store(swap->right, swap->left, TokenType::Assign);
+	}
+}
+
+CompilerContext::TypeState CompilerContext::LoopTypes(const std::vector<Expression*>& loop)
+{
+	LoopScan scan;
+	scan.declarations = 0;
+	scan.scopes.push_back(std::map<std::string, std::string>());
+	for (auto ii: loop)
+	{
+		if (ii)
+			this->Scan(ii, scan);
+	}
+
+	//start from the types the locals have before the loop, and make a local unknown as soon as something
+	//in the loop could store another type in it, until every assignment keeps the type it got
+	for (auto& ii: scan.assignments)
+	{
+		int local = ii.declaration ? -1 : this->TypedLocal(ii.name);
+		if (local >= 0)
+			scan.assumed[ii.name] = this->Type(local);
+	}
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (auto& ii: scan.assignments)
+		{
+			StaticType type = StaticType::Unknown;
+			if (ii.value)
+				type = this->TypeOf(ii.value, &scan);
+			if (ii.value && ii.operation != TokenType::Assign && ii.operation != TokenType::Increment)
+			{
+				auto old = scan.assumed.find(ii.name);
+				type = Arithmetic(ii.operation, old == scan.assumed.end() ? StaticType::Unknown : old->second, type);
+			}
+
+			auto current = scan.assumed.find(ii.name);
+			if (current == scan.assumed.end())
+			{
+				//the first store to something declared in the loop decides, stores to globals are never known
+				scan.assumed[ii.name] = ii.declaration ? type : StaticType::Unknown;
+				changed = true;
+			}
+			else if (current->second != type && current->second != StaticType::Unknown)
+			{
+				current->second = StaticType::Unknown;
+				changed = true;
+			}
+		}
+	}
+
+	for (auto& ii: scan.assumed)
+	{
+		int local = ii.first.find('#') == std::string::npos ? this->TypedLocal(ii.first) : -1;
+		if (local >= 0)
+			this->types[local] = ii.second;
+	}
+	return this->types;
+}
+
+int CompilerContext::VarArgs(const std::string& variable)
+{
+	Scope* ptr = this->scope;
+	while (ptr)
+	{
+		for (unsigned int i = 0; i < ptr->localvars.size(); i++)
+		{
+			if (ptr->localvars[i].name == variable)
+				return (this->vararg && ptr->localvars[i].local == (int)this->arguments) ? ptr->localvars[i].local : -1;
+		}
+		ptr = ptr->previous;
+	}
+	return -1;
+}
+
+bool CompilerContext::IsIntLoop(Expression* condition, Expression* incr, IntLoop& loop)
+{
+	//condition must be a comparison of a local against an int literal or another local
+	auto op = dynamic_cast<OperatorExpression*>(condition);
+	if (op == 0)
+		return false;
+
+	switch (op->_operator.type)
+	{
+	case TokenType::LessThan:
+		loop.comparison = 0;
+		break;
+	case TokenType::LessThanEqual:
+		loop.comparison = 1;
+		break;
+	case TokenType::GreaterThan:
+		loop.comparison = 2;
+		break;
+	case TokenType::GreaterThanEqual:
+		loop.comparison = 3;
+		break;
+	default:
+		return false;
+	}
+
+	auto counter = dynamic_cast<NameExpression*>(op->left);
+	if (counter == 0 || (loop.counter = this->GetLocal(counter->GetName())) < 0)
+		return false;
+
+	//work out the step before allocating any constant for the limit
+	Expression* target = 0;
+	if (auto pre = dynamic_cast<PrefixExpression*>(incr))
+	{
+		target = pre->right;
+		loop.step = pre->_operator.type == TokenType::Increment ? 1 : -1;
+		if (pre->_operator.type != TokenType::Increment && pre->_operator.type != TokenType::Decrement)
+			return false;
+	}
+	else if (auto post = dynamic_cast<PostfixExpression*>(incr))
+	{
+		target = post->left;
+		loop.step = post->_operator.type == TokenType::Increment ? 1 : -1;
+		if (post->_operator.type != TokenType::Increment && post->_operator.type != TokenType::Decrement)
+			return false;
+	}
+	else if (auto assign = dynamic_cast<OperatorAssignExpression*>(incr))
+	{
+		auto num = dynamic_cast<IntNumberExpression*>(assign->right);
+		if (num == 0 || num->GetValue() < 1 || num->GetValue() > 127)
+			return false;
+
+		target = assign->left;
+		if (assign->token.type == TokenType::AddAssign)
+			loop.step = (int)num->GetValue();
+		else if (assign->token.type == TokenType::SubtractAssign)
+			loop.step = -(int)num->GetValue();
+		else
+			return false;
+	}
+
+	auto name = dynamic_cast<NameExpression*>(target);
+	if (name == 0 || name->GetName() != counter->GetName())
+		return false;
+
+	if (auto limit = dynamic_cast<NameExpression*>(op->right))
+	{
+		loop.limit = this->GetLocal(limit->GetName());
+		return loop.limit >= 0 && loop.limit != loop.counter;
+	}
+	if (auto num = dynamic_cast<IntNumberExpression*>(op->right))
+	{
+		loop.limit = this->Constant(num->GetValue());
+		return true;
+	}
+	return false;
+}
+
+bool CompilerContext::IsRegisterExpression(Expression* expr)
+{
+	if (dynamic_cast<IntNumberExpression*>(expr) || dynamic_cast<RealNumberExpression*>(expr))
+		return true;
+
+	if (auto name = dynamic_cast<NameExpression*>(expr))
+		return this->GetLocal(name->GetName()) >= 0;
+
+	if (auto op = dynamic_cast<OperatorExpression*>(expr))
+	{
+		InstructionType instruction;
+		return GetRegisterInstruction(op->_operator.type, instruction)
+			&& this->IsRegisterExpression(op->left) 
+			&& this->IsRegisterExpression(op->right);
+	}
+	return false;
+}
+
+void CompilerContext::RegisterCompile(Expression* expr, int dst)
+{
+	if (auto num = dynamic_cast<IntNumberExpression*>(expr))
+	{
+		this->RegisterInt(dst, num->GetValue());
+	}
+	else if (auto num = dynamic_cast<RealNumberExpression*>(expr))
+	{
+		this->RegisterReal(dst, num->GetValue());
+	}
+	else if (auto name = dynamic_cast<NameExpression*>(expr))
+	{
+		int src = this->GetLocal(name->GetName());
+		if (src != dst)
+			this->RegisterMove(dst, src);
+	}
+	else if (auto op = dynamic_cast<OperatorExpression*>(expr))
+	{
+		this->Line(op->_operator.line);
+
+		unsigned int used = this->tempsused;
+		int src1 = this->RegisterSource(op->left);
+		int src2 = this->RegisterSource(op->right);
+		this->RegisterOperation(op->_operator.type, dst, src1, src2);
+		this->tempsused = used;//free the temporaries
+	}
+}
+
+int CompilerContext::RegisterSource(Expression* expr)
+{
+	//locals can be used in place
+	if (auto name = dynamic_cast<NameExpression*>(expr))
+		return this->GetLocal(name->GetName());
+
+	if (auto num = dynamic_cast<IntNumberExpression*>(expr))
+		return this->Constant(num->GetValue());
+	if (auto num = dynamic_cast<RealNumberExpression*>(expr))
+		return this->Constant(num->GetValue());
+
+	int temp = this->AllocTemp();
+	this->RegisterCompile(expr, temp);
+	return temp;
+}
+
+int CompilerContext::AllocTemp()
+{
+	if (this->tempsused < this->temps.size())
+		return this->temps[this->tempsused++];
+
+	int local = this->localindex++;
+	this->temps.push_back(local);
+	this->tempsused++;
+
+	out.push_back(IntermediateInstruction(InstructionType::Local, "{temp}", 0));
+	return local;
+}
+
+int CompilerContext::Constant(int64_t value)
+{
+	auto ii = this->intconstants.find(value);
+	if (ii != this->intconstants.end())
+		return ii->second;
+
+	int local = this->localindex++;
+	this->intconstants[value] = local;
+	out.push_back(IntermediateInstruction(InstructionType::Local, "{constant}", 0));
+	return local;
+}
+
+int CompilerContext::Constant(double value)
+{
+	auto ii = this->realconstants.find(value);
+	if (ii != this->realconstants.end())
+		return ii->second;
+
+	int local = this->localindex++;
+	this->realconstants[value] = local;
+	out.push_back(IntermediateInstruction(InstructionType::Local, "{constant}", 0));
+	return local;
+}
+
+void CompilerContext::LoadConstants(unsigned int position)
+{
+	std::vector<IntermediateInstruction> loads;
+	for (auto ii: this->intconstants)
+	{
+		IntermediateInstruction ins = IntermediateInstruction(InstructionType::RLdInt, ii.first, true);
+		ins.first = ii.second;
+		loads.push_back(ins);
+	}
+	for (auto ii: this->realconstants)
+		loads.push_back(IntermediateInstruction(InstructionType::RLdReal, ii.second, ii.first));
+
+	this->out.insert(this->out.begin() + position, loads.begin(), loads.end());
+}
+
+void CompilerContext::RegisterOperation(TokenType operation, int dst, int src1, int src2)
+{
+	InstructionType instruction;
+	if (GetRegisterInstruction(operation, instruction) == false)
+		throw CompilerException(this->filename, this->lastline, "Operator has no register instruction!");
+
+	this->Stored(dst);
+	IntermediateInstruction ins = IntermediateInstruction(instruction, dst);
+	ins.a = src1;
+	ins.b = src2;
+	out.push_back(ins);
+}
+
 void CompilerContext::BinaryOperation(TokenType operation)
 {
 	switch (operation)
@@ -247,6 +1035,53 @@ void CompilerContext::BinaryOperation(TokenType operation)
 	}
 }
 
+void CompilerContext::BinaryOperation(TokenType operation, StaticType left, StaticType right)
+{
+	InstructionType instruction;
+	bool typed = left == right && left != StaticType::Unknown;
+	bool real = left == StaticType::Real;
+	switch (operation)
+	{
+	case TokenType::Plus:
+	case TokenType::AddAssign:
+		instruction = real ? InstructionType::AddReal : InstructionType::AddInt;
+		break;
+	case TokenType::Minus:
+	case TokenType::SubtractAssign:
+		instruction = real ? InstructionType::SubReal : InstructionType::SubInt;
+		break;
+	case TokenType::Asterisk:
+	case TokenType::MultiplyAssign:
+		instruction = real ? InstructionType::MulReal : InstructionType::MulInt;
+		break;
+	case TokenType::Slash:
+	case TokenType::DivideAssign:
+		//ints are left to the quickened division
+		typed = typed && real;
+		instruction = InstructionType::DivReal;
+		break;
+	case TokenType::LessThan:
+		instruction = real ? InstructionType::LtReal : InstructionType::LtInt;
+		break;
+	case TokenType::GreaterThan:
+		instruction = real ? InstructionType::GtReal : InstructionType::GtInt;
+		break;
+	case TokenType::LessThanEqual:
+		instruction = real ? InstructionType::LtEReal : InstructionType::LtEInt;
+		break;
+	case TokenType::GreaterThanEqual:
+		instruction = real ? InstructionType::GtEReal : InstructionType::GtEInt;
+		break;
+	default:
+		typed = false;
+	}
+
+	if (typed)
+		this->out.push_back(IntermediateInstruction(instruction));
+	else
+		this->BinaryOperation(operation);
+}
+
 void CompilerContext::UnaryOperation(TokenType operation)
 {
 	switch (operation)
@@ -277,6 +1112,7 @@ CompilerContext* CompilerContext::AddFunction(std::string name, unsigned int arg
 	newfun->uuid = this->uuid;
 	newfun->parent = this;
 	newfun->vararg = vararg;
+	newfun->registers = this->registers;
 	this->functions[fname] = newfun;
 
 	//store the function in the variable
@@ -297,7 +1133,7 @@ void CompilerContext::FinalizeFunction(CompilerContext* c)
 			if (i.second.uploaded == false)
 			{
 				i.second.uploaded = true;
-				out.push_back(IntermediateInstruction(InstructionType::CInit,i.second.localindex/*ptr->localvars[i].local*/, i.second.captureindex/*ptr->localvars[i].capture*/));
+				out.push_back(IntermediateInstruction(i.second.local ? InstructionType::CInit : InstructionType::CCopy, i.second.localindex, i.second.captureindex));
 			}
 		}
 	}
@@ -313,6 +1149,8 @@ void CompilerContext::Load(const std::string& variable)
 		{
 			if (ptr->localvars[i].name == variable)
 			{
+				if (this->vararg && ptr->localvars[i].local == (int)this->arguments)
+					this->varargescapes = true;
 				out.push_back(IntermediateInstruction(InstructionType::LLoad, ptr->localvars[i].local, 0));//i, ptr->level));
 				return;//exit the loops we found it
 			}
@@ -320,37 +1158,11 @@ void CompilerContext::Load(const std::string& variable)
 		ptr = ptr->previous;
 	}
 
-	int level = 0;
-	auto cur = this->parent;
-	auto prev = this;
-	while (cur)
+	int capture = this->Upvalue(variable);
+	if (capture >= 0)
 	{
-		ptr = cur->scope;
-		while (ptr)
-		{
-			//look for var in locals
-			for (unsigned int i = 0; i < ptr->localvars.size(); i++)
-			{
-				if (ptr->localvars[i].name == variable)
-				{
-					auto cpt = prev->captures.find(ptr->localvars[i].name);
-					if (cpt == prev->captures.end())
-					{
-						prev->captures[ptr->localvars[i].name] = Capture(level, ptr->localvars[i].local, prev->closures++);
-						cpt = prev->captures.find(ptr->localvars[i].name);
-
-						out.push_back(IntermediateInstruction(InstructionType::Capture, ptr->localvars[i].name, 0));
-					}
-
-					out.push_back(IntermediateInstruction(InstructionType::CLoad, cpt->second.captureindex/*ptr->localvars[i].capture*/, level));//i, ptr->level));
-					return;//exit the loops we found it
-				}
-			}
-			ptr = ptr->previous;
-		}
-		level--;
-		prev = cur;
-		cur = cur->parent;
+		out.push_back(IntermediateInstruction(InstructionType::CLoad, capture, 0));
+		return;
 	}
 
 	out.push_back(IntermediateInstruction(InstructionType::Load, variable));
@@ -367,6 +1179,9 @@ void CompilerContext::Store(const std::string& variable)
 		{
 			if (ptr->localvars[i].name == variable)
 			{
+				if (this->vararg && ptr->localvars[i].local == (int)this->arguments)
+					this->varargescapes = true;
+				this->Stored(ptr->localvars[i].local);
 				out.push_back(IntermediateInstruction(InstructionType::LStore, ptr->localvars[i].local, 0));//i, ptr->level));
 				return;//exit the loops we found it
 			}
@@ -374,41 +1189,51 @@ void CompilerContext::Store(const std::string& variable)
 		ptr = ptr->previous;
 	}
 
-	int level = 0;
-	auto cur = this->parent;
-	auto prev = this;
-	while(cur)
+	int capture = this->Upvalue(variable);
+	if (capture >= 0)
 	{
-		ptr = cur->scope;
-		while (ptr)
-		{
-			//look for var in locals
-			for (unsigned int i = 0; i < ptr->localvars.size(); i++)
-			{
-				if (ptr->localvars[i].name == variable)
-				{
-					//exit the loops we found it
-					auto cpt = prev->captures.find(ptr->localvars[i].name);
-					if (cpt == prev->captures.end())
-					{
-						prev->captures[ptr->localvars[i].name] = Capture(level, ptr->localvars[i].local, prev->closures++);
-						cpt = prev->captures.find(ptr->localvars[i].name);
+		out.push_back(IntermediateInstruction(InstructionType::CStore, capture, 0));
+		return;
+	}
+	globalvars.insert(variable);
+	out.push_back(IntermediateInstruction(InstructionType::Store, variable));
+}
 
-						out.push_back(IntermediateInstruction(InstructionType::Capture, ptr->localvars[i].name, 0));
-					}
+int CompilerContext::Upvalue(const std::string& variable)
+{
+	auto cpt = this->captures.find(variable);
+	if (cpt != this->captures.end())
+		return cpt->second.captureindex;
+	if (this->parent == 0)
+		return -1;
 
-					out.push_back(IntermediateInstruction(InstructionType::CStore, cpt->second.captureindex /*ptr->localvars[i].capture*/, level));//i, ptr->level));
-					return;
-				}
+	//look for var in the parent's locals, otherwise the parent has to capture it too
+	int index = -1;
+	bool local = false;
+	for (Scope* ptr = this->parent->scope; ptr && local == false; ptr = ptr->previous)
+	{
+		for (unsigned int i = 0; i < ptr->localvars.size(); i++)
+		{
+			if (ptr->localvars[i].name == variable)
+			{
+				if (this->parent->vararg && ptr->localvars[i].local == (int)this->parent->arguments)
+					this->parent->varargescapes = true;
+				index = ptr->localvars[i].local;
+				local = true;
+				if (index > this->parent->captured)
+					this->parent->captured = index;
+				break;
 			}
-			ptr = ptr->previous;
 		}
-		level--;
-		prev = cur;
-		cur = cur->parent;
 	}
-	globalvars.insert(variable);
-	out.push_back(IntermediateInstruction(InstructionType::Store, variable));
+	if (local == false)
+		index = this->parent->Upvalue(variable);
+	if (index < 0)
+		return -1;
+
+	this->captures[variable] = Capture(index, this->closures, local);
+	out.push_back(IntermediateInstruction(InstructionType::Capture, variable, 0));
+	return this->closures++;
 }
 
 void Jet::CompilerContext::StoreGlobal(const std::string& variable)
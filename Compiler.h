@@ -4,6 +4,7 @@
 #include <vector>
 #include <map>
 #include <unordered_set>
+#include <algorithm>
 #include <stdint.h>
 
 #include "Token.h"
@@ -85,6 +86,15 @@ namespace Jet
 	};
 
 	class BlockExpression;
+	class Expression;
+
+	//what the compiler has proven about the type of a value, it picks the typed instructions
+	enum class StaticType : char
+	{
+		Unknown,
+		Int,
+		Real
+	};
 
 	template <class T, class T2, class T3>
 	struct triple
@@ -117,6 +127,7 @@ namespace Jet
 		{
 			int local;
 			std::string name;
+			bool scalar;//an object literal that never escapes, its fields are the locals named name.key in the same scope
 		};
 
 		struct Scope
@@ -134,15 +145,71 @@ namespace Jet
 		unsigned int localindex;//next open local index
 
 		bool vararg; bool isgenerator;
+		bool varargescapes;//the vararg local is used as a value somewhere, so it needs a real array
 		unsigned int closures;//number of closures we have
+		int captured;//highest local a closure captures, -1 if none, Close instructions below it have nothing to do
 		unsigned int arguments;//number of arguments we have
 
 		CompilerContext* parent;//parent scoping function
 
 		std::vector<IntermediateInstruction> out;//list of instructions generated
 
+		std::vector<int> temps;//locals allocated for register temporaries
+		unsigned int tempsused;//number of temporaries currently in use
+		std::map<int64_t, int> intconstants;//locals holding constants used by register instructions
+		std::map<double, int> realconstants;//these get loaded once at the start of the function
+
+		std::vector<StaticType> types;//type each local is known to have at this point of the function, indexed by local
+		std::vector<bool> untyped;//locals a call could change, their type is never known
+		std::unordered_set<std::string> capturednames;//names used inside closures, locals with them are untyped
+
+		//what LoopTypes finds in a loop before it gets compiled, locals declared in the loop get #number after their name
+		struct LoopScan
+		{
+			struct Assignment
+			{
+				std::string name;//the local, or object.key for a field of a scalar replaced object
+				Expression* value;//0 if the type is unknown
+				TokenType operation;//Assign for a plain store, Increment for ++ and --, otherwise the operator applied to the old value
+				bool declaration;
+			};
+			std::vector<Assignment> assignments;
+			std::map<Expression*, std::string> names;//what each name used in the loop refers to
+			std::vector<std::map<std::string, std::string>> scopes;//the ones declared in the loop so far
+			std::map<std::string, StaticType> assumed;//type each local keeps through the loop
+			int declarations;
+
+			std::string Resolve(const std::string& name)
+			{
+				for (auto ii = this->scopes.rbegin(); ii != this->scopes.rend(); ii++)
+				{
+					auto declared = ii->find(name);
+					if (declared != ii->end())
+						return declared->second;
+				}
+				return name;
+			}
+		};
+		void Scan(Expression* expr, LoopScan& scan);
+		StaticType Type(int local)
+		{
+			if (local < 0 || local >= (int)this->types.size() || this->untyped[local])
+				return StaticType::Unknown;
+			if (this->vararg && local == (int)this->arguments)
+				return StaticType::Unknown;
+			return this->types[local];
+		}
+		int TypedLocal(const std::string& name);//the local a name or object.key refers to or -1
+		void Stored(int local)//anything stored without being told its type is unknown
+		{
+			if (local >= 0 && local < (int)this->types.size())
+				this->types[local] = StaticType::Unknown;
+		}
+
 	public:
 
+		bool registers;//use register instructions for arithmetic on locals
+
 		CompilerContext(void);
 		~CompilerContext(void);
 
@@ -153,16 +220,27 @@ namespace Jet
 		void FinalizeFunction(CompilerContext* c);
 
 		std::vector<IntermediateInstruction> Compile(BlockExpression* expr, const char* filename);
+
+		//fuses common instruction sequences into superinstructions, run on the output of Compile before assembling it
+		static void Optimize(std::vector<IntermediateInstruction>& code);
 	private:
 		void Compile()
 		{
+			//every closure in the function has been compiled by now, so it is known which locals got captured
+			this->out.erase(std::remove_if(this->out.begin(), this->out.end(), [this](const IntermediateInstruction& ins)
+			{
+				return ins.type == InstructionType::Close && ins.first > this->captured;
+			}), this->out.end());
+
 			//append functions to end here
 			for (auto fun: this->functions)
 			{
 				fun.second->Compile();
+				fun.second->LoadConstants(0);
 
 				//need to set var with the function name and location
-				this->FunctionLabel(fun.first, fun.second->arguments, fun.second->localindex, fun.second->closures, fun.second->vararg, fun.second->isgenerator);
+				bool stackvarargs = fun.second->vararg && fun.second->varargescapes == false && fun.second->isgenerator == false;
+				this->FunctionLabel(fun.first, fun.second->arguments, fun.second->localindex, fun.second->closures, fun.second->vararg, fun.second->isgenerator, stackvarargs);
 				for (auto ins: fun.second->out)
 					this->out.push_back(ins);
 
@@ -170,13 +248,13 @@ namespace Jet
 			}
 		}
 
-		void FunctionLabel(std::string name, int args, int locals, int upvals, bool vararg = false, bool isgenerator = false)
+		void FunctionLabel(std::string name, int args, int locals, int upvals, bool vararg = false, bool isgenerator = false, bool stackvarargs = false)
 		{
 			IntermediateInstruction ins = IntermediateInstruction(InstructionType::Function, name, args);
 			ins.a = args;
 			ins.b = locals;
 			ins.c = upvals;
-			ins.d = vararg + isgenerator*2;
+			ins.d = vararg + isgenerator*2 + stackvarargs*4;
 			out.push_back(ins);
 		}
 
@@ -234,8 +312,80 @@ namespace Jet
 		}
 
 		bool RegisterLocal(const std::string name);//returns success
+		bool RegisterObject(const std::string& name, const std::vector<std::string>& keys);//declares a scalar replaced object literal, returns success
+		int GetField(const std::string& object, const std::string& key);//returns the local holding a field of a scalar replaced object or -1
+
+		//flow sensitive types of locals, where both operands are known a typed instruction is used that skips checking them
+		typedef std::vector<StaticType> TypeState;
+		void CaptureNames(Expression* body);//finds the names used by closures in the body, call before registering any locals
+		StaticType TypeOf(Expression* expr, const LoopScan* scan = 0);//type the value of the expression is known to have
+		static StaticType Arithmetic(TokenType operation, StaticType left, StaticType right);//type of the result of a binary operator
+		void Assigned(Expression* target, StaticType type);//the target was just stored a value of the type
+		void Assigned(const std::string& name, StaticType type);
+		TypeState LoopTypes(const std::vector<Expression*>& loop);//sets the types that hold on every pass through the loop, they are the ones after it too
+		TypeState GetTypes()
+		{
+			return this->types;
+		}
+		void SetTypes(const TypeState& state)
+		{
+			this->types = state;
+		}
+		void Meet(const TypeState& other)//where two paths join only the types both agree on are kept
+		{
+			for (unsigned int i = 0; i < this->types.size(); i++)
+			{
+				if (i >= other.size() || other[i] != this->types[i])
+					this->types[i] = StaticType::Unknown;
+			}
+		}
+
+		//register code generation
+		int GetLocal(const std::string& variable);//returns the local index of a variable in this function or -1
+		int VarArgs(const std::string& variable);//returns the local if the variable is the varargs of this function or -1
+		bool IsRegisterExpression(Expression* expr);//if the expression can be compiled to register instructions
+		void RegisterCompile(Expression* expr, int dst);//compiles the expression so its value ends up in local dst
+		int RegisterSource(Expression* expr);//returns a local holding the value of the expression
+		int AllocTemp();
+		int Constant(int64_t value);
+		int Constant(double value);
+		void LoadConstants(unsigned int position);//inserts the loads of the constant locals at position
+		void FreeTemps()//temporaries never live past the statement that made them
+		{
+			this->tempsused = 0;
+		}
+		void RegisterOperation(TokenType operation, int dst, int src1, int src2);
+
+		void RegisterMove(int dst, int src)
+		{
+			this->Stored(dst);
+			IntermediateInstruction ins = IntermediateInstruction(InstructionType::RMove, dst);
+			ins.a = src;
+			out.push_back(ins);
+		}
+
+		void RegisterIncrement(TokenType operation, int local)
+		{
+			this->Stored(local);
+			out.push_back(IntermediateInstruction(operation == TokenType::Increment ? InstructionType::RIncr : InstructionType::RDecr, local));
+		}
+
+		void RegisterInt(int dst, int64_t value)
+		{
+			this->Stored(dst);
+			IntermediateInstruction ins = IntermediateInstruction(InstructionType::RLdInt, value, true);
+			ins.first = dst;
+			out.push_back(ins);
+		}
+
+		void RegisterReal(int dst, double value)
+		{
+			this->Stored(dst);
+			out.push_back(IntermediateInstruction(InstructionType::RLdReal, dst, value));
+		}
 
 		void BinaryOperation(TokenType operation);
+		void BinaryOperation(TokenType operation, StaticType left, StaticType right);//uses a typed instruction if the types allow it
 		void UnaryOperation(TokenType operation);
 
 		//stack operations
@@ -296,22 +446,62 @@ namespace Jet
 			out.push_back(IntermediateInstruction(InstructionType::Jump, pos));
 		}
 
+		//pushes the next value from the container in local and its state in local+1 or jumps to end
+		void ForEach(int local, const char* end)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::ForEach, end, local));
+		}
+
+		//a for loop counting a local towards another local by a small constant step
+		struct IntLoop
+		{
+			int counter, limit;
+			int comparison;//0 <, 1 <=, 2 >, 3 >=
+			int step;
+		};
+		bool IsIntLoop(Expression* condition, Expression* incr, IntLoop& loop);//if the loop can use ForIntPrep/ForIntLoop
+
+		//jumps to end if the loop condition already fails
+		void ForIntPrep(const IntLoop& loop, const char* end)
+		{
+			this->ForInt(InstructionType::ForIntPrep, loop, end);
+		}
+
+		//steps the counter and jumps to body while the loop condition holds
+		void ForIntLoop(const IntLoop& loop, const char* body)
+		{
+			this->ForInt(InstructionType::ForIntLoop, loop, body);
+		}
+
+		void ForInt(InstructionType type, const IntLoop& loop, const char* label)
+		{
+			IntermediateInstruction ins(type, label);
+			ins.a = loop.counter;
+			ins.b = loop.limit;
+			ins.c = loop.comparison;
+			ins.d = (unsigned char)(signed char)loop.step;
+			out.push_back(ins);
+		}
+
 		void Label(const std::string& name)
 		{
 			out.push_back(IntermediateInstruction(InstructionType::Label, name));
 		}
 
+		//every function holds the captures it uses itself, a local of the parent gets captured from its stack
+		//and anything further out gets shared from the parent's own captures when the closure is made
 		struct Capture
 		{
-			int localindex;
-			int level;
+			int localindex;//local of the parent, or the parent's capture if it isnt a local
+			bool local;
 			int captureindex;
 			bool uploaded;
 			Capture() {}
 
-			Capture(int l, int li, int ci) : localindex(li), level(l), captureindex(ci) {uploaded = false;}
+			Capture(int li, int ci, bool local) : localindex(li), local(local), captureindex(ci) {uploaded = false;}
 		};
 		std::map<std::string, Capture> captures;
+		int Upvalue(const std::string& variable);//returns the capture for a local of an enclosing function, adding it if needed, or -1
 
 		void Store(const std::string& variable);
 		void StoreGlobal(const std::string& variable);
@@ -388,6 +578,37 @@ namespace Jet
 			out.push_back(IntermediateInstruction(InstructionType::ECall, args));
 		}
 
+		void MCall(unsigned int args, unsigned int results)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::MCall, (int)args, (double)results));
+		}
+
+		void TailCall(unsigned int args, bool varargs = false)//varargs if PushVarArgs added to them
+		{
+			out.push_back(IntermediateInstruction(InstructionType::TailCall, (int)args, varargs ? 1.0 : 0.0));
+		}
+
+		//these read the varargs through their local without loading it, so they dont make it escape
+		void VarArg(int local)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::VarArg, local));
+		}
+
+		void VarArgCount(int local)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::VarArgCount, local));
+		}
+
+		void PushVarArgs(int local)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::PushVarArgs, local));
+		}
+
+		void VCall(unsigned int args, unsigned int results = 1)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::VCall, (int)args, (double)results));
+		}
+
 		void LoadIndex(const char* index = 0)
 		{
 			out.push_back(IntermediateInstruction(InstructionType::LoadAt, index));
@@ -415,6 +636,12 @@ namespace Jet
 			out.push_back(IntermediateInstruction(InstructionType::Return));
 		}
 
+		void ReturnN(unsigned int count)
+		{
+			out.push_back(IntermediateInstruction(InstructionType::Close));
+			out.push_back(IntermediateInstruction(InstructionType::ReturnN, count));
+		}
+
 		void Yield()
 		{
 			out.push_back(IntermediateInstruction(InstructionType::Yield));
@@ -8,6 +8,17 @@ void PrefixExpression::Compile(CompilerContext* context)
 {
 	context->Line(this->_operator.line);
 
+	//increment a local in place if nobody needs the result
+	auto name = dynamic_cast<NameExpression*>(this->right);
+	auto type = context->TypeOf(this->right);//++ and -- keep the type of a number
+	if (context->registers && name && context->GetLocal(name->GetName()) >= 0 && dynamic_cast<BlockExpression*>(this->Parent)
+		&& (this->_operator.type == TokenType::Increment || this->_operator.type == TokenType::Decrement))
+	{
+		context->RegisterIncrement(this->_operator.type, context->GetLocal(name->GetName()));
+		context->Assigned(this->right, type);
+		return;
+	}
+
 	right->Compile(context);
 
 	context->UnaryOperation(this->_operator.type);
@@ -30,6 +41,8 @@ void PrefixExpression::Compile(CompilerContext* context)
 					context->Duplicate();
 
 				location->CompileStore(context);
+				if (this->_operator.type == TokenType::Increment || this->_operator.type == TokenType::Decrement)
+					context->Assigned(this->right, type);
 			}
 			else if (dynamic_cast<BlockExpression*>(this->Parent) != 0)
 				context->Pop();
@@ -41,6 +54,17 @@ void PostfixExpression::Compile(CompilerContext* context)
 {
 	context->Line(this->_operator.line);
 
+	//increment a local in place if nobody needs the result
+	auto name = dynamic_cast<NameExpression*>(this->left);
+	auto type = context->TypeOf(this->left);
+	if (context->registers && name && context->GetLocal(name->GetName()) >= 0 && dynamic_cast<BlockExpression*>(this->Parent)
+		&& (this->_operator.type == TokenType::Increment || this->_operator.type == TokenType::Decrement))
+	{
+		context->RegisterIncrement(this->_operator.type, context->GetLocal(name->GetName()));
+		context->Assigned(this->left, type);
+		return;
+	}
+
 	left->Compile(context);
 
 	if (dynamic_cast<BlockExpression*>(this->Parent) == 0 && dynamic_cast<IStorableExpression*>(this->left))
@@ -49,7 +73,11 @@ void PostfixExpression::Compile(CompilerContext* context)
 	context->UnaryOperation(this->_operator.type);
 
 	if (dynamic_cast<IStorableExpression*>(this->left))
+	{
 		dynamic_cast<IStorableExpression*>(this->left)->CompileStore(context);
+		if (this->_operator.type == TokenType::Increment || this->_operator.type == TokenType::Decrement)
+			context->Assigned(this->left, type);
+	}
 	else if (dynamic_cast<BlockExpression*>(this->Parent) != 0)
 		context->Pop();
 }
@@ -58,16 +86,33 @@ void IndexExpression::Compile(CompilerContext* context)
 {
 	context->Line(token.line);
 
-	left->Compile(context);
-	//if the index is constant compile to a special instruction carying that constant
-	if (auto string = dynamic_cast<StringExpression*>(index))
+	//indexing the varargs reads them in place
+	auto name = dynamic_cast<NameExpression*>(left);
+	int varargs;
+	if (name && token.type != TokenType::Dot && token.type != TokenType::Colon && (varargs = context->VarArgs(name->GetName())) >= 0)
+	{
+		index->Compile(context);
+		context->VarArg(varargs);
+	}
+	else if (name && token.type == TokenType::Dot && dynamic_cast<StringExpression*>(index)
+		&& context->GetField(name->GetName(), static_cast<StringExpression*>(index)->GetValue()) >= 0)
 	{
-		context->LoadIndex(string->GetValue().c_str());
+		//field of an object literal that got replaced by locals
+		context->Load(name->GetName() + "." + static_cast<StringExpression*>(index)->GetValue());
 	}
 	else
 	{
-		index->Compile(context);
-		context->LoadIndex();
+		left->Compile(context);
+		//if the index is constant compile to a special instruction carying that constant
+		if (auto string = dynamic_cast<StringExpression*>(index))
+		{
+			context->LoadIndex(string->GetValue().c_str());
+		}
+		else
+		{
+			index->Compile(context);
+			context->LoadIndex();
+		}
 	}
 
 	if (dynamic_cast<BlockExpression*>(this->Parent) != 0)
@@ -78,6 +123,14 @@ void IndexExpression::CompileStore(CompilerContext* context)
 {
 	context->Line(token.line);
 
+	auto name = dynamic_cast<NameExpression*>(left);
+	auto key = dynamic_cast<StringExpression*>(index);
+	if (name && key && token.type == TokenType::Dot && context->GetField(name->GetName(), key->GetValue()) >= 0)
+	{
+		context->Store(name->GetName() + "." + key->GetValue());
+		return;
+	}
+
 	left->Compile(context);
 	//if the index is constant compile to a special instruction carying that constant
 	if (auto string = dynamic_cast<StringExpression*>(index))
@@ -111,6 +164,40 @@ void ObjectExpression::Compile(CompilerContext* context)
 		context->Pop();
 }
 
+bool ObjectExpression::Escapes(Expression* parent, Expression* expr, const std::string& name, bool nested)
+{
+	if (expr == 0)
+		return false;
+
+	//the only use allowed is reading or writing one of the keys it was made with, and not from a closure
+	auto var = dynamic_cast<NameExpression*>(expr);
+	if (var && var->GetName() == name)
+	{
+		auto index = dynamic_cast<IndexExpression*>(parent);
+		auto key = index ? dynamic_cast<StringExpression*>(index->GetIndex()) : 0;
+		if (nested || key == 0 || index->left != expr || index->token.type != TokenType::Dot)
+			return true;
+		for (auto ii: *this->inits)
+		{
+			if (ii.first == key->GetValue())
+				return false;
+		}
+		return true;
+	}
+
+	if (dynamic_cast<FunctionExpression*>(expr))
+		nested = true;
+
+	std::vector<Expression*> children;
+	expr->Children(children);
+	for (auto ii: children)
+	{
+		if (this->Escapes(expr, ii, name, nested))
+			return true;
+	}
+	return false;
+}
+
 void ArrayExpression::Compile(CompilerContext* context)
 {
 	int count = (int)this->initializers.size();
@@ -162,6 +249,8 @@ void RealNumberExpression::Compile(CompilerContext* context)
 
 void SwapExpression::Compile(CompilerContext* context)
 {
+	auto ltype = context->TypeOf(this->left);
+	auto rtype = context->TypeOf(this->right);
 	right->Compile(context);
 	left->Compile(context);
 
@@ -173,25 +262,57 @@ void SwapExpression::Compile(CompilerContext* context)
 
 	if (auto lstorable = dynamic_cast<IStorableExpression*>(this->left))
 		lstorable->CompileStore(context);
+
+	context->Assigned(this->right, ltype);
+	context->Assigned(this->left, rtype);
 }
 
 void AssignExpression::Compile(CompilerContext* context)
 {
+	auto name = dynamic_cast<NameExpression*>(this->left);
+	auto type = context->TypeOf(this->right);
+	if (context->registers && name && context->GetLocal(name->GetName()) >= 0 && context->IsRegisterExpression(this->right))
+	{
+		context->RegisterCompile(this->right, context->GetLocal(name->GetName()));
+		context->Assigned(this->left, type);
+
+		if (dynamic_cast<BlockExpression*>(this->Parent) == 0)
+			context->Load(name->GetName());
+		return;
+	}
+
 	this->right->Compile(context);
 
 	if (dynamic_cast<BlockExpression*>(this->Parent) == 0)
 		context->Duplicate();//if my parent is not block expression, we need the result, so push it
 
 	if (auto storable = dynamic_cast<IStorableExpression*>(this->left))
+	{
 		storable->CompileStore(context);
+		context->Assigned(this->left, type);
+	}
 }
 
 void CallExpression::Compile(CompilerContext* context)
 {
 	context->Line(token.line);
 
+	auto index = dynamic_cast<IndexExpression*>(left);
+	auto name = index ? dynamic_cast<NameExpression*>(index->left) : 0;
+	auto member = index ? dynamic_cast<StringExpression*>(index->index) : 0;
+	int local;
+	if (this->varargs)
+	{
+		this->CompileResults(context, 1);
+	}
+	else if (name && member && index->token.type == TokenType::Colon && args->size() == 0 && member->GetValue() == "size"
+		&& (local = context->VarArgs(name->GetName())) >= 0)
+	{
+		//the number of varargs, without making an array for them
+		context->VarArgCount(local);
+	}
 	//need to check if left is a local, or a captured value before looking at globals
-	if (dynamic_cast<NameExpression*>(left) && context->IsLocal(dynamic_cast<NameExpression*>(left)->GetName()) == false)
+	else if (dynamic_cast<NameExpression*>(left) && context->IsLocal(dynamic_cast<NameExpression*>(left)->GetName()) == false)
 	{
 		//push args onto stack
 		for (auto i: *args)
@@ -201,7 +322,6 @@ void CallExpression::Compile(CompilerContext* context)
 	}
 	else// if (dynamic_cast<IStorableExpression*>(left) != 0)
 	{
-		auto index = dynamic_cast<IndexExpression*>(left);
 		if (index && index->token.type == TokenType::Colon)//its a "self" call
 		{
 			index->left->Compile(context);//push object as the first argument
@@ -232,12 +352,73 @@ void CallExpression::Compile(CompilerContext* context)
 	//{
 	//throw ParserException(token.filename, token.line, "Error: Cannot call an expression that is not a name");
 	//}
-	//help, how should I handle this for multiple returns
+	//only the first return value is kept here, the return drops the rest
 	//pop off return value if we dont need it
 	if (dynamic_cast<BlockExpression*>(this->Parent))
 		context->Pop();//if my parent is block expression, we dont the result, so pop it
 }
 
+void CallExpression::CompileResults(CompilerContext* context, unsigned int results)
+{
+	context->Line(token.line);
+
+	//always done with the function on the stack so the call can say how many results it wants
+	auto index = dynamic_cast<IndexExpression*>(left);
+	unsigned int count = (unsigned int)args->size();
+	if (index && index->token.type == TokenType::Colon)
+	{
+		index->left->Compile(context);//push object as the first argument
+		count++;
+	}
+	for (auto i: *args)
+		i->Compile(context);
+
+	if (this->varargs)
+	{
+		//the varargs get pushed where the caller left them followed by their count
+		int local = context->VarArgs(this->varargs->GetName());
+		if (local < 0)
+			throw CompilerException(context->filename, token.line, "Only the varargs of the current function can be forwarded");
+		context->PushVarArgs(local);
+		left->Compile(context);
+		context->VCall(count, results);
+	}
+	else
+	{
+		left->Compile(context);
+		context->MCall(count, results);
+	}
+}
+
+void CallExpression::CompileTail(CompilerContext* context)
+{
+	context->Line(token.line);
+
+	auto index = dynamic_cast<IndexExpression*>(left);
+	unsigned int count = (unsigned int)args->size();
+	if (index && index->token.type == TokenType::Colon)//its a "self" call
+	{
+		index->left->Compile(context);//push object as the first argument
+		count++;
+	}
+	for (auto i: *args)
+		i->Compile(context);
+
+	//the varargs are copied to the top of the stack, so the frame can still be reused
+	int local = -1;
+	if (this->varargs)
+	{
+		local = context->VarArgs(this->varargs->GetName());
+		if (local < 0)
+			throw CompilerException(context->filename, token.line, "Only the varargs of the current function can be forwarded");
+		context->PushVarArgs(local);
+	}
+
+	//globals get loaded too, the function has to be on the stack
+	left->Compile(context);
+	context->TailCall(count, local >= 0);
+}
+
 void NameExpression::Compile(CompilerContext* context)
 {
 	//add load variable instruction
@@ -251,17 +432,49 @@ void NameExpression::Compile(CompilerContext* context)
 void OperatorAssignExpression::Compile(CompilerContext* context)
 {
 	context->Line(token.line);
+
+	auto name = dynamic_cast<NameExpression*>(this->left);
+	if (context->registers && name && context->GetLocal(name->GetName()) >= 0 && context->IsRegisterExpression(this->right))
+	{
+		switch (token.type)
+		{
+		case TokenType::AddAssign:
+		case TokenType::SubtractAssign:
+		case TokenType::MultiplyAssign:
+		case TokenType::DivideAssign:
+			{
+				auto type = CompilerContext::Arithmetic(token.type, context->TypeOf(this->left), context->TypeOf(this->right));
+				int local = context->GetLocal(name->GetName());
+				int src = context->RegisterSource(this->right);
+				context->RegisterOperation(token.type, local, local, src);
+				context->FreeTemps();
+				context->Assigned(this->left, type);
+
+				if (dynamic_cast<BlockExpression*>(this->Parent) == 0)
+					context->Load(name->GetName());
+				return;
+			}
+		default:
+			break;
+		}
+	}
+
 	//https://dl.dropboxusercontent.com/u/675786/ShareX/2015-02/08_22-33-22.png fix this
+	auto ltype = context->TypeOf(this->left);
 	this->left->Compile(context);
+	auto rtype = context->TypeOf(this->right);
 	this->right->Compile(context);
-	context->BinaryOperation(token.type);
+	context->BinaryOperation(token.type, ltype, rtype);
 
 	//insert store here
 	if (dynamic_cast<BlockExpression*>(this->Parent) == 0)
 		context->Duplicate();//if my parent is not block expression, we need the result, so push it
 
 	if (auto storable = dynamic_cast<IStorableExpression*>(this->left))
+	{
 		storable->CompileStore(context);
+		context->Assigned(this->left, CompilerContext::Arithmetic(token.type, ltype, rtype));
+	}
 }
 
 void OperatorExpression::Compile(CompilerContext* context)
@@ -274,8 +487,10 @@ void OperatorExpression::Compile(CompilerContext* context)
 		this->left->Compile(context);
 		context->JumpFalsePeek(label.c_str());//jump to endand if false
 		context->Pop();
+		auto skipped = context->GetTypes();
 		this->right->Compile(context);
 		context->Label(label);//put endand label here
+		context->Meet(skipped);
 		return;
 	}
 
@@ -285,14 +500,18 @@ void OperatorExpression::Compile(CompilerContext* context)
 		this->left->Compile(context);
 		context->JumpTruePeek(label.c_str());//jump to endor if true
 		context->Pop();
+		auto skipped = context->GetTypes();
 		this->right->Compile(context);
 		context->Label(label);//put endor label here
+		context->Meet(skipped);
 		return;
 	}
 
+	auto ltype = context->TypeOf(this->left);
 	this->left->Compile(context);
+	auto rtype = context->TypeOf(this->right);
 	this->right->Compile(context);
-	context->BinaryOperation(this->_operator.type);
+	context->BinaryOperation(this->_operator.type, ltype, rtype);
 
 	//pop off if we dont need the result
 	if (dynamic_cast<BlockExpression*>(this->Parent))
@@ -312,6 +531,7 @@ void FunctionExpression::Compile(CompilerContext* context)
 	CompilerContext* function = context->AddFunction(fname, (unsigned int)this->args->size(), this->varargs != nullptr);
 	//ok, kinda hacky
 	int start = (int)context->out.size();
+	function->CaptureNames(this->block);
 
 	//ok push locals, in opposite order
 	for (unsigned int i = 0; i < this->args->size(); i++)
@@ -349,30 +569,121 @@ void FunctionExpression::Compile(CompilerContext* context)
 }
 
 
+ObjectExpression* LocalExpression::ScalarObject(std::vector<std::string>& keys)
+{
+	//an object literal only ever used through its fields in the rest of the block can live in locals instead
+	auto object = dynamic_cast<ObjectExpression*>((*this->defines)[0].m_Experssion);
+	auto block = dynamic_cast<BlockExpression*>(this->Parent);
+	if (object == 0 || object->inits == 0 || object->inits->size() == 0 || this->defines->size() != 1 || block == 0)
+		return 0;
+
+	keys.clear();
+	for (auto ii: *object->inits)
+	{
+		if (std::find(keys.begin(), keys.end(), ii.first) == keys.end())
+			keys.push_back(ii.first);
+	}
+
+	auto statement = std::find(block->statements.begin(), block->statements.end(), this);
+	if (keys.size() != object->inits->size() || statement == block->statements.end())
+		return 0;
+	for (statement++; statement != block->statements.end(); statement++)
+	{
+		if (object->Escapes(block, *statement, (*this->defines)[0].m_Name.text, false))
+			return 0;
+	}
+	return object;
+}
+
 void Jet::LocalExpression::Compile(CompilerContext* context)
 {
 	context->Line((*defines)[0].m_Name.line);
 
+	//names without a value right before one set to a call all get one of its return values
+	std::vector<Token> names;
+	auto declare = [&]()
+	{
+		for (auto& name : names)
+		{
+			if (context->RegisterLocal(name.getText()) == false)
+				throw CompilerException(context->filename, name.line, "Duplicate Local Variable '" + name.text + "'");
+		}
+	};
 	for (auto v : *this->defines)
 	{
-		//ʽֵ
+		auto call = dynamic_cast<CallExpression*>(v.m_Experssion);
+		if (v.m_Experssion == nullptr)
+		{
+			names.push_back(v.m_Name);
+			continue;
+		}
+		else if (call && names.size() > 0)
+		{
+			names.push_back(v.m_Name);
+			call->CompileResults(context, (unsigned int)names.size());
+			declare();
+			//the last value is on top
+			for (auto ii = names.rbegin(); ii != names.rend(); ii++)
+				context->StoreLocal(ii->text);
+			names.clear();
+			continue;
+		}
+
+		declare();
+		names.clear();
+
+		std::vector<std::string> keys;
+		if (auto object = this->ScalarObject(keys))
+		{
+			//the values get worked out before the name is declared, they could use another local of the same name
+			std::vector<StaticType> types;
+			for (auto ii: *object->inits)
+			{
+				types.push_back(context->TypeOf(ii.second));
+				ii.second->Compile(context);
+			}
+
+			if (context->RegisterObject(v.m_Name.text, keys) == false)
+				throw CompilerException(context->filename, v.m_Name.line, "Duplicate Local Variable '" + v.m_Name.text + "'");
+
+			for (auto ii = object->inits->rbegin(); ii != object->inits->rend(); ii++)
+				context->StoreLocal(v.m_Name.text + "." + ii->first);
+			for (unsigned int i = 0; i < types.size(); i++)
+				context->Assigned(v.m_Name.text + "." + (*object->inits)[i].first, types[i]);
+			continue;
+		}
+
+		//the expression only reads locals, so if none of them has this name we can compute straight into the new local
+		auto type = v.m_Experssion ? context->TypeOf(v.m_Experssion) : StaticType::Unknown;
+		if (context->registers && v.m_Experssion != nullptr && context->GetLocal(v.m_Name.text) < 0 && context->IsRegisterExpression(v.m_Experssion))
+		{
+			context->RegisterLocal(v.m_Name.text);
+			context->RegisterCompile(v.m_Experssion, context->GetLocal(v.m_Name.text));
+			context->Assigned(v.m_Name.text, type);
+			continue;
+		}
+
+		//计算表达式的值
 		if (v.m_Experssion != nullptr)
 		{
 			v.m_Experssion->Compile(context);
 		}
 
-		//
+		//创建变量
 		if (context->RegisterLocal(v.m_Name.getText()) == false)
 		{
 			throw CompilerException(context->filename, v.m_Name.line, "Duplicate Local Variable '" + v.m_Name.text + "'");
 		}
 
-		//ݴ洢
+		//将数据存储到变量
 		if (v.m_Experssion != nullptr)
 		{
 			context->StoreLocal(v.m_Name.text);
+			context->Assigned(v.m_Name.text, type);
 		}
 	}
+
+	declare();
 }
 
 
@@ -382,13 +693,13 @@ void GlobalExpression::Compile(CompilerContext* context)
 
 	for (auto v : *this->defines)
 	{
-		//ʽֵ
+		//计算表达式的值
 		if (v.m_Experssion != nullptr)
 		{
 			v.m_Experssion->Compile(context);
 		}
 
-		//ݴ洢
+		//将数据存储到变量
 		if (v.m_Experssion != nullptr)
 		{
 			context->StoreGlobal(v.m_Name.text);
@@ -398,9 +709,9 @@ void GlobalExpression::Compile(CompilerContext* context)
 
 void Jet::ClassExpression::Compile(CompilerContext* context)
 {
-	printf("class %s ӵ%dֶΣ%dԱ\n", m_Name.c_str(), (int)m_Fields.size(), (int)m_Functions.size());
-	//ÿclassӦһClassΪObjectclassȫݣҸҪĬϹ캯ע⣺ҪǼ̳е
-	//new classʱ캯ķֵһObjectĳԱͳԱƸObjectֶҪcloneֱӸƣ
+	printf("class %s 拥有%d个字段，%d个成员函数\n", m_Name.c_str(), (int)m_Fields.size(), (int)m_Functions.size());
+	//每个class对应一个以Class为名的Object对象，这个对象包含了class的全部数据，并且根据需要添加默认构造函数。注意：需要考虑继承的问题
+	//new class时，构造函数的返回值是一个Object，并将自身的成员变量和成员函数复制给该Object（字段需要clone，函数可以直接复制）
 	/*for (auto& i : m_Functions)
 	{
 	i.second->Compile(context);
@@ -33,6 +33,11 @@ namespace Jet
 		}
 
 		virtual void Compile(CompilerContext* context) = 0;
+
+		//adds the expressions directly under this one, for analyses that walk the tree
+		virtual void Children(std::vector<Expression*>& out)
+		{
+		}
 	};
 
 	class IStorableExpression
@@ -108,11 +113,18 @@ namespace Jet
 			//}
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.insert(out.end(), this->initializers.begin(), this->initializers.end());
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class ObjectExpression: public Expression
 	{
+		friend class LocalExpression;
+		friend class CompilerContext;
 		std::vector<std::pair<std::string, Expression*>>* inits;
 	public:
 		ObjectExpression()
@@ -140,27 +152,37 @@ namespace Jet
 					ii.second->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			if (this->inits)
+				for (auto ii: *this->inits)
+					out.push_back(ii.second);
+		}
+
+		bool Escapes(Expression* parent, Expression* expr, const std::string& name, bool nested);//if the local holding this object is used as more than name.key in expr
+
 		void Compile(CompilerContext* context);
 	};
 
 	/// <summary>
-	/// 
+	/// 变量定义
 	/// </summary>
 	struct VarDefine 
 	{
 		/// <summary>
-		/// 
+		/// 变量名
 		/// </summary>
 		Token		m_Name;
 
 		/// <summary>
-		/// ʼʽ
+		/// 变量初始化表达式
 		/// </summary>
 		Expression*	m_Experssion = nullptr;
 	};
 
 	class LocalExpression: public Expression
 	{
+		friend class CompilerContext;
 		std::vector<VarDefine>*	defines = nullptr;
 	public:
 		LocalExpression(std::vector<VarDefine>* _defines)
@@ -192,6 +214,17 @@ namespace Jet
 			}
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			for (auto d : *this->defines)
+			{
+				if (d.m_Experssion != nullptr)
+					out.push_back(d.m_Experssion);
+			}
+		}
+
+		ObjectExpression* ScalarObject(std::vector<std::string>& keys);//the object literal this declares if it can live in locals, with its keys
+
 		void Compile(CompilerContext* context);
 	};
 
@@ -228,6 +261,15 @@ namespace Jet
 			}
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			for (auto d : *this->defines)
+			{
+				if (d.m_Experssion != nullptr)
+					out.push_back(d.m_Experssion);
+			}
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
@@ -299,6 +341,7 @@ namespace Jet
 
 	class IndexExpression: public Expression, public IStorableExpression
 	{
+		friend class CallExpression;
 		Expression*index;
 	public:
 		Expression* left;
@@ -316,6 +359,17 @@ namespace Jet
 			delete index;
 		}
 
+		Expression* GetIndex()
+		{
+			return this->index;
+		}
+
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.push_back(this->index);
+		}
+
 		void Compile(CompilerContext* context);
 
 		void CompileStore(CompilerContext* context);
@@ -323,6 +377,7 @@ namespace Jet
 
 	class AssignExpression: public Expression
 	{
+		friend class CompilerContext;
 		Expression* left;
 		Expression* right;
 	public:
@@ -345,11 +400,18 @@ namespace Jet
 			left->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class OperatorAssignExpression: public Expression
 	{
+		friend class CompilerContext;
 		Token token;
 
 		Expression* left;
@@ -375,11 +437,18 @@ namespace Jet
 			left->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class SwapExpression: public Expression
 	{
+		friend class CompilerContext;
 		Expression* left;
 		Expression* right;
 	public:
@@ -402,11 +471,18 @@ namespace Jet
 			left->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class PrefixExpression: public Expression
 	{
+		friend class CompilerContext;
 		Token _operator;
 
 		Expression* right;
@@ -428,11 +504,17 @@ namespace Jet
 			right->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class PostfixExpression: public Expression
 	{
+		friend class CompilerContext;
 		Token _operator;
 
 		Expression* left;
@@ -454,11 +536,17 @@ namespace Jet
 			left->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
 	class OperatorExpression: public Expression
 	{
+		friend class CompilerContext;
 		Token _operator;
 
 		Expression* left, *right;
@@ -484,6 +572,12 @@ namespace Jet
 			right->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
@@ -522,6 +616,11 @@ namespace Jet
 				ii->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.insert(out.end(), this->statements.begin(), this->statements.end());
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			for (auto ii: statements)
@@ -581,11 +680,18 @@ namespace Jet
 			condition->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->condition);
+			out.push_back(this->block);
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			context->Line(token.line);
 
 			std::string uuid = context->GetUUID();
+			auto head = context->LoopTypes({ this->condition, this->block });
 			context->Label("loopstart_"+uuid);
 			this->condition->Compile(context);
 			context->JumpFalse(("loopend_"+uuid).c_str());
@@ -596,6 +702,7 @@ namespace Jet
 
 			context->Jump(("loopstart_"+uuid).c_str());
 			context->Label("loopend_"+uuid);
+			context->SetTypes(head);
 		}
 	};
 
@@ -631,12 +738,40 @@ namespace Jet
 			initial->SetParent(block);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->initial);
+			out.push_back(this->condition);
+			out.push_back(this->incr);
+			out.push_back(this->block);
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			context->Line(token.line);
 
 			std::string uuid = context->GetUUID();
 			this->initial->Compile(context);
+			auto head = context->LoopTypes({ this->condition, this->block, this->incr });
+
+			CompilerContext::IntLoop loop;
+			if (context->IsIntLoop(this->condition, this->incr, loop))
+			{
+				//counting loop, the compare and step are done by one instruction at the bottom
+				context->ForIntPrep(loop, ("forloopend_"+uuid).c_str());
+				context->Label("forloopbody_"+uuid);
+
+				context->PushLoop("forloopend_"+uuid, "forloopcontinue_"+uuid);
+				this->block->Compile(context);
+				context->PopLoop();
+
+				context->Label("forloopcontinue_"+uuid);
+				context->ForIntLoop(loop, ("forloopbody_"+uuid).c_str());
+				context->Label("forloopend_"+uuid);
+				context->SetTypes(head);
+				return;
+			}
+
 			context->Label("forloopstart_"+uuid);
 			this->condition->Compile(context);
 			context->JumpFalse(("forloopend_"+uuid).c_str());
@@ -650,11 +785,13 @@ namespace Jet
 			this->incr->Compile(context);
 			context->Jump(("forloopstart_"+uuid).c_str());
 			context->Label("forloopend_"+uuid);
+			context->SetTypes(head);
 		}
 	};
 
 	class ForEachExpression: public Expression
 	{
+		friend class CompilerContext;
 		Token name;
 		Expression* container;
 		ScopeExpression* block;
@@ -678,51 +815,41 @@ namespace Jet
 			block->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->container);
+			out.push_back(this->block);
+		}
+
 		void Compile(CompilerContext* context)
 		{
+			auto head = context->LoopTypes({ this });
 			context->PushScope();
 
 			auto uuid = context->GetUUID();
 			context->RegisterLocal(this->name.text);
 			context->RegisterLocal("_iter");
+			context->RegisterLocal("_iterstate");
 
-			//context->Load(this->container.text);
+			//ForEach keeps the container and its position in these two locals
 			this->container->Compile(context);
-			context->Duplicate();
-			context->LoadIndex("iterator");
-			context->ECall(1);
-			//context->Duplicate();
 			context->Store("_iter");
-			//context->JumpFalse(("_foreachend"+uuid).c_str());
+			context->Null();
+			context->Store("_iterstate");
 
 			context->Label("_foreachstart"+uuid);
-
-			context->Load("_iter");
-			context->Duplicate();
-			context->LoadIndex("advance");
-			context->ECall(1);
-			context->JumpFalse(("_foreachend"+uuid).c_str());
-
-			context->Load("_iter");
-			context->Duplicate();
-			context->LoadIndex("current");
-			context->ECall(1);
+			context->ForEach(context->GetLocal("_iter"), ("_foreachend"+uuid).c_str());
 			context->Store(this->name.text);
 
-			//context->ForEach(this->name.text, "_foreachstart"+uuid, "_foreachend"+uuid);
-			//finish implementing foreach instructions
 			context->PushLoop("_foreachend"+uuid, "_foreachstart"+uuid);
 			this->block->Compile(context);
 			context->PopLoop();
 
-			//context->PostForEach(
-
-			
-
 			context->Jump(("_foreachstart"+uuid).c_str());
 			context->Label("_foreachend"+uuid);
 
 			context->PopScope();
+			context->SetTypes(head);
 		}
 	};
 
@@ -784,6 +911,17 @@ namespace Jet
 			}
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			for (auto& ii: branches)
+			{
+				out.push_back(ii->condition);
+				out.push_back(ii->block);
+			}
+			if (this->Else)
+				out.push_back(this->Else->block);
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			context->Line(token.line);
@@ -792,12 +930,14 @@ namespace Jet
 			std::string bname = "ifstatement_" + uuid + "_I";
 			int pos = 0;
 			bool hasElse = this->Else ? this->Else->block->statements.size() > 0 : false;
+			std::vector<CompilerContext::TypeState> ends;//types at the end of each branch, they all meet at the end
 			for (auto& ii: this->branches)
 			{
 				if (pos != 0)//no jump label needed on first one
 					context->Label(bname);
 
 				ii->condition->Compile(context);
+				auto skipped = context->GetTypes();
 
 				//if no else and is last go to end
 				if (hasElse == false && pos == (this->branches.size()-1))
@@ -806,6 +946,8 @@ namespace Jet
 					context->JumpFalse((bname+"I").c_str());
 
 				ii->block->Compile(context);
+				ends.push_back(context->GetTypes());
+				context->SetTypes(skipped);
 
 				if (pos != (this->branches.size()-1) || hasElse)//if isnt last one
 					context->Jump(("ifstatementend_"+uuid).c_str());
@@ -820,6 +962,8 @@ namespace Jet
 				this->Else->block->Compile(context);
 			}
 			context->Label("ifstatementend_"+uuid);
+			for (auto& ii: ends)
+				context->Meet(ii);
 		}
 	};
 
@@ -828,18 +972,21 @@ namespace Jet
 		Token token;
 		Expression* left;
 		std::vector<Expression*>* args;
+		NameExpression* varargs;//forwarded with ...name after the other arguments
 	public:
 		friend class FunctionParselet;
-		CallExpression(Token token, Expression* left, std::vector<Expression*>* args)
+		CallExpression(Token token, Expression* left, std::vector<Expression*>* args, NameExpression* varargs = 0)
 		{
 			this->token = token;
 			this->left = left;
 			this->args = args;
+			this->varargs = varargs;
 		}
 
 		~CallExpression()
 		{
 			delete this->left;
+			delete this->varargs;
 			if (args)
 			{
 				for (auto ii: *args)
@@ -855,13 +1002,26 @@ namespace Jet
 			left->SetParent(this);
 			for (auto ii: *args)
 				ii->SetParent(this);
+			if (varargs)
+				varargs->SetParent(this);
+		}
+
+		void Children(std::vector<Expression*>& out)
+		{
+			out.push_back(this->left);
+			out.insert(out.end(), this->args->begin(), this->args->end());
+			if (this->varargs)
+				out.push_back(this->varargs);
 		}
 
 		void Compile(CompilerContext* context);
+		void CompileTail(CompilerContext* context);//compiles the call as the last thing the function does
+		void CompileResults(CompilerContext* context, unsigned int results);//leaves that many of the return values on the stack
 	};
 
 	class FunctionExpression: public Expression
 	{
+		friend class CompilerContext;
 		Expression* name;
 		std::vector<Expression*>* args;
 		ScopeExpression* block;
@@ -904,6 +1064,16 @@ namespace Jet
 				ii->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			if (this->name)
+				out.push_back(this->name);
+			out.insert(out.end(), this->args->begin(), this->args->end());
+			if (this->varargs)
+				out.push_back(this->varargs);
+			out.push_back(this->block);
+		}
+
 		void Compile(CompilerContext* context);
 	};
 
@@ -911,16 +1081,25 @@ namespace Jet
 	{
 		Token token;
 		Expression* right;
+		std::vector<Expression*>* values;//when more than one value is returned
 	public:
-		ReturnExpression(Token token, Expression* right)
+		ReturnExpression(Token token, Expression* right, std::vector<Expression*>* values = 0)
 		{
 			this->token = token;
 			this->right = right;
+			this->values = values;
 		}
 
 		~ReturnExpression()
 		{
 			delete this->right;
+			if (values)
+			{
+				for (auto ii: *values)
+					delete ii;
+
+				delete values;
+			}
 		}
 
 		void SetParent(Expression* parent)
@@ -928,13 +1107,37 @@ namespace Jet
 			this->Parent = parent;
 			if (right)
 				this->right->SetParent(this);
+			if (values)
+			{
+				for (auto ii: *values)
+					ii->SetParent(this);
+			}
+		}
+
+		void Children(std::vector<Expression*>& out)
+		{
+			if (this->right)
+				out.push_back(this->right);
+			if (this->values)
+				out.insert(out.end(), this->values->begin(), this->values->end());
 		}
 
 		void Compile(CompilerContext* context)
 		{
 			context->Line(token.line);
 
-			if (right)
+			if (values)
+			{
+				//they stay on the stack, the caller takes as many as it wants
+				for (auto ii: *values)
+					ii->Compile(context);
+				context->ReturnN((unsigned int)values->size());
+				return;
+			}
+
+			if (auto call = dynamic_cast<CallExpression*>(right))
+				call->CompileTail(context);//only falls through to the return if the frame couldnt be reused
+			else if (right)
 				right->Compile(context);
 			else
 				context->Null();//bad value to prevent use
@@ -990,6 +1193,12 @@ namespace Jet
 				right->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			if (this->right)
+				out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			if (right)
@@ -1022,6 +1231,12 @@ namespace Jet
 				right->SetParent(this);
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			if (this->right)
+				out.push_back(this->right);
+		}
+
 		void Compile(CompilerContext* context)
 		{
 			this->right->Compile(context);
@@ -1078,6 +1293,17 @@ namespace Jet
 			}
 		}
 
+		void Children(std::vector<Expression*>& out)
+		{
+			for (auto& i : m_Functions)
+				out.push_back(i.second);
+			for (auto& i : m_Fields)
+			{
+				if (i.m_Experssion != nullptr)
+					out.push_back(i.m_Experssion);
+			}
+		}
+
 		void Compile(CompilerContext* context);
 	};
 }
@@ -5,10 +5,51 @@ using namespace Jet;
 
 //#define JETGCDEBUG
 
-GarbageCollector::GarbageCollector(JetContext* context) : context(context)
+GarbageCollector::GarbageCollector(JetContext* context) : context(context), greys(64, 0xFFFFFFFF)
 {
 	this->allocationCounter = 1;//messes up if these start at 0
 	this->collectionCounter = 1;
+	this->allocated = this->peak = this->quota = 0;
+}
+
+size_t GarbageCollector::Size(gcval* obj)
+{
+	switch (obj->type)
+	{
+	case ValueType::Function:
+		{
+			Closure* fun = (Closure*)obj;
+			size_t size = sizeof(Closure) + fun->numupvals*sizeof(Capture*);
+			if (fun->generator)
+				size += sizeof(Generator) + fun->prototype->locals*sizeof(Value);
+			return size;
+		}
+	case ValueType::Object:
+		return ((JetObject*)obj)->Size();
+	case ValueType::Array:
+		return sizeof(JetArray) + ((JetArray*)obj)->accounted*sizeof(Value);
+	case ValueType::Userdata:
+		return sizeof(JetUserdata);
+	case ValueType::String:
+		return sizeof(JetString) + ((JetString*)obj)->length;
+	case ValueType::Capture:
+		return sizeof(Capture);
+	default:
+		return 0;
+	}
+}
+
+void GarbageCollector::OverQuota()
+{
+	//collecting here could free whatever the caller is still holding, so just have the next check do it
+	this->context->Recheck();
+}
+
+void GarbageCollector::Reclaim(size_t bytes)
+{
+	this->Run(true);
+	if (this->allocated + bytes > this->quota)
+		throw RuntimeException("Out of memory!");
 }
 
 void GarbageCollector::Cleanup()
@@ -71,30 +112,23 @@ void GarbageCollector::Cleanup()
 		case (int)ValueType::Function:
 			{
 				Closure* fun = (Closure*)ii;
-				if (fun->numupvals)
-					delete[] fun->upvals;
 				delete fun->generator;
-				delete fun;
+				delete[] (char*)fun;
 				break;
 			}
 		case (int)ValueType::Object:
 			delete (JetObject*)ii;
 			break;
 		case (int)ValueType::Array:
-			((JetArray*)ii)->data.~vector();
-			delete[] (char*)ii;
+			delete ((JetArray*)ii);
 			break;
 		case (int)ValueType::Userdata:
 			//did in first pass
 			delete (JetUserdata*)ii;
 			break;
 		case (int)ValueType::String:
-			{
-				JetString* str = (JetString*)ii;
-				delete[] str->data;
-				delete str;
-				break;
-			}
+			delete[] (char*)ii;
+			break;
 		case (int)ValueType::Capture:
 			{
 				Capture* c = (Capture*)ii;
@@ -111,10 +145,8 @@ void GarbageCollector::Cleanup()
 		case (int)ValueType::Function:
 			{
 				Closure* fun = (Closure*)ii;
-				if (fun->numupvals)
-					delete[] fun->upvals;
 				delete fun->generator;
-				delete fun;
+				delete[] (char*)fun;
 				break;
 			}
 		case (int)ValueType::Object:
@@ -128,12 +160,8 @@ void GarbageCollector::Cleanup()
 			delete (JetUserdata*)ii;
 			break;
 		case (int)ValueType::String:
-			{
-				JetString* str = (JetString*)ii;
-				delete[] str->data;
-				delete str;
-				break;
-			}
+			delete[] (char*)ii;
+			break;
 		case (int)ValueType::Capture:
 			{
 				Capture* c = (Capture*)ii;
@@ -207,19 +235,18 @@ void GarbageCollector::Mark()
 
 
 	//this is really part of the sweep section
+	//locals live in the stack with everything else, so only the closures of the frames are left
 	if (context->callstack.size() > 0)
 	{
-		//traverse all local vars
 		if (context->curframe && context->curframe->grey == false)
 		{
 			context->curframe->grey = true;
 			this->greys.Push(Value(context->curframe));
 		}
 
-		int sp = 0;
 		for (unsigned int i = 0; i < context->callstack.size(); i++)
 		{
-			auto closure = context->callstack[i].second;
+			auto closure = context->callstack[i].closure;
 			if (closure == 0)
 				continue;
 
@@ -228,35 +255,6 @@ void GarbageCollector::Mark()
 				closure->grey = true;
 				this->greys.Push(Value(closure));
 			}
-			int max = sp+closure->prototype->locals;
-			for (; sp < max; sp++)
-			{
-				if (context->localstack[sp].type > ValueType::NativeFunction)
-				{
-					if (context->localstack[sp]._object->grey == false)
-					{
-						context->localstack[sp]._object->grey = true;
-						this->greys.Push(context->localstack[sp]);
-					}
-				}
-			}
-		}
-
-		//mark curframe locals
-		if (context->curframe)
-		{
-			int max = sp+context->curframe->prototype->locals;
-			for (; sp < max; sp++)
-			{
-				if (context->localstack[sp].type > ValueType::NativeFunction)
-				{
-					if (context->localstack[sp]._object->grey == false)
-					{
-						context->localstack[sp]._object->grey = true;
-						this->greys.Push(context->localstack[sp]);
-					}
-				}
-			}
 		}
 	}
 
@@ -298,6 +296,7 @@ void GarbageCollector::Mark()
 			case ValueType::Array:
 				{
 					obj._array->mark = true;
+					this->Track(obj._array);
 
 					for (auto ii: obj._array->data)
 					{
@@ -326,11 +325,6 @@ void GarbageCollector::Mark()
 			case ValueType::Function:
 				{
 					obj._function->mark = true;
-					if (obj._function->prev && obj._function->prev->grey == false)
-					{
-						obj._function->prev->grey = true;
-						greys.Push(Value(obj._function->prev));
-					}
 
 					if (obj._function->numupvals)
 					{
@@ -339,16 +333,13 @@ void GarbageCollector::Mark()
 							auto uv = obj._function->upvals[i];
 							if (uv && uv->grey == false)
 							{
-								if (uv->closed)
+								//mark the value stored in it, open ones can point into a generator that isn't reachable anymore
+								if (uv->v->type > ValueType::NativeFunction)
 								{
-									//mark the value stored in it
-									if (uv->value.type > ValueType::NativeFunction)
+									if (uv->v->_object->grey == false)
 									{
-										if (uv->value._object->grey == false)
-										{
-											uv->value._object->grey = true;
-											greys.Push(uv->value);
-										}
+										uv->v->_object->grey = true;
+										greys.Push(*uv->v);
 									}
 								}
 								//mark it
@@ -392,10 +383,10 @@ void GarbageCollector::Mark()
 	}
 }
 
-void GarbageCollector::Sweep()
+void GarbageCollector::Sweep(bool full)
 {
 	bool nextIncremental = ((this->collectionCounter+1)%GC_STEPS)!=0;
-	bool incremental = ((this->collectionCounter)%GC_STEPS)!=0;
+	bool incremental = !full && ((this->collectionCounter)%GC_STEPS)!=0;
 
 	/* SWEEPING SECTION */
 
@@ -458,7 +449,7 @@ void GarbageCollector::Sweep()
 	//3. All other objects are assumed to be still reachable during a minor GC and are neither traversed, nor swept, nor are their marks changed (kept black). A regular sweep phase is used if a major collection is to follow.
 }
 
-void GarbageCollector::Run()
+void GarbageCollector::Run(bool full)
 {
 	//printf("Running GC: %d Greys, %d Globals, %d Stack\n%d Closures, %d Arrays, %d Objects, %d Userdata\n", this->greys.size(), this->vars.size(), 0, this->closures.size(), this->arrays.size(), this->objects.size(), this->userdata.size());
 #ifdef JET_TIME_EXECUTION
@@ -466,11 +457,18 @@ void GarbageCollector::Run()
 	//QueryPerformanceFrequency( (LARGE_INTEGER *)&rate );
 	QueryPerformanceCounter( (LARGE_INTEGER *)&start );
 #endif
+	if (full)
+	{
+		//old objects stay marked between collections, forget that so only reachable ones survive this time
+		for (auto ii: this->gen2)
+			ii->mark = ii->grey = false;
+	}
+
 	//mark all references in the grey stack
 	this->Mark();
 
 	//clear up dead memory
-	this->Sweep();
+	this->Sweep(full);
 
 	this->collectionCounter++;//used to determine collection mode
 #ifdef JET_TIME_EXECUTION
@@ -488,6 +486,7 @@ void GarbageCollector::Run()
 
 void GarbageCollector::Free(gcval* ii)
 {
+	this->Account(-(ptrdiff_t)Size(ii));
 	switch (ii->type)
 	{
 	case (int)ValueType::Function:
@@ -498,11 +497,11 @@ void GarbageCollector::Free(gcval* ii)
 
 			fun->generator = (Generator*)0xcdcdcdcd;
 #else
-			if (fun->numupvals)
-				delete[] fun->upvals;
-
+			//closures made inside it can outlive a suspended generator
+			if (fun->generator)
+				fun->generator->Close();
 			delete fun->generator;
-			delete fun;
+			delete[] (char*)fun;
 #endif
 			break;
 		}
@@ -510,7 +509,7 @@ void GarbageCollector::Free(gcval* ii)
 		{
 #ifdef JETGCDEBUG
 			JetObject* obj = (JetObject*)ii;
-			obj->nodes = (ObjNode*)0xcdcdcdcd;
+			obj->slots = (Value*)0xcdcdcdcd;
 #else
 			delete (JetObject*)ii;
 #endif
@@ -542,8 +541,9 @@ void GarbageCollector::Free(gcval* ii)
 	case (int)ValueType::String:
 		{
 			JetString* str = (JetString*)ii;
-			delete[] str->data;
-			delete str;
+			if (str->interned)
+				this->context->Unintern(str);
+			delete[] (char*)str;
 			break;
 		}
 	case (int)ValueType::Capture:
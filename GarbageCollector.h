@@ -36,6 +36,10 @@ namespace Jet
 		int collectionCounter;//state of the gc
 		VMStack<Value> greys;//stack of grey objects for processing
 
+		size_t allocated;//bytes held by live gc objects, their backing storage and the shapes
+		size_t peak;//most bytes ever allocated at once
+		size_t quota;//most bytes allowed before scripts get an out of memory error, 0 for no limit
+
 		GarbageCollector(JetContext* context);
 
 		void Cleanup();
@@ -43,6 +47,7 @@ namespace Jet
 		inline void AddObject(gcval* obj)
 		{
 			this->gen1.push_back(obj);
+			this->Account((ptrdiff_t)Size(obj));
 		}
 
 		template<class T> 
@@ -50,7 +55,7 @@ namespace Jet
 		{
 			//need to call constructor
 			T* buf = new T();
-			this->gen1.push_back((gcval*)buf);
+			this->AddObject((gcval*)buf);
 			return (T*)(buf);
 		}
 
@@ -60,17 +65,7 @@ namespace Jet
 		{
 			//need to call constructor
 			T* buf = new T(arg1);
-			this->gen1.push_back((gcval*)buf);
-			return (T*)(buf);
-		}
-
-		//hack for strings
-		template<class T> 
-		T* New(char* arg1)
-		{
-			//need to call constructor
-			T* buf = new T(arg1);
-			this->gen1.push_back((gcval*)buf);
+			this->AddObject((gcval*)buf);
 			return (T*)(buf);
 		}
 
@@ -80,7 +75,7 @@ namespace Jet
 		{
 			//need to call constructor
 			T* buf = new T(arg1, arg2);
-			this->gen1.push_back((gcval*)buf);
+			this->AddObject((gcval*)buf);
 			//new (buf) T(arg1, arg2);
 			return (T*)(buf);
 
@@ -92,11 +87,44 @@ namespace Jet
 #endif
 		}
 
-		void Run();
+		void Run(bool full = false);
+
+		//counts memory changing hands, allocating never collects so going over the quota
+		//just has the vm collect at its next check
+		inline void Account(ptrdiff_t bytes)
+		{
+			this->allocated += bytes;
+			if (this->allocated > this->peak)
+				this->peak = this->allocated;
+			if (this->quota && this->allocated > this->quota)
+				this->OverQuota();
+		}
+
+		//counts any change in the size of an array's backing storage
+		inline void Track(JetArray* arr)
+		{
+			if (arr->data.capacity() != arr->accounted)
+			{
+				this->Account(((ptrdiff_t)arr->data.capacity() - (ptrdiff_t)arr->accounted)*(ptrdiff_t)sizeof(Value));
+				arr->accounted = (unsigned int)arr->data.capacity();
+			}
+		}
+
+		//makes room for bytes more under the quota before they get allocated, running a full collection
+		//if they wouldn't fit and throwing if they still don't, only call this when everything live is rooted
+		inline void Reserve(size_t bytes)
+		{
+			if (this->quota && this->allocated + bytes > this->quota)
+				this->Reclaim(bytes);
+		}
+
+		static size_t Size(gcval* obj);//bytes held by a gc object
 
 	private:
 		void Mark();
-		void Sweep();
+		void Sweep(bool full);
+		void OverQuota();
+		void Reclaim(size_t bytes);
 
 		void Free(gcval* val);
 	};
@@ -1,9 +1,11 @@
 #include "JetContext.h"
+#include "JetJIT.h"
 #include "UniquePtr.h"
 
 #include <stack>
 #include <fstream>
 #include <memory>
+#include <chrono>
 
 #undef Yield
 
@@ -159,29 +161,148 @@ Value JetContext::NewUserdata(void* data, const Value& proto)
 
 Value JetContext::NewString(const char* string, bool copy)
 {
-	if (copy)
-	{
-		size_t len = strlen(string);
-		auto temp = new char[len+1];
-		memcpy(temp, string, len);
-		temp[len] = 0;
-		string = temp;
-	}
-	auto str = gc.New<GCVal<char*>>((char*)string);
+	JetString* str = this->AllocString(string, (unsigned int)strlen(string));
+	if (copy == false)
+		delete[] string;
+	return Value(str);
+}
+
+JetString* JetContext::AllocString(const char* string, unsigned int length)
+{
+	//the characters go right after the header in the same block
+	auto str = (JetString*)new char[sizeof(JetString) + length];
 	str->grey = str->mark = false;
 	str->refcount = 0;
 	str->type = ValueType::String;
+	str->interned = str->constant = false;
+	str->length = length;
 	str->context = this;
-	return Value(str);
+	str->next = 0;
+	memcpy(str->data, string, length);
+	str->data[length] = 0;
+	str->hash = JetString::Hash(str->data, length);
+	gc.AddObject((GarbageCollector::gcval*)str);
+	return str;
+}
+
+Closure* JetContext::AllocClosure(Function* prototype)
+{
+	auto closure = (Closure*)new char[sizeof(Closure) + prototype->upvals*sizeof(Capture*)];
+	closure->grey = closure->mark = false;
+	closure->refcount = 0;
+	closure->type = ValueType::Function;
+	closure->prototype = prototype;
+	closure->generator = 0;
+	closure->numupvals = prototype->upvals;
+	if (closure->numupvals)
+	{
+		closure->upvals = (Capture**)(closure + 1);
+		for (unsigned int i = 0; i < closure->numupvals; i++)
+			closure->upvals[i] = 0;//this is done for the GC
+	}
+	else
+		closure->upvals = 0;
+	gc.AddObject((GarbageCollector::gcval*)closure);
+	return closure;
+}
+
+JetString* JetContext::Intern(const char* string)
+{
+	unsigned int length = (unsigned int)strlen(string);
+	size_t hash = JetString::Hash(string, length);
+	for (JetString* s = this->strings[hash & (this->strings.size() - 1)]; s; s = s->next)
+	{
+		if (s->hash == hash && s->length == length && memcmp(s->data, string, length) == 0)
+			return s;
+	}
+	return this->Intern(this->AllocString(string, length));
+}
+
+JetString* JetContext::Intern(JetString* str)
+{
+	if (str->interned)
+		return str;
+
+	for (JetString* s = this->strings[str->hash & (this->strings.size() - 1)]; s; s = s->next)
+	{
+		if (s->hash == str->hash && s->length == str->length && memcmp(s->data, str->data, str->length) == 0)
+			return s;
+	}
+
+	//keep the table at most fully loaded
+	if (this->numstrings >= this->strings.size())
+	{
+		std::vector<JetString*> old(this->strings.size()*2, 0);
+		old.swap(this->strings);
+		size_t mask = this->strings.size() - 1;
+		for (auto s: old)
+		{
+			while (s)
+			{
+				JetString* next = s->next;
+				s->next = this->strings[s->hash & mask];
+				this->strings[s->hash & mask] = s;
+				s = next;
+			}
+		}
+	}
+
+	JetString*& bucket = this->strings[str->hash & (this->strings.size() - 1)];
+	str->next = bucket;
+	bucket = str;
+	str->interned = true;
+	this->numstrings++;
+	return str;
+}
+
+void JetContext::Unintern(JetString* str)
+{
+	JetString** s = &this->strings[str->hash & (this->strings.size() - 1)];
+	while (*s != str)
+		s = &(*s)->next;
+	*s = str->next;
+	str->interned = false;
+	this->numstrings--;
+}
+
+void JetContext::Pin(JetString* str)
+{
+	//one reference is enough no matter how many places use it
+	if (str->constant == false)
+	{
+		str->constant = true;
+		Value(str).AddRef();
+	}
 }
 
 #include "Libraries/File.h"
 #include "Libraries/Math.h"
 
-JetContext::JetContext() : gc(this), stack(4096), callstack(JET_MAX_CALLDEPTH, "Call Stack Overflow")
+JetContext::JetContext() : gc(this), stack(JET_STACK_SIZE, JET_MAX_STACK_SIZE), callstack(JET_CALLSTACK_SIZE, JET_MAX_CALLDEPTH, "Call Stack Overflow")
 {
-	this->sptr = this->localstack;//initialize stack pointer
+	//every object starts out with the empty shape
+	this->rootshape = new JetShape(true);
+	this->shapes.push_back(this->rootshape);
+	this->protoepoch = 0;
+	this->strings.resize(256, 0);
+	this->numstrings = 0;
+
+	this->sptr = this->stack._data;//initialize stack pointer
 	this->curframe = 0;
+	this->returned = 0;
+	this->countdown = 0;
+	this->budget = -1;
+	this->deadline = -1;
+	this->interrupted = false;
+#ifdef JET_JIT
+	this->jit = false;
+#endif
+
+#ifdef JET_COMPUTED_GOTO
+	//get the handler addresses from the interpreter before anything is assembled
+	if (handlers == nullptr)
+		this->Execute(0, nullptr);
+#endif
 
 	//add more functions and junk
 	(*this)["print"] = print;
@@ -234,7 +355,7 @@ JetContext::JetContext() : gc(this), stack(4096), callstack(JET_MAX_CALLDEPTH, "
 		if (v->type == ValueType::Object && v[1].type == ValueType::Object)
 		{
 			Value val = v[0];
-			val._object->prototype = v[1]._object;
+			val._object->SetPrototype(v[1]._object);
 			return val;
 		}
 		else
@@ -402,7 +523,10 @@ JetContext::JetContext() : gc(this), stack(4096), callstack(JET_MAX_CALLDEPTH, "
 	(*this->Array)["add"] = Value([](JetContext* context, Value* v, int args)
 	{
 		if (args == 2)
+		{
 			v->_array->data.push_back(v[1]);
+			context->gc.Track(v->_array);
+		}
 		else
 			throw RuntimeException("Invalid add call!!");
 		return Value::Empty;
@@ -417,7 +541,13 @@ JetContext::JetContext() : gc(this), stack(4096), callstack(JET_MAX_CALLDEPTH, "
 	(*this->Array)["resize"] = Value([](JetContext* context, Value* v, int args)
 	{
 		if (args == 2)
-			v->_array->data.resize((int)v[1]);
+		{
+			int size = (int)v[1];
+			if (size > (int)v->_array->data.size())
+				context->gc.Reserve((size - v->_array->data.size())*sizeof(Value));
+			v->_array->data.resize(size);
+			context->gc.Track(v->_array);
+		}
 		else
 			throw RuntimeException("Invalid resize call!!");
 		return Value::Empty;
@@ -564,16 +694,10 @@ JetContext::JetContext() : gc(this), stack(4096), callstack(JET_MAX_CALLDEPTH, "
 					return *v;//hack for foreach loops
 			}
 
-			Closure* closure = new Closure;
-			closure->refcount = 0;
-			closure->grey = closure->mark = false;
-			closure->prev = v->_function->prev;
-			closure->numupvals = v->_function->numupvals;
+			Closure* closure = context->AllocClosure(v->_function->prototype);
 			closure->generator = new Generator(context, v->_function, 0);
 			if (closure->numupvals)
-				closure->upvals = new Capture*[closure->numupvals];
-			closure->prototype = v->_function->prototype;
-			context->gc.AddObject((GarbageCollector::gcval*)closure);
+				memcpy(closure->upvals, v->_function->upvals, sizeof(Capture*)*closure->numupvals);
 
 			if (closure->generator->state == Generator::GeneratorState::Dead)
 				return Value::Empty;
@@ -632,6 +756,48 @@ JetContext::~JetContext()
 	delete this->arrayiter;
 	delete this->objectiter;
 	delete this->function;
+
+	for (auto ii: this->shapes)
+		delete ii;
+
+#ifdef JET_JIT
+	for (auto ii: this->jitcode)
+		JetJIT::Free(ii);
+#endif
+
+	this->FreeOldStacks();
+}
+
+void JetContext::SetStackLimits(unsigned int values, unsigned int calls)
+{
+	this->stack.limit(values);
+	this->callstack.limit(calls);
+}
+
+bool JetContext::GrowStack(unsigned int count)
+{
+	unsigned int size = this->stack.capacity();
+	Value* old = this->stack.Grow(count);
+	if (old == nullptr)
+		return false;
+
+	//move everything pointing into the old array over, natives further up may still be reading their arguments from it
+	//running generators have their locals and captures in their own storage, which stays put
+	auto moved = [=](Value* v) { return v >= old && v <= old + size ? this->stack._data + (v - old) : v; };
+	this->sptr = moved(this->sptr);
+	for (auto& open: this->opencaptures)
+		open.capture->v = moved(open.capture->v);
+	for (unsigned int i = 0; i < this->callstack._size; i++)
+		this->callstack._data[i].base = moved(this->callstack._data[i].base);
+	this->oldstacks.push_back(old);
+	return true;
+}
+
+void JetContext::FreeOldStacks()
+{
+	for (auto ii: this->oldstacks)
+		delete[] ii;
+	this->oldstacks.clear();
 }
 
 #ifndef _WIN32
@@ -652,6 +818,7 @@ std::vector<IntermediateInstruction> JetContext::Compile(const char* code, const
 	BlockExpression* result = parser.parseAll();
 
 	std::vector<IntermediateInstruction> out = compiler.Compile(result, filename);
+	CompilerContext::Optimize(out);
 
 	delete result;
 
@@ -704,99 +871,181 @@ void JetContext::RunGC()
 	this->gc.Run();
 }
 
-unsigned int JetContext::Call(const Value* fun, unsigned int iptr, unsigned int args)
+void JetContext::Close(int local)
+{
+	//remove from the back, the ones this frame opened are the last ones and point into its locals
+	//anything else belongs to a caller or to a generator that is running somewhere else
+	Value* start = &sptr[local];
+	Value* end = &sptr[curframe->prototype->locals];
+	while (opencaptures.size() > 0)
+	{
+		auto cur = opencaptures.back();
+		if (cur.capture->v < start || cur.capture->v >= end)
+			break;
+
+#ifdef _DEBUG
+		//this just verifies that the break above works right
+		if (cur.creator != this->curframe)
+			throw RuntimeException("RUNTIME ERROR: Tried to close capture in wrong scope!");
+#endif
+
+		this->Close(cur.capture);
+		opencaptures.pop_back();
+	}
+}
+
+void JetContext::Close(Capture* capture)
+{
+	capture->closed = true;
+	capture->value = *capture->v;
+	capture->v = &capture->value;
+	//m_OutputFunction("Closed capture with value %s\n", capture->value.ToString().c_str());
+
+	//do a write barrier
+	if (capture->value.type > ValueType::NativeFunction && capture->value._object->grey == false)
+	{
+		capture->value._object->grey = true;
+		this->gc.greys.Push(capture->value);
+	}
+}
+
+static int64_t Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void JetContext::SetBudget(int64_t steps)
+{
+	this->budget = steps < 0 ? -1 : steps;
+	this->countdown = 0;
+}
+
+void JetContext::SetDeadline(int64_t ns)
+{
+	this->deadline = ns < 0 ? -1 : Now() + ns;
+	this->countdown = 0;
+}
+
+void JetContext::Preempt()
+{
+	//the countdown stays negative after throwing, so scripts catching this get stopped again right away
+	this->gc.Reserve(0);
+	if (this->interrupted.load(std::memory_order_relaxed))
+		throw RuntimeException("Script was interrupted!");
+	if (this->deadline >= 0 && Now() >= this->deadline)
+		throw RuntimeException("Script ran past its deadline!");
+	if (this->budget == 0)
+		throw RuntimeException("Script ran out of its execution budget!");
+
+	//this step is paid for out of the new countdown
+	int64_t steps = this->deadline >= 0 ? JET_DEADLINE_CHECK : INT64_MAX;
+	if (this->budget > 0)
+	{
+		steps = std::min(steps, this->budget);
+		this->budget -= steps;
+	}
+	this->countdown = steps - 1;
+}
+
+void JetContext::Results(unsigned int count, unsigned int wanted)
+{
+	if (wanted == 0)
+	{
+		//the host takes them all
+		this->returned = count;
+		return;
+	}
+	if (count > wanted)
+		stack.QuickPop(count - wanted);
+	for (; count < wanted; count++)
+		vmstack_push(stack, Value::Empty);
+}
+
+unsigned int JetContext::Call(const Value* fun, unsigned int iptr, unsigned int args, bool tail)
 {
 	if (fun->type == ValueType::Function)
 	{
 		//let generators be called
 		if (fun->_function->generator)
 		{
-			callstack.Push(std::pair<unsigned int, Closure*>(iptr, curframe));
-
-			sptr += curframe->prototype->locals;
-
-			if ((sptr - localstack) >= JET_STACK_SIZE)
+			this->Check();
+			Function* func = fun->_function->prototype;
+			if (!this->Fits(func->maxstack + 1))
 				throw RuntimeException("Stack Overflow!");
 
+			//the first argument is the value sent to the generator, the rest are dropped
+			Value arg;
+			if (args > 0)
+			{
+				vmstack_popn(stack, args - 1);
+				vmstack_pop_to(stack, arg);
+			}
+
+			callstack.Push(CallFrame(iptr, curframe, sptr));
 			curframe = fun->_function;
 
-			if (args == 0)
-				stack.Push(Value::Empty);
-			else if (args > 1)
-				for (unsigned int i = 1; i < args; i++)
-					stack.Pop();
-			return fun->_function->generator->Resume(this)-1;
+			return fun->_function->generator->Resume(this, arg)-1;
 		}
 		if (fun->_function->prototype->generator)
 		{
 			//create generator and return it
-			Closure* closure = new Closure;
-			closure->grey = closure->mark = false;
-			closure->prev = fun->_function->prev;
-			closure->numupvals = fun->_function->numupvals;
-			closure->refcount = 0;
+			Closure* closure = this->AllocClosure(fun->_function->prototype);
 			closure->generator = new Generator(this, fun->_function, args);
+			//the generator uses the same captures as the function it runs
 			if (closure->numupvals)
-				closure->upvals = new Capture*[closure->numupvals];
-			closure->prototype = fun->_function->prototype;
-			closure->type = ValueType::Function;
-			this->gc.AddObject((GarbageCollector::gcval*)closure);
+				memcpy(closure->upvals, fun->_function->upvals, sizeof(Capture*)*closure->numupvals);
 
 			this->stack.Push(Value(closure));
 			return iptr;
 		}
 
-		//manipulate frame pointer
-		callstack.Push(std::pair<unsigned int, Closure*>(iptr, curframe));
+		this->Check();
+		Function* func = fun->_function->prototype;
+		func->calls++;
 
-		sptr += curframe->prototype->locals;
-
-		//clean out the new stack for the gc
-		for (unsigned int i = 0; i < fun->_function->prototype->locals; i++)
-		{
-			sptr[i] = Value::Empty;
-		}
+		//this is the only overflow check the function needs, instructions push and pop unchecked
+		//the arguments are still on the stack, so this is a little conservative
+		if (!this->Fits(func->locals + func->maxstack))
+			throw RuntimeException("Stack Overflow!");
 
-		if ((sptr - localstack) >= JET_STACK_SIZE)
+		//the arguments are already where the first locals of the new frame go
+		Value* base = &stack._data[stack._size - args];
+		if (tail)
 		{
-			throw RuntimeException("Stack Overflow!");
+			//a tail call puts the new frame where the current one is and keeps its return address
+			for (unsigned int i = 0; i < args; i++)
+				sptr[i] = base[i];
+			base = sptr;
 		}
+		else
+			callstack.Push(CallFrame(iptr, curframe, sptr));
 
-		curframe = fun->_function;
-
-		Function* func = curframe->prototype;
-		//set all the locals
-		if (args <= func->args)
+		//clear the rest of the locals, extra arguments get dropped or go in the vararg local
+		unsigned int i = args < func->args ? args : func->args;
+		unsigned int extra = args > func->args ? args - func->args : 0;
+		if (func->stackvarargs)
 		{
-			for (int i = (int)func->args-1; i >= 0; i--)
-			{
-				if (i < (int)args)
-					stack.Pop(sptr[i]);
-			}
+			//move them above the locals where the frame keeps them, the vararg local holds the count
+			for (unsigned int v = extra; v-- > 0;)
+				base[func->locals + v] = base[func->args + v];
+			base[i++] = Value((int)extra);
 		}
 		else if (func->vararg)
 		{
-			sptr[func->locals-1] = this->NewArray();
-			auto arr = &sptr[func->locals-1]._array->data;
-			arr->resize(args - func->args);
-			for (int i = (int)args-1; i >= 0; i--)
-			{
-				if (i < (int)func->args)
-					stack.Pop(sptr[i]);
-				else
-					stack.Pop((*arr)[i]);
-			}
+			Value arr = this->NewArray();
+			arr._array->data.assign(base + func->args, base + func->args + extra);
+			this->gc.Track(arr._array);
+			base[i++] = arr;
+			extra = 0;
 		}
 		else
-		{
-			for (int i = (int)args-1; i >= 0; i--)
-			{
-				if (i < (int)func->args)
-					stack.Pop(sptr[i]);
-				else
-					stack.QuickPop();
-			}
-		}
+			extra = 0;
+		for (; i < func->locals; i++)
+			base[i] = Value::Empty;
+
+		stack._size = (unsigned int)(base - stack._data) + func->locals + extra;
+		sptr = base;
+		curframe = fun->_function;
 
 		//go to function
 		return -1;
@@ -807,14 +1056,12 @@ unsigned int JetContext::Call(const Value* fun, unsigned int iptr, unsigned int
 
 		//ok fix this to be cleaner and resolve stack printing
 		//should just push a value to indicate that we are in a native function call
-		callstack.Push(std::pair<unsigned int, Closure*>(iptr, curframe));
-		callstack.Push(std::pair<unsigned int, Closure*>(JET_BAD_INSTRUCTION, 0));
+		callstack.Push(CallFrame(iptr, curframe, sptr));
+		callstack.Push(CallFrame(JET_BAD_INSTRUCTION, 0, sptr));
 		Closure* temp = curframe;
-		sptr += temp->prototype->locals;
 		curframe = 0;
 		Value ret = (*fun->func)(this,tmp,args);
 		stack.QuickPop(args);
-		sptr -= temp->prototype->locals;		
 		curframe = temp;
 		callstack.QuickPop(2);
 		stack.Push(ret);
@@ -835,8 +1082,319 @@ unsigned int JetContext::Call(const Value* fun, unsigned int iptr, unsigned int
 	throw RuntimeException("Cannot call non function type " + std::string(fun->Type()) + "!!!");
 }
 
-Value JetContext::Execute(int iptr, Closure* frame)
+#ifdef JET_COMPUTED_GOTO
+const void* const* JetContext::handlers = nullptr;
+#endif
+
+Value JetContext::GetMember(const Value& v, const char* key)
+{
+	JetObject* obj = v.type == ValueType::Object ? v._object : (v.type == ValueType::Userdata ? v._userdata->prototype : 0);
+	for (; obj; obj = obj->prototype)
+	{
+		if (Value* slot = obj->findSlot(key))
+			return *slot;
+	}
+	return Value();
+}
+
+//instruction dispatch
+//with computed gotos each handler jumps straight to the next one, only instructions that
+//can change the current frame go back out to reload and check it
+#ifdef JET_COMPUTED_GOTO
+#define vmcase(op) op_##op
+#define vmdefault op_Unimplemented
+#define vmdispatch() goto *in->handler
+#define vmnext { ++in; vmdispatch(); }
+#define vmjump(to) { in = (to); vmdispatch(); }
+#else
+#define vmcase(op) case InstructionType::op
+#define vmdefault default
+#define vmnext break
+#define vmjump(to) { in = (to); continue; }
+#endif
+#define vmframe goto newframe
+
+void JetContext::StoreAt(const DecodedInstruction* in, InlineCache* caches)
+{
+	if (in->strlit)
+	{
+		Value& loc = vmstack_peek(stack);
+		Value& val = vmstack_peekn(stack,2);
+
+		if (loc.type == ValueType::Object)
+		{
+			JetObject* obj = loc._object;
+			InlineCache& cache = caches[in->value];
+			Value* slot = cache.Get(obj, this->protoepoch);
+			if (slot == 0)
+			{
+				Value key(in->strlit);
+				slot = obj->getSlot(&key);
+				if (obj->shape->shared)
+					cache.Set(obj, 0, (int)(slot - obj->slots), this->protoepoch);
+			}
+			*slot = val;
+		}
+		else
+			throw RuntimeException("Could not index a non array/object value!");
+		vmstack_popn(stack,2);
+		//this may be redundant and already done in object
+		//check me
+		if (loc._object->mark)
+		{
+			//reset to grey and push back for reprocessing
+			loc._object->mark = false;
+			gc.greys.Push(loc);//push to grey stack
+		}
+		//write barrier
+	}
+	else
+	{
+		Value& index = vmstack_peekn(stack,1);
+		Value& loc = vmstack_peekn(stack,2);
+		Value& val = vmstack_peekn(stack,3);	
+
+		if (loc.type == ValueType::Array)
+		{
+			int in = (int)index;
+			if (in >= (int)loc._array->data.size() || in < 0)
+				throw RuntimeException("Array index out of range!");
+			loc._array->data[in] = val;
+
+			//write barrier
+			if (loc._array->mark)
+			{
+				//reset to grey and push back for reprocessing
+				//m_OutputFunction("write barrier triggered!\n");
+				loc._array->mark = false;
+				gc.greys.Push(loc);//push to grey stack
+			}
+		}
+		else if (loc.type == ValueType::Object)
+		{
+			(*loc._object)[index] = val;
+
+			//write barrier
+			//this may be redundant, lets check
+			//its also done in the object object
+			if (loc._object->mark)
+			{
+				//reset to grey and push back for reprocessing
+				//m_OutputFunction("write barrier triggered!\n");
+				loc._object->mark = false;
+				gc.greys.Push(loc);//push to grey stack
+			}
+		}
+		else if (loc.type == ValueType::String)
+		{
+			int in = (int)index;
+			if (in >= (int)loc.length || in < 0)
+				throw RuntimeException("String index out of range!");
+
+			//interned strings are shared by everything that uses them
+			if (loc._string->interned)
+				throw RuntimeException("Cannot modify a constant string!");
+			loc._string->data[in] = (int)val;
+			loc._string->hash = JetString::Hash(loc._string->data, loc._string->length);
+		}
+		else
+		{
+			throw RuntimeException("Could not index a non array/object value!");
+		}
+		vmstack_popn(stack, 3);
+	}
+}
+
+void JetContext::LoadAt(const DecodedInstruction* in, InlineCache* caches)
+{
+	if (in->strlit)
+	{
+		Value loc;
+		vmstack_pop_to(stack, loc);
+		if (loc.type == ValueType::Object)
+		{
+			JetObject* obj = loc._object;
+			InlineCache& cache = caches[in->value];
+			Value* slot = cache.Get(obj, this->protoepoch);
+			if (slot == 0)
+			{
+				//look it up in the receiver then down the prototype chain
+				Value key(in->strlit);
+				JetObject* holder = obj;
+				int i;
+				while ((i = holder->shape->find(&key)) < 0 && holder->prototype)
+					holder = holder->prototype;
+
+				if (i >= 0)
+				{
+					slot = &holder->slots[i];
+					if (obj->shape->shared)
+					{
+						//anything between the receiver and the holder must not get the key later
+						if (holder != obj)
+						{
+							for (auto p = obj->prototype; p != holder; p = p->prototype)
+								p->isprototype = true;
+						}
+						cache.Set(obj, holder == obj ? 0 : holder, i, this->protoepoch);
+					}
+				}
+			}
+			if (slot)
+				vmstack_push(stack, *slot);
+			else
+				vmstack_push(stack, Value::Empty);
+		}
+		else if (loc.type == ValueType::String)
+			vmstack_push(stack, ((*this->string)[in->strlit->data]));
+		else if (loc.type == ValueType::Array)
+			vmstack_push(stack, ((*this->Array)[in->strlit->data]));
+		else if (loc.type == ValueType::Userdata)
+			vmstack_push(stack, ((*loc._userdata->prototype)[in->strlit->data]));
+		else if (loc.type == ValueType::Function && loc._function->prototype->generator)
+			vmstack_push(stack, ((*this->function)[in->strlit->data]));
+		else
+			throw RuntimeException("Could not index a non array/object value!");
+	}
+	else
+	{
+		Value index = stack._data[--stack._size];
+		Value loc = stack._data[--stack._size];
+
+		if (loc.type == ValueType::Array)
+		{
+			int in = (int)index;
+			if (in >= (int)loc._array->data.size() || in < 0)
+				throw RuntimeException("Array index out of range!");
+			vmstack_push(stack, (loc._array->data[in]));
+		}
+		else if (loc.type == ValueType::Object)
+			vmstack_push(stack,((*loc._object).get(index)));
+		else if (loc.type == ValueType::String)
+		{
+			int in = (int)index;
+			if (in >= (int)loc.length || in < 0)
+				throw RuntimeException("String index out of range!");
+
+			vmstack_push(stack, Value(loc._string->data[in]));
+		}
+
+		else
+			throw RuntimeException("Could not index a non array/object value!");
+	}
+}
+
+//quickening, the current instruction is rewritten in place to a variant specialised for the
+//operand types just seen, a guard failure sends the site back to the generic variant for good
+//by setting value to -1, so generic instructions that get quickened must not use value
+#ifdef JET_COMPUTED_GOTO
+#define vmrewrite(op) { auto q = const_cast<DecodedInstruction*>(in); q->instruction = InstructionType::op; q->handler = dispatch[(int)InstructionType::op]; }
+#else
+#define vmrewrite(op) { const_cast<DecodedInstruction*>(in)->instruction = InstructionType::op; }
+#endif
+#define vmquicken(a, b, intint, realreal) if (in->value >= 0 && a.type == b.type) { if (a.type == ValueType::Int) vmrewrite(intint) else if (a.type == ValueType::Real) vmrewrite(realreal) }
+#define vmdeopt(op) { const_cast<DecodedInstruction*>(in)->value = -1; vmrewrite(op); vmjump(in); }
+
+Value JetContext::Execute(int iptr, Closure* frame, std::vector<Value>* results)
 {
+#ifdef JET_COMPUTED_GOTO
+	//handler for each instruction, must be kept in the same order as InstructionType
+	static const void* const dispatch[] =
+	{
+		&&op_Add, &&op_Mul, &&op_Div, &&op_Sub, &&op_Modulus,
+		&&op_Negate,
+		&&op_BAnd, &&op_BOr, &&op_Xor, &&op_BNot,
+		&&op_LeftShift, &&op_RightShift,
+		&&op_Eq, &&op_NotEq,
+		&&op_Lt, &&op_Gt,
+		&&op_LtE, &&op_GtE,
+		&&op_Incr,
+		&&op_Decr,
+		&&op_Dup, &&op_Pop,
+		&&op_LdInt,
+		&&op_LdReal,
+		&&op_LdNull,
+		&&op_LdStr,
+		&&op_LoadFunction,
+		&&op_Jump,
+		&&op_JumpTrue, &&op_JumpTruePeek,
+		&&op_JumpFalse, &&op_JumpFalsePeek,
+		&&op_NewArray,
+		&&op_NewObject,
+		&&op_Store, &&op_Load,
+		&&op_LStore, &&op_LLoad,
+		&&op_CStore, &&op_CLoad,
+		&&op_CInit, &&op_CCopy,
+		&&op_ForEach,
+		&&op_ForIntPrep,
+		&&op_ForIntLoop,
+		&&op_LoadAt,
+		&&op_StoreAt,
+		&&op_ECall,
+		&&op_MCall,
+		&&op_Call,
+		&&op_TailCall,
+		&&op_Return,
+		&&op_ReturnN,
+		&&op_Resume,
+		&&op_Yield,
+		&&op_Close,
+		&&op_VarArg,
+		&&op_VarArgCount,
+		&&op_PushVarArgs,
+		&&op_VCall,
+		&&op_RMove,
+		&&op_RIncr, &&op_RDecr,
+		&&op_RLdInt, &&op_RLdReal,
+		&&op_RAdd, &&op_RSub, &&op_RMul, &&op_RDiv, &&op_RModulus,
+		&&op_REq, &&op_RNotEq,
+		&&op_RLt, &&op_RGt,
+		&&op_RLtE, &&op_RGtE,
+		&&op_LLoadLLoad,
+		&&op_LLoadLLoadAdd, &&op_LLoadLLoadSub, &&op_LLoadLLoadMul,
+		&&op_LdIntAdd, &&op_LdIntSub, &&op_LdIntMul,
+		&&op_LLoadIncrLStore, &&op_LLoadDecrLStore,
+		&&op_EqJumpFalse, &&op_NotEqJumpFalse,
+		&&op_LtJumpFalse, &&op_GtJumpFalse,
+		&&op_LtEJumpFalse, &&op_GtEJumpFalse,
+		&&op_AddIntInt, &&op_AddRealReal,
+		&&op_SubIntInt, &&op_SubRealReal,
+		&&op_MulIntInt, &&op_MulRealReal,
+		&&op_DivIntInt, &&op_DivRealReal,
+		&&op_LtIntInt, &&op_LtRealReal,
+		&&op_GtIntInt, &&op_GtRealReal,
+		&&op_LtEIntInt, &&op_LtERealReal,
+		&&op_GtEIntInt, &&op_GtERealReal,
+		&&op_LtJumpFalseIntInt, &&op_LtJumpFalseRealReal,
+		&&op_GtJumpFalseIntInt, &&op_GtJumpFalseRealReal,
+		&&op_LtEJumpFalseIntInt, &&op_LtEJumpFalseRealReal,
+		&&op_GtEJumpFalseIntInt, &&op_GtEJumpFalseRealReal,
+		&&op_LLoadLLoadAddIntInt, &&op_LLoadLLoadAddRealReal,
+		&&op_LLoadLLoadSubIntInt, &&op_LLoadLLoadSubRealReal,
+		&&op_LLoadLLoadMulIntInt, &&op_LLoadLLoadMulRealReal,
+		&&op_AddInt, &&op_SubInt, &&op_MulInt,
+		&&op_AddReal, &&op_SubReal, &&op_MulReal, &&op_DivReal,
+		&&op_LtInt, &&op_GtInt, &&op_LtEInt, &&op_GtEInt,
+		&&op_LtReal, &&op_GtReal, &&op_LtEReal, &&op_GtEReal,
+		&&op_LtIntJumpFalse, &&op_GtIntJumpFalse, &&op_LtEIntJumpFalse, &&op_GtEIntJumpFalse,
+		&&op_LtRealJumpFalse, &&op_GtRealJumpFalse, &&op_LtERealJumpFalse, &&op_GtERealJumpFalse,
+		&&op_LLoadLLoadAddInt, &&op_LLoadLLoadSubInt, &&op_LLoadLLoadMulInt,
+		&&op_LLoadLLoadAddReal, &&op_LLoadLLoadSubReal, &&op_LLoadLLoadMulReal,
+		&&op_LdIntAddInt, &&op_LdIntSubInt, &&op_LdIntMulInt,
+		&&op_Loop,
+		//dummy instructions never make it into a function
+		&&op_Unimplemented, &&op_Unimplemented, &&op_Unimplemented,
+		&&op_Unimplemented, &&op_Unimplemented, &&op_Unimplemented
+	};
+	static_assert(sizeof(dispatch)/sizeof(dispatch[0]) == (int)InstructionType::Function+1, "dispatch table out of sync with InstructionType");
+
+	//called without a frame just to hand out the table for Decode
+	if (frame == nullptr)
+	{
+		handlers = dispatch;
+		return Value();
+	}
+#endif
 #ifdef JET_TIME_EXECUTION
 	INT64 start, rate, end;
 	QueryPerformanceFrequency( (LARGE_INTEGER *)&rate );
@@ -845,380 +1403,446 @@ Value JetContext::Execute(int iptr, Closure* frame)
 	//frame and stack pointer reset
 	unsigned int startcallstack = this->callstack._size;
 	unsigned int startstack = this->stack._size;
-	auto startlocalstack = this->sptr;
+	size_t startcaptures = this->opencaptures.size();
 
-	vmstack_push(callstack,(std::pair<unsigned int, Closure*>(JET_BAD_INSTRUCTION, nullptr)));//bad value to get it to return;
+	callstack.Push(CallFrame(JET_BAD_INSTRUCTION, nullptr, sptr, 0));//bad value to get it to return, keeps all the results
 	curframe = frame;
 
+
+	const DecodedInstruction* code = nullptr;
+	InlineCache* caches = nullptr;
+	const DecodedInstruction* in = nullptr;
+#ifdef JET_JIT
+	bool native = false;
+#endif
 	try
 	{
-		while (curframe && iptr < (int)curframe->prototype->instructions.size() && iptr >= 0)
+		while (curframe && iptr < (int)curframe->prototype->code.size() && iptr >= 0)
 		{
-			const Instruction& in = curframe->prototype->instructions[iptr];
-			switch(in.instruction)
+#ifdef JET_JIT
+			//hot functions run as machine code until it gets to something it leaves to the interpreter,
+			//which then runs at least that instruction before going back to the machine code
+			if (this->jit && native == false)
+			{
+				native = true;
+				Function* func = curframe->prototype;
+				if (func->native == nullptr && func->calls >= JET_JIT_THRESHOLD)
+					JetJIT::Compile(this, func);
+				if (func->native)
+				{
+					std::exception_ptr error;
+					iptr = JetJIT::Run(this, iptr, error);
+					if (error)
+					{
+						//iptr is already where it threw, and the frame may be a native call's by now
+						in = nullptr;
+						std::rethrow_exception(error);
+					}
+					continue;
+				}
+			}
+			native = false;
+#endif
+			code = curframe->prototype->code.data();
+			caches = curframe->prototype->caches.data();
+			in = &code[iptr];
+			for (;;)
+			{
+#ifdef JET_COMPUTED_GOTO
+			vmdispatch();
+#else
+			switch(in->instruction)
+#endif
 			{
-			case InstructionType::Add:
+			vmcase(Add):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
+					vmquicken(a, b, AddIntInt, AddRealReal);
 					a += b;
-					break;
+					vmnext;
 				}
-			case InstructionType::Sub:
+			vmcase(Sub):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
+					vmquicken(a, b, SubIntInt, SubRealReal);
 					a -= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::Mul:
+			vmcase(Mul):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					a *=b;
-					break;
+					vmquicken(a, b, MulIntInt, MulRealReal);
+					a *= b;
+					vmnext;
 				}
-			case InstructionType::Div:
+			vmcase(Div):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
+					vmquicken(a, b, DivIntInt, DivRealReal);
 					a /= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::Modulus:
+			vmcase(Modulus):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a %=b;
-					break;
+					vmnext;
 				}
-			case InstructionType::BAnd:
+			vmcase(BAnd):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a &= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::BOr:
+			vmcase(BOr):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a |= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::Xor:
+			vmcase(Xor):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a^=b;
-					break;
+					vmnext;
 				}
-			case InstructionType::BNot:
+			vmcase(BNot):
 				{
 					Value& a = vmstack_peek(stack);
 					a = ~a;
-					break;
+					vmnext;
 				}
-			case InstructionType::LeftShift:
+			vmcase(LeftShift):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a <<= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::RightShift:
+			vmcase(RightShift):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
 					a >>= b;
-					break;
+					vmnext;
 				}
-			case InstructionType::Incr:
+			vmcase(Incr):
 				{
 					Value& a = vmstack_peek(stack);
 					a .Increase();
-					break;
+					vmnext;
 				}
-			case InstructionType::Decr:
+			vmcase(Decr):
 				{
 					Value& a = vmstack_peek(stack);
 					a.Decrease();
-					break;
+					vmnext;
 				}
-			case InstructionType::Negate:
+			vmcase(Negate):
 				{
 					Value& a = vmstack_peek(stack);
 					a.Negate();
-					break;
+					vmnext;
 				}
-			case InstructionType::Eq:
+			vmcase(Eq):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, a == b);
-					break;
+					bool r = a == b;
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::NotEq:
+			vmcase(NotEq):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, !(a == b));
-					break;
+					bool r = !(a == b);
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::Lt:
+			vmcase(Lt):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, a.int_value < b.int_value);
-					break;
+					vmquicken(a, b, LtIntInt, LtRealReal);
+					bool r = vmcompare(a, b, <);
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::Gt:
+			vmcase(Gt):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, a.int_value > b.int_value);
-					break;
+					vmquicken(a, b, GtIntInt, GtRealReal);
+					bool r = vmcompare(a, b, >);
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::GtE:
+			vmcase(GtE):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, a.int_value >= b.int_value);
-					break;
+					vmquicken(a, b, GtEIntInt, GtERealReal);
+					bool r = vmcompare(a, b, >=);
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::LtE:
+			vmcase(LtE):
 				{
 					const Value& b = vmstack_peek(stack);
 					--stack._size;
 					Value& a = vmstack_peek(stack);
-					set_value_bool(a, a.int_value <= b.int_value);
-					break;
+					vmquicken(a, b, LtEIntInt, LtERealReal);
+					bool r = vmcompare(a, b, <=);
+					set_value_bool(a, r);
+					vmnext;
 				}
-			case InstructionType::LdNull:
+			vmcase(LdNull):
 				{
 					vmstack_push(stack,Value::Empty);
-					break;
+					vmnext;
 				}
-			case InstructionType::LdInt:
+			vmcase(LdInt):
 				{
-					vmstack_push(stack, in.int_lit);
-					break;
+					vmstack_push(stack, in->int_lit);
+					vmnext;
 				}
-			case InstructionType::LdReal:
+			vmcase(LdReal):
 			{
-				vmstack_push(stack, in.lit);
-				break;
+				vmstack_push(stack, in->lit);
+				vmnext;
 			}
-			case InstructionType::LdStr:
+			vmcase(LdStr):
 				{
-					vmstack_push(stack, Value(in.strlit));
-					break;
+					vmstack_push(stack, Value(in->strlit));
+					vmnext;
 				}
-			case InstructionType::Jump:
+			vmcase(Jump):
 				{
-					iptr = in.value-1;
-					break;
+					vmjump(in->target);
 				}
-			case InstructionType::JumpTrue:
+			vmcase(Loop):
+				{
+					this->Check();
+#ifdef JET_JIT
+					//loops make a function hot as well, going through newframe gets it compiled and switches to it
+					if (this->jit && ++curframe->prototype->calls >= JET_JIT_THRESHOLD)
+					{
+						iptr = (int)(in->target - code) - 1;
+						vmframe;
+					}
+#endif
+					vmjump(in->target);
+				}
+			vmcase(JumpTrue):
 				{
 					const auto& temp= vmstack_peek(stack);
+					bool jump;
 					switch (temp.type)
 					{
 					case ValueType::Int:
-						if (temp.int_value != 0)
-							iptr = in.value-1;
+						jump = temp.int_value != 0;
 						break;
 					case ValueType::Real:
-						if (temp.value != 0.0)
-							iptr = in.value - 1;
+						jump = temp.value != 0.0;
 						break;
 					case ValueType::Null:
+						jump = false;
 						break;
 					default:
-						iptr = in.value-1;
+						jump = true;
 					}
 					vmstack_pop(stack);
-					break;
+					if (jump)
+						vmjump(in->target);
+					vmnext;
 				}
-			case InstructionType::JumpTruePeek:
+			vmcase(JumpTruePeek):
 				{
 					const auto& temp = vmstack_peek(stack);
+					bool jump;
 					switch (temp.type)
 					{
 					case ValueType::Int:
-						if (temp.int_value != 0)
-							iptr = in.value - 1;
+						jump = temp.int_value != 0;
 						break;
 					case ValueType::Real:
-						if (temp.value != 0.0)
-							iptr = in.value-1;
+						jump = temp.value != 0.0;
 						break;
 					case ValueType::Null:
+						jump = false;
 						break;
 					default:
-						iptr = in.value-1;
+						jump = true;
 					}
-					break;
+					if (jump)
+						vmjump(in->target);
+					vmnext;
 				}
-			case InstructionType::JumpFalse:
+			vmcase(JumpFalse):
 				{
 					const auto&  temp = vmstack_peek(stack);
+					bool jump;
 					switch (temp.type)
 					{
 					case ValueType::Int:
-						if (temp.int_value == 0)
-							iptr = in.value - 1;
+						jump = temp.int_value == 0;
 						break;
 					case ValueType::Real:
-						if (temp.value == 0.0)
-							iptr = in.value-1;
+						jump = temp.value == 0.0;
 						break;
 					case ValueType::Null:
-						iptr = in.value-1;
+						jump = true;
 						break;
+					default:
+						jump = false;
 					}
 					vmstack_pop(stack);
-					break;
+					if (jump)
+						vmjump(in->target);
+					vmnext;
 				}
-			case InstructionType::JumpFalsePeek:
+			vmcase(JumpFalsePeek):
 				{
 					const auto& temp = vmstack_peek(stack);
+					bool jump;
 					switch (temp.type)
 					{
 					case ValueType::Int:
-						if (temp.int_value == 0)
-							iptr = in.value - 1;
+						jump = temp.int_value == 0;
 						break;
 					case ValueType::Real:
-						if (temp.value == 0.0)
-							iptr = in.value-1;
+						jump = temp.value == 0.0;
 						break;
 					case ValueType::Null:
-						iptr = in.value-1;
+						jump = true;
 						break;
+					default:
+						jump = false;
 					}
-					break;
+					if (jump)
+						vmjump(in->target);
+					vmnext;
 				}
-			case InstructionType::Load:
+			vmcase(Load):
 				{
-					vmstack_push(stack,(vars[in.value]));
-					break;
+					vmstack_push(stack,(vars[in->value]));
+					vmnext;
 				}
-			case InstructionType::Store:
+			vmcase(Store):
 				{
-					stack.Pop(vars[in.value]);
-					break;
+					vmstack_pop_to(stack, vars[in->value]);
+					vmnext;
 				}
-			case InstructionType::LLoad:
+			vmcase(LLoad):
 				{
-					vmstack_push(stack, (sptr[in.value]));
-					break;
+					vmstack_push(stack, (sptr[in->value]));
+					vmnext;
 				}
-			case InstructionType::LStore:
+			vmcase(LStore):
 				{
-					stack.Pop(sptr[in.value]);
-					break;
+					vmstack_pop_to(stack, sptr[in->value]);
+					vmnext;
 				}
-			case InstructionType::CLoad:
+			vmcase(CLoad):
 				{
-					auto frame = curframe;
-					int index = in.value2;
-					while ( index++ < 0)
-						frame = frame->prev;
-
-					vmstack_push(stack, (*frame->upvals[in.value]->v));
-					break;
+					vmstack_push(stack, (*curframe->upvals[in->value]->v));
+					vmnext;
 				}
-			case InstructionType::CStore:
+			vmcase(CStore):
 				{
 					auto frame = curframe;
-					int index = in.value2;
-					while ( index++ < 0)
-						frame = frame->prev;
-
 					if (frame->mark)
 					{
 						frame->mark = false;
 						gc.greys.Push(frame);
 					}
 
-					if (frame->upvals[in.value]->closed)
+					if (frame->upvals[in->value]->closed)
 					{
-						frame->upvals[in.value]->value = stack.Pop();
+						vmstack_pop_to(stack, frame->upvals[in->value]->value);
 
 						//fix up this write barrier
 						//do a write barrier
-						/*if (frame->upvals[in.value]->value.type > ValueType::NativeFunction && frame->upvals[in.value]->value._object->grey == false)
+						/*if (frame->upvals[in->value]->value.type > ValueType::NativeFunction && frame->upvals[in->value]->value._object->grey == false)
 						{
-						frame->upvals[in.value]->value._object->grey = true;
-						this->gc.greys.Push(frame->upvals[in.value]->value);
+						frame->upvals[in->value]->value._object->grey = true;
+						this->gc.greys.Push(frame->upvals[in->value]->value);
 						}*/
 					}
 					else
 					{
-						stack.Pop(*frame->upvals[in.value]->v);
+						vmstack_pop_to(stack, *frame->upvals[in->value]->v);
 					}
-					break;
+					vmnext;
 				}
-			case InstructionType::LoadFunction:
+			vmcase(LoadFunction):
 				{
-					//construct a new closure with the right number of upvalues
-					//from the Func* object
-					Closure* closure = new Closure;
-					closure->grey = closure->mark = false;
-					closure->prev = curframe;
-					closure->refcount = 0;
-					closure->generator = 0;
-					closure->numupvals = in.func->upvals;
-					if (in.func->upvals)
+					//without captures every closure of it would be the same, so they all share one
+					if (in->func->upvals == 0)
 					{
-						closure->upvals = new Capture*[in.func->upvals];
-						//#ifdef _DEBUG
-						for (unsigned int i = 0; i < in.func->upvals; i++)
-							closure->upvals[i] = 0;//this is done for the GC
-						//#endif
-						this->lastadded = closure;
+						if (in->func->closure == 0)
+						{
+							in->func->closure = this->AllocClosure(in->func);
+							in->func->closure->refcount++;
+						}
+						vmstack_push(stack, Value(in->func->closure));
+						vmnext;
 					}
 
-					closure->prototype = in.func;
-					closure->type = ValueType::Function;
-					gc.AddObject((GarbageCollector::gcval*)closure);
+					//construct a new closure with the right number of upvalues
+					//from the Func* object, the CInit and CCopy after this fill them in
+					Closure* closure = this->AllocClosure(in->func);
+					if (closure->numupvals)
+						this->lastadded = closure;
 					vmstack_push(stack, Value(closure));
 
 					if (gc.allocationCounter++%GC_INTERVAL == 0)
 						this->RunGC();
 
-					break;
+					vmnext;
 				}
-			case InstructionType::CInit:
+			vmcase(CInit):
 				{
 					//allocate and add new upvalue
 					auto frame = lastadded;
 					//first see if we already have this closure open for this variable
+					//only the ones at the back can be in this frame, so stop at the first that points outside its locals
 					bool found = false;
-					for (auto& ii: opencaptures)
+					Value* end = &sptr[curframe->prototype->locals];
+					for (auto ii = opencaptures.rbegin(); ii != opencaptures.rend(); ii++)
 					{
-						if (ii.capture->v == &sptr[in.value])
+						if (ii->capture->v < sptr || ii->capture->v >= end)
+							break;
+						if (ii->capture->v == &sptr[in->value])
 						{
 							//we found it
-							frame->upvals[in.value2] = ii.capture;
+							frame->upvals[in->value2] = ii->capture;
 							found = true;
-							//m_OutputFunction("Reused Capture %d %s in %s\n", in.value2, sptr[in.value].ToString().c_str(), curframe->prototype->name.c_str());
+							//m_OutputFunction("Reused Capture %d %s in %s\n", in->value2, sptr[in->value].ToString().c_str(), curframe->prototype->name.c_str());
 
 							if (frame->mark)
 							{
@@ -1237,19 +1861,19 @@ Value JetContext::Execute(int iptr, Closure* frame)
 						capture->grey = capture->mark = false;
 						capture->refcount = 0;
 						capture->type = ValueType::Capture;
-						capture->v = &sptr[in.value];
+						capture->v = &sptr[in->value];
 #ifdef _DEBUG
 						capture->usecount = 1;
 						capture->owner = frame;
 #endif
-						frame->upvals[in.value2] = capture;
+						frame->upvals[in->value2] = capture;
 
 						OpenCapture c;
 						c.capture = capture;
 #ifdef _DEBUG
-						c.creator = frame->prev;
+						c.creator = curframe;
 #endif
-						//m_OutputFunction("Initalized Capture %d %s in %s\n", in.value2, sptr[in.value].ToString().c_str(), curframe->prototype->name.c_str());
+						//m_OutputFunction("Initalized Capture %d %s in %s\n", in->value2, sptr[in->value].ToString().c_str(), curframe->prototype->name.c_str());
 						this->opencaptures.push_back(c);
 
 						if (frame->mark)
@@ -1262,316 +1886,1255 @@ Value JetContext::Execute(int iptr, Closure* frame)
 							this->RunGC();
 					}
 
-					break;
+					vmnext;
 				}
-			case InstructionType::Close:
+			vmcase(CCopy):
 				{
-					//remove from the back
-					while (opencaptures.size() > 0)
+					//the closure being made uses one of our captures, it gets the same one
+					auto frame = lastadded;
+					frame->upvals[in->value2] = curframe->upvals[in->value];
+					if (frame->mark)
 					{
-						auto cur = opencaptures.back();
-						int index = (int)(cur.capture->v - sptr);
-						if (index < in.value)
-							break;
-
-#ifdef _DEBUG
-						//this just verifies that the break above works right
-						if (cur.creator != this->curframe)
-							throw RuntimeException("RUNTIME ERROR: Tried to close capture in wrong scope!");
-#endif
-
-						cur.capture->closed = true;
-						cur.capture->value = *cur.capture->v;
-						cur.capture->v = &cur.capture->value;
-						//m_OutputFunction("Closed capture with value %s\n", cur->value.ToString().c_str());
-						//m_OutputFunction("Closed capture %d in %d as %s\n", i, cur, cur->upvals[i]->v->ToString().c_str());
-
-						//do a write barrier
-						if (cur.capture->value.type > ValueType::NativeFunction && cur.capture->value._object->grey == false)
-						{
-							cur.capture->value._object->grey = true;
-							this->gc.greys.Push(cur.capture->value);
-						}
-						opencaptures.pop_back();
+						frame->mark = false;
+						gc.greys.Push(frame);
 					}
-
-					break;
+					vmnext;
 				}
-			case InstructionType::Call:
+			vmcase(Close):
 				{
-					iptr = this->Call(&vars[in.value], iptr, in.value2);
-					break;
+					if (opencaptures.size() > 0)
+						this->Close(in->value);
+					vmnext;
 				}
-			case InstructionType::ECall:
+			vmcase(Call):
+				{
+					iptr = this->Call(&vars[in->value], (unsigned int)(in - code), in->value2);
+					vmframe;
+				}
+			vmcase(ECall):
 				{
 					//allocate capture area here
 					Value one;
-					stack.Pop(one);
-					iptr = this->Call(&one, iptr, in.value);
-					break;
+					vmstack_pop_to(stack, one);
+					iptr = this->Call(&one, (unsigned int)(in - code), in->value);
+					vmframe;
 				}
-			case InstructionType::Return:
+			vmcase(MCall):
 				{
-					auto& oframe = vmstack_peek(callstack);
-					iptr = oframe.first;
-					if (curframe && curframe->generator)
-						curframe->generator->Kill();
+					Value one;
+					vmstack_pop_to(stack, one);
+					unsigned int calls = callstack._size;
+					iptr = this->Call(&one, (unsigned int)(in - code), in->value);
 
-					if (oframe.first != JET_BAD_INSTRUCTION)
+					//script functions and generators return later through their frame, anything else already did
+					if (callstack._size > calls)
+						vmstack_peek(callstack).results = in->value2;
+					else
+						this->Results(1, in->value2);
+					vmframe;
+				}
+			vmcase(TailCall):
+				{
+					Value one;
+					vmstack_pop_to(stack, one);
+					unsigned int args = in->value;
+					if (in->value2)
 					{
-#ifdef _DEBUG
-						//this makes sure that the gc doesnt overrun its boundaries
-						for (int i = 0; i < (int)oframe.second->prototype->locals; i++)
-						{
-							//need to mark stack with garbage values for error checking
-							sptr[i].type = ValueType::Object;
-							sptr[i]._object = (JetObject*)0xcdcdcdcd;
-						}
-#endif
-						sptr -= oframe.second->prototype->locals;
+						//forwarding varargs, their count is under the function
+						Value count;
+						vmstack_pop_to(stack, count);
+						args += (unsigned int)count.int_value;
 					}
-					//m_OutputFunction("Return: Stack Ptr At: %d\n", sptr - localstack);
-					curframe = oframe.second;
-					vmstack_pop(callstack);
-					break;
+					if (one.type == ValueType::Function && one._function->generator == 0 && one._function->prototype->generator == false
+						&& curframe->generator == 0)
+					{
+						//nothing can be left pointing into the frame before it gets reused
+						if (opencaptures.size() > 0)
+							this->Close(0);
+						iptr = this->Call(&one, (unsigned int)(in - code), args, true);
+					}
+					else//natives, generators and the rest get called normally and return through the next instructions
+						iptr = this->Call(&one, (unsigned int)(in - code), args);
+					vmframe;
 				}
-			case InstructionType::Yield:
+			vmcase(VarArg):
 				{
-					if (curframe->generator)
-						curframe->generator->Yield(this, iptr);
+					//the vararg local holds the count when they are on the stack, or the array they escaped into
+					const Value& va = sptr[in->value];
+					Value& top = vmstack_peek(stack);
+					int index = (int)top;
+					if (va.type == ValueType::Int)
+					{
+						if (index >= va.int_value || index < 0)
+							throw RuntimeException("Array index out of range!");
+						top = sptr[curframe->prototype->locals + index];
+					}
 					else
-						throw RuntimeException("Cannot Yield from outside a generator");
+					{
+						if (index >= (int)va._array->data.size() || index < 0)
+							throw RuntimeException("Array index out of range!");
+						top = va._array->data[index];
+					}
+					vmnext;
+				}
+			vmcase(VarArgCount):
+				{
+					const Value& va = sptr[in->value];
+					if (va.type == ValueType::Int)
+						vmstack_push(stack, va);
+					else
+						vmstack_push(stack, Value((int)va._array->data.size()));
+					vmnext;
+				}
+			vmcase(PushVarArgs):
+				{
+					bool inplace = sptr[in->value].type == ValueType::Int;
+					unsigned int count = inplace ? (unsigned int)sptr[in->value].int_value : (unsigned int)sptr[in->value]._array->data.size();
+
+					//the depth check on entry only counted the count itself, this can move the stack
+					if (!this->Fits(count + curframe->prototype->maxstack))
+						throw RuntimeException("Stack Overflow!");
+					const Value* src = inplace ? &sptr[curframe->prototype->locals] : sptr[in->value]._array->data.data();
+					for (unsigned int i = 0; i < count; i++)
+						vmstack_push(stack, src[i]);
+					vmstack_push(stack, Value((int)count));
+					vmnext;
+				}
+			vmcase(VCall):
+				{
+					Value one, count;
+					vmstack_pop_to(stack, one);
+					vmstack_pop_to(stack, count);
+					unsigned int calls = callstack._size;
+					iptr = this->Call(&one, (unsigned int)(in - code), in->value + (unsigned int)count.int_value);
+
+					//value2 is the number of results wanted like with MCall when there is more than one
+					if (in->value2 > 1)
+					{
+						if (callstack._size > calls)
+							vmstack_peek(callstack).results = in->value2;
+						else
+							this->Results(1, in->value2);
+					}
+					vmframe;
+				}
+			vmcase(Return):
+				{
+					const CallFrame& oframe = vmstack_peek(callstack);
+					iptr = oframe.iptr;
+					Value* frame = sptr;
+					if (curframe && curframe->generator)
+						frame = curframe->generator->Kill(this);
 
-					auto oframe = callstack.Pop();
-					iptr = oframe.first;
-					curframe = oframe.second;
-					if (oframe.second)
-						sptr -= oframe.second->prototype->locals;
+					//drop the frame and leave the return value where the arguments were
+					Value ret = vmstack_peek(stack);
+					stack._size = (unsigned int)(frame - stack._data);
+					vmstack_push(stack, ret);
+					if (oframe.results != 1)
+						this->Results(1, oframe.results);
 
-					break;
+					sptr = oframe.base;
+					curframe = oframe.closure;
+					vmstack_pop(callstack);
+					vmframe;
+				}
+			vmcase(ReturnN):
+				{
+					const CallFrame& oframe = vmstack_peek(callstack);
+					iptr = oframe.iptr;
+					Value* frame = sptr;
+					if (curframe && curframe->generator)
+						frame = curframe->generator->Kill(this);
+
+					//move the values down to where the arguments were, as many as the caller wants
+					unsigned int count = in->value;
+					unsigned int wanted = oframe.results ? oframe.results : count;
+					const Value* values = &stack._data[stack._size - count];
+					for (unsigned int i = 0; i < wanted; i++)
+						frame[i] = i < count ? values[i] : Value::Empty;
+					stack._size = (unsigned int)(frame - stack._data) + wanted;
+					this->returned = wanted;
+
+					sptr = oframe.base;
+					curframe = oframe.closure;
+					vmstack_pop(callstack);
+					vmframe;
 				}
-			case InstructionType::Resume:
+			vmcase(Yield):
+				{
+					if (curframe->generator == 0)
+						throw RuntimeException("Cannot Yield from outside a generator");
+
+					//the locals stay in the generator, drop its temporaries and hand back the yielded value
+					Value ret = vmstack_peek(stack);
+					stack._size = (unsigned int)(curframe->generator->Yield(this, (unsigned int)(in - code)) - stack._data);
+					vmstack_push(stack, ret);
+
+					const CallFrame& oframe = vmstack_peek(callstack);
+					if (oframe.results != 1)
+						this->Results(1, oframe.results);
+					iptr = oframe.iptr;
+					sptr = oframe.base;
+					curframe = oframe.closure;
+					vmstack_pop(callstack);
+					vmframe;
+				}
+			vmcase(Resume):
 				{
 					//resume last item placed on stack
-					Value v = this->stack.Pop();
+					Value v;
+					vmstack_pop_to(stack, v);
 					if (v.type != ValueType::Function || v._function->generator == 0)
 						throw RuntimeException("Cannot resume a non generator!");
 
-					vmstack_push(callstack,(std::pair<unsigned int, Closure*>(iptr, curframe)));
+					iptr = this->Call(&v, (unsigned int)(in - code), 0);
+					vmframe;
+				}
+			vmcase(ForEach):
+				{
+					//value is the local holding the container, the next local holds the loop state
+					//arrays and objects are walked in place, generators and iterators from an
+					//iterator metamethod are called through the normal call path with this
+					//instruction as the return address, so it runs again once the result is pushed
+					enum
+					{
+						GeneratorCreated = -1,//just created the generator, its on the stack
+						GeneratorResumed = -2,//yielded value is on the stack
+						GeneratorSuspended = -3,
+						IteratorCreated = -4,//iterator() returned
+						IteratorAdvanced = -5,//advance() returned
+						IteratorCurrent = -6,//current() returned the value
+						IteratorSuspended = -7,
+					};
+					Value& container = sptr[in->value];
+					Value& state = sptr[in->value+1];
+					unsigned int ret = (unsigned int)(in - code) - 1;
+
+					if (state.type == ValueType::Null)
+					{
+						state = Value(0);
+						if (container.type == ValueType::Function)
+						{
+							if (container._function->generator)
+							{
+								if (container._function->generator->state == Generator::GeneratorState::Dead)
+									vmjump(in->target);
+								state.int_value = GeneratorResumed;
+								iptr = this->Call(&container, ret, 0);
+								vmframe;
+							}
+							else if (container._function->prototype->generator == false)
+								throw RuntimeException("Cannot iterate over a non generator function!");
 
-					sptr += curframe->prototype->locals;
+							state.int_value = GeneratorCreated;
+							iptr = this->Call(&container, ret, 0);
+							vmframe;
+						}
+						else if (container.type == ValueType::Object)
+						{
+							//objects only get iterated in place if nothing overrides the default iterator
+							for (JetObject* p = container._object; p && p != this->object; p = p->prototype)
+							{
+								if (p->findSlot("iterator"))
+								{
+									state.int_value = IteratorCreated;
+									break;
+								}
+							}
+						}
+						else if (container.type == ValueType::Userdata)
+							state.int_value = IteratorCreated;
+						else if (container.type != ValueType::Array)
+							throw RuntimeException("Cannot iterate over a " + (std::string)container.Type() + "!");
 
-					if ((sptr - localstack) >= JET_STACK_SIZE)
-						throw RuntimeException("Stack Overflow!");
+						if (state.int_value == IteratorCreated)
+						{
+							Value fun = GetMember(container, "iterator");
+							vmstack_push(stack, container);
+							iptr = this->Call(&fun, ret, 1);
+							vmframe;
+						}
+					}
 
-					curframe = v._function;
+					int64_t i = state.int_value;
+					if (i >= 0)
+					{
+						if (container.type == ValueType::Array)
+						{
+							if (i >= (int64_t)container._array->data.size())
+								vmjump(in->target);
+							vmstack_push(stack, container._array->data[(size_t)i]);
+						}
+						else
+						{
+							if (i >= (int64_t)container._object->size())
+								vmjump(in->target);
+							vmstack_push(stack, container._object->slots[i]);
+						}
+						state.int_value = i + 1;
+						vmnext;
+					}
 
-					iptr = v._function->generator->Resume(this)-1;
+					if (i == GeneratorCreated || i == GeneratorSuspended)
+					{
+						if (i == GeneratorCreated)
+							vmstack_pop_to(stack, container);
+						state.int_value = GeneratorResumed;
+						iptr = this->Call(&container, ret, 0);
+						vmframe;
+					}
+					else if (i == GeneratorResumed)
+					{
+						if (container._function->generator->state == Generator::GeneratorState::Dead)
+						{
+							vmstack_pop(stack);//the return value
+							vmjump(in->target);
+						}
+						state.int_value = GeneratorSuspended;
+						vmnext;
+					}
+					else if (i == IteratorCurrent)
+					{
+						state.int_value = IteratorSuspended;
+						vmnext;
+					}
+					else if (i == IteratorCreated || i == IteratorSuspended)
+					{
+						if (i == IteratorCreated)
+							vmstack_pop_to(stack, container);
+						Value fun = GetMember(container, "advance");
+						vmstack_push(stack, container);
+						state.int_value = IteratorAdvanced;
+						iptr = this->Call(&fun, ret, 1);
+						vmframe;
+					}
+					else if (i == IteratorAdvanced)
+					{
+						Value more;
+						vmstack_pop_to(stack, more);
+						if (more.type == ValueType::Null || (more.type == ValueType::Int && more.int_value == 0) || (more.type == ValueType::Real && more.value == 0.0))
+							vmjump(in->target);
+						Value fun = GetMember(container, "current");
+						vmstack_push(stack, container);
+						state.int_value = IteratorCurrent;
+						iptr = this->Call(&fun, ret, 1);
+						vmframe;
+					}
+					throw RuntimeException("Invalid ForEach state!");
+				}
+			vmcase(ForIntPrep):
+				{
+					const Value& i = sptr[in->value & 0xFF];
+					const Value& limit = sptr[(in->value >> 8) & 0xFF];
+					bool run;
+					switch ((in->value >> 16) & 0xFF)
+					{
+					case 0: run = vmcompare(i, limit, <); break;
+					case 1: run = vmcompare(i, limit, <=); break;
+					case 2: run = vmcompare(i, limit, >); break;
+					default: run = vmcompare(i, limit, >=); break;
+					}
+					if (run == false)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(ForIntLoop):
+				{
+					Value& i = sptr[in->value & 0xFF];
+					const Value& limit = sptr[(in->value >> 8) & 0xFF];
+					int step = (signed char)(in->value >> 24);
+					bool run;
+					if (i.type == ValueType::Int && limit.type == ValueType::Int)
+					{
+						int64_t n = i.int_value + step;
+						i.int_value = n;
+						switch ((in->value >> 16) & 0xFF)
+						{
+						case 0: run = n < limit.int_value; break;
+						case 1: run = n <= limit.int_value; break;
+						case 2: run = n > limit.int_value; break;
+						default: run = n >= limit.int_value; break;
+						}
+					}
+					else
+					{
+						//the counter or the limit stopped being an int, do what the loop would have done
+						i += Value(step);
+						switch ((in->value >> 16) & 0xFF)
+						{
+						case 0: run = vmcompare(i, limit, <); break;
+						case 1: run = vmcompare(i, limit, <=); break;
+						case 2: run = vmcompare(i, limit, >); break;
+						default: run = vmcompare(i, limit, >=); break;
+						}
+					}
+					if (run)
+					{
+						this->Check();
+#ifdef JET_JIT
+						if (this->jit && ++curframe->prototype->calls >= JET_JIT_THRESHOLD)
+						{
+							iptr = (int)(in->target - code) - 1;
+							vmframe;
+						}
+#endif
+						vmjump(in->target);
+					}
+					vmnext;
+				}
+			vmcase(Dup):
+				{
+					vmstack_push_top(stack);
+					vmnext;
+				}
+			vmcase(Pop):
+				{
+					vmstack_pop(stack);
+					vmnext;
+				}
+			vmcase(StoreAt):
+				{
+					this->StoreAt(in, caches);
+					vmnext;
+				}
+			vmcase(LoadAt):
+				{
+					this->LoadAt(in, caches);
+					vmnext;
+				}
+			vmcase(NewArray):
+				{
+					gc.Reserve(sizeof(JetArray) + in->value*sizeof(Value));
+					auto arr = new JetArray();//GCVal<std::vector<Value>>();
+					arr->grey = arr->mark = false;
+					arr->refcount = 0;
+					arr->context = this;
+					arr->type = ValueType::Array;
+					this->gc.AddObject((GarbageCollector::gcval*)arr);
+					arr->data.resize(in->value);
+					this->gc.Track(arr);
+					for (int i = in->value - 1; i >= 0; i--)
+					{
+						vmstack_pop_to(stack, arr->data[i]);
+					}
+					vmstack_push(stack,(Value(arr)));
 
-					break;
+					if (gc.allocationCounter++%GC_INTERVAL == 0)
+						this->RunGC();
+
+					vmnext;
+				}
+			vmcase(NewObject):
+				{
+					gc.Reserve(sizeof(JetObject) + in->value*sizeof(Value));
+					auto obj = new JetObject(this);
+					obj->grey = obj->mark = false;
+					obj->refcount = 0;
+					obj->type = ValueType::Object;
+					this->gc.AddObject((GarbageCollector::gcval*)obj);
+					for (int i = in->value-1; i >= 0; i--)
+					{
+						const auto& value = vmstack_peek(stack);
+						const auto& key = vmstack_peekn(stack,2);
+						(*obj)[key] = value;
+						vmstack_popn(stack,2);
+					}
+					vmstack_push(stack,Value(obj));
+
+					if (gc.allocationCounter++%GC_INTERVAL == 0)
+						this->RunGC();
+
+					vmnext;
+				}
+			vmcase(RMove):
+				{
+					sptr[in->value] = sptr[in->src1];
+					vmnext;
+				}
+			vmcase(RIncr):
+				{
+					Value a = sptr[in->value];
+					a.Increase();
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RDecr):
+				{
+					Value a = sptr[in->value];
+					a.Decrease();
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RLdInt):
+				{
+					sptr[in->value] = in->int_lit;
+					vmnext;
+				}
+			vmcase(RLdReal):
+				{
+					sptr[in->value] = in->lit;
+					vmnext;
+				}
+			vmcase(RAdd):
+				{
+					Value a = sptr[in->src1];
+					a += sptr[in->src2];
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RSub):
+				{
+					Value a = sptr[in->src1];
+					a -= sptr[in->src2];
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RMul):
+				{
+					Value a = sptr[in->src1];
+					a *= sptr[in->src2];
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RDiv):
+				{
+					Value a = sptr[in->src1];
+					a /= sptr[in->src2];
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(RModulus):
+				{
+					Value a = sptr[in->src1];
+					a %= sptr[in->src2];
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(REq):
+				{
+					bool b = sptr[in->src1] == sptr[in->src2];
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(RNotEq):
+				{
+					bool b = !(sptr[in->src1] == sptr[in->src2]);
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(RLt):
+				{
+					bool b = vmcompare(sptr[in->src1], sptr[in->src2], <);
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(RGt):
+				{
+					bool b = vmcompare(sptr[in->src1], sptr[in->src2], >);
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(RLtE):
+				{
+					bool b = vmcompare(sptr[in->src1], sptr[in->src2], <=);
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(RGtE):
+				{
+					bool b = vmcompare(sptr[in->src1], sptr[in->src2], >=);
+					set_value_bool(sptr[in->value], b);
+					vmnext;
+				}
+			vmcase(LLoadLLoad):
+				{
+					vmstack_push(stack, sptr[in->src1]);
+					vmstack_push(stack, sptr[in->src2]);
+					vmnext;
+				}
+			vmcase(LLoadLLoadAdd):
+				{
+					Value a = sptr[in->src1];
+					vmquicken(a, sptr[in->src2], LLoadLLoadAddIntInt, LLoadLLoadAddRealReal);
+					a += sptr[in->src2];
+					vmstack_push(stack, a);
+					vmnext;
+				}
+			vmcase(LLoadLLoadSub):
+				{
+					Value a = sptr[in->src1];
+					vmquicken(a, sptr[in->src2], LLoadLLoadSubIntInt, LLoadLLoadSubRealReal);
+					a -= sptr[in->src2];
+					vmstack_push(stack, a);
+					vmnext;
+				}
+			vmcase(LLoadLLoadMul):
+				{
+					Value a = sptr[in->src1];
+					vmquicken(a, sptr[in->src2], LLoadLLoadMulIntInt, LLoadLLoadMulRealReal);
+					a *= sptr[in->src2];
+					vmstack_push(stack, a);
+					vmnext;
+				}
+			vmcase(LdIntAdd):
+				{
+					Value& a = vmstack_peek(stack);
+					a += Value(in->int_lit);
+					vmnext;
+				}
+			vmcase(LdIntSub):
+				{
+					Value& a = vmstack_peek(stack);
+					a -= Value(in->int_lit);
+					vmnext;
+				}
+			vmcase(LdIntMul):
+				{
+					Value& a = vmstack_peek(stack);
+					a *= Value(in->int_lit);
+					vmnext;
+				}
+			vmcase(LLoadIncrLStore):
+				{
+					Value a = sptr[in->src1];
+					a.Increase();
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(LLoadDecrLStore):
+				{
+					Value a = sptr[in->src1];
+					a.Decrease();
+					sptr[in->value] = a;
+					vmnext;
+				}
+			vmcase(EqJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					bool jump = !(a == b);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(NotEqJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					bool jump = !(!(a == b));
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					vmquicken(a, b, LtJumpFalseIntInt, LtJumpFalseRealReal);
+					bool jump = !vmcompare(a, b, <);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					vmquicken(a, b, GtJumpFalseIntInt, GtJumpFalseRealReal);
+					bool jump = !vmcompare(a, b, >);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtEJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					vmquicken(a, b, LtEJumpFalseIntInt, LtEJumpFalseRealReal);
+					bool jump = !vmcompare(a, b, <=);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtEJumpFalse):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					vmquicken(a, b, GtEJumpFalseIntInt, GtEJumpFalseRealReal);
+					bool jump = !vmcompare(a, b, >=);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(AddIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Add);
+					a.int_value += b.int_value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(AddRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Add);
+					a.value += b.value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(SubIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Sub);
+					a.int_value -= b.int_value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(SubRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Sub);
+					a.value -= b.value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(MulIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Mul);
+					a.int_value *= b.int_value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(MulRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Mul);
+					a.value *= b.value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(DivIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Div);
+					a.int_value /= b.int_value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(DivRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Div);
+					a.value /= b.value;
+					--stack._size;
+					vmnext;
+				}
+			vmcase(LtIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Lt);
+					bool r = a.int_value < b.int_value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(LtRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Lt);
+					bool r = a.value < b.value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(GtIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(Gt);
+					bool r = a.int_value > b.int_value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(GtRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(Gt);
+					bool r = a.value > b.value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(LtEIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LtE);
+					bool r = a.int_value <= b.int_value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(LtERealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LtE);
+					bool r = a.value <= b.value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(GtEIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(GtE);
+					bool r = a.int_value >= b.int_value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(GtERealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(GtE);
+					bool r = a.value >= b.value;
+					set_value_bool(a, r);
+					--stack._size;
+					vmnext;
+				}
+			vmcase(LtJumpFalseIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LtJumpFalse);
+					bool jump = !(a.int_value < b.int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtJumpFalseRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LtJumpFalse);
+					bool jump = !(a.value < b.value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtJumpFalseIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(GtJumpFalse);
+					bool jump = !(a.int_value > b.int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtJumpFalseRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(GtJumpFalse);
+					bool jump = !(a.value > b.value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtEJumpFalseIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LtEJumpFalse);
+					bool jump = !(a.int_value <= b.int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtEJumpFalseRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LtEJumpFalse);
+					bool jump = !(a.value <= b.value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtEJumpFalseIntInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(GtEJumpFalse);
+					bool jump = !(a.int_value >= b.int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtEJumpFalseRealReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					const Value& a = vmstack_peekn(stack, 2);
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(GtEJumpFalse);
+					bool jump = !(a.value >= b.value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LLoadLLoadAddIntInt):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LLoadLLoadAdd);
+					vmstack_push(stack, Value(a.int_value + b.int_value));
+					vmnext;
+				}
+			vmcase(LLoadLLoadAddRealReal):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LLoadLLoadAdd);
+					vmstack_push(stack, Value(a.value + b.value));
+					vmnext;
+				}
+			vmcase(LLoadLLoadSubIntInt):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LLoadLLoadSub);
+					vmstack_push(stack, Value(a.int_value - b.int_value));
+					vmnext;
+				}
+			vmcase(LLoadLLoadSubRealReal):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LLoadLLoadSub);
+					vmstack_push(stack, Value(a.value - b.value));
+					vmnext;
+				}
+			vmcase(LLoadLLoadMulIntInt):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Int || b.type != ValueType::Int)
+						vmdeopt(LLoadLLoadMul);
+					vmstack_push(stack, Value(a.int_value * b.int_value));
+					vmnext;
+				}
+			vmcase(LLoadLLoadMulRealReal):
+				{
+					const Value& a = sptr[in->src1];
+					const Value& b = sptr[in->src2];
+					if (a.type != ValueType::Real || b.type != ValueType::Real)
+						vmdeopt(LLoadLLoadMul);
+					vmstack_push(stack, Value(a.value * b.value));
+					vmnext;
+				}
+			vmcase(AddInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).int_value += b.int_value;
+					vmnext;
+				}
+			vmcase(SubInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).int_value -= b.int_value;
+					vmnext;
+				}
+			vmcase(MulInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).int_value *= b.int_value;
+					vmnext;
+				}
+			vmcase(AddReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).value += b.value;
+					vmnext;
+				}
+			vmcase(SubReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).value -= b.value;
+					vmnext;
+				}
+			vmcase(MulReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).value *= b.value;
+					vmnext;
+				}
+			vmcase(DivReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					vmstack_peek(stack).value /= b.value;
+					vmnext;
+				}
+			vmcase(LtInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.int_value < b.int_value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(GtInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.int_value > b.int_value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(LtEInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.int_value <= b.int_value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(GtEInt):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.int_value >= b.int_value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(LtReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.value < b.value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(GtReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.value > b.value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(LtEReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.value <= b.value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(GtEReal):
+				{
+					const Value& b = vmstack_peek(stack);
+					--stack._size;
+					Value& a = vmstack_peek(stack);
+					bool r = a.value >= b.value;
+					set_value_bool(a, r);
+					vmnext;
+				}
+			vmcase(LtIntJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).int_value < vmstack_peek(stack).int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtIntJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).int_value > vmstack_peek(stack).int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtEIntJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).int_value <= vmstack_peek(stack).int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtEIntJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).int_value >= vmstack_peek(stack).int_value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtRealJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).value < vmstack_peek(stack).value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtRealJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).value > vmstack_peek(stack).value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(LtERealJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).value <= vmstack_peek(stack).value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
+				}
+			vmcase(GtERealJumpFalse):
+				{
+					bool jump = !(vmstack_peekn(stack, 2).value >= vmstack_peek(stack).value);
+					vmstack_popn(stack, 2);
+					if (jump)
+						vmjump(in->target);
+					vmnext;
 				}
-			case InstructionType::Dup:
+			vmcase(LLoadLLoadAddInt):
 				{
-					vmstack_push_top(stack);
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].int_value + sptr[in->src2].int_value));
+					vmnext;
 				}
-			case InstructionType::Pop:
+			vmcase(LLoadLLoadSubInt):
 				{
-					vmstack_pop(stack);
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].int_value - sptr[in->src2].int_value));
+					vmnext;
 				}
-			case InstructionType::StoreAt:
+			vmcase(LLoadLLoadMulInt):
 				{
-					if (in.string)
-					{
-						Value& loc = vmstack_peek(stack);
-						Value& val = vmstack_peekn(stack,2);
-
-						if (loc.type == ValueType::Object)
-							(*loc._object)[in.string] = val;
-						else
-							throw RuntimeException("Could not index a non array/object value!");
-						vmstack_popn(stack,2);
-						//this may be redundant and already done in object
-						//check me
-						if (loc._object->mark)
-						{
-							//reset to grey and push back for reprocessing
-							loc._object->mark = false;
-							gc.greys.Push(loc);//push to grey stack
-						}
-						//write barrier
-					}
-					else
-					{
-						Value& index = vmstack_peekn(stack,1);
-						Value& loc = vmstack_peekn(stack,2);
-						Value& val = vmstack_peekn(stack,3);	
-
-						if (loc.type == ValueType::Array)
-						{
-							int in = (int)index;
-							if (in >= (int)loc._array->data.size() || in < 0)
-								throw RuntimeException("Array index out of range!");
-							loc._array->data[in] = val;
-
-							//write barrier
-							if (loc._array->mark)
-							{
-								//reset to grey and push back for reprocessing
-								//m_OutputFunction("write barrier triggered!\n");
-								loc._array->mark = false;
-								gc.greys.Push(loc);//push to grey stack
-							}
-						}
-						else if (loc.type == ValueType::Object)
-						{
-							(*loc._object)[index] = val;
-
-							//write barrier
-							//this may be redundant, lets check
-							//its also done in the object object
-							if (loc._object->mark)
-							{
-								//reset to grey and push back for reprocessing
-								//m_OutputFunction("write barrier triggered!\n");
-								loc._object->mark = false;
-								gc.greys.Push(loc);//push to grey stack
-							}
-						}
-						else if (loc.type == ValueType::String)
-						{
-							int in = (int)index;
-							if (in >= (int)loc.length || in < 0)
-								throw RuntimeException("String index out of range!");
-
-							loc._string->data[in] = (int)val;
-						}
-						else
-						{
-							throw RuntimeException("Could not index a non array/object value!");
-						}
-						vmstack_popn(stack, 3);
-					}
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].int_value * sptr[in->src2].int_value));
+					vmnext;
 				}
-			case InstructionType::LoadAt:
+			vmcase(LLoadLLoadAddReal):
 				{
-					if (in.string)
-					{
-						Value loc;
-						stack.Pop(loc);
-						if (loc.type == ValueType::Object)
-						{
-							auto n = loc._object->findNode(in.string);
-							if (n)
-							{
-								vmstack_push(stack, n->second);
-							}
-							else
-							{
-								auto obj = loc._object->prototype;
-								while (obj)
-								{
-									n = obj->findNode(in.string);
-									if (n)
-									{
-										vmstack_push(stack, n->second);
-										break;
-									}
-									obj = obj->prototype;
-								}
-							}
-						}
-						else if (loc.type == ValueType::String)
-							vmstack_push(stack, ((*this->string)[in.string]));
-						else if (loc.type == ValueType::Array)
-							vmstack_push(stack, ((*this->Array)[in.string]));
-						else if (loc.type == ValueType::Userdata)
-							vmstack_push(stack, ((*loc._userdata->prototype)[in.string]));
-						else if (loc.type == ValueType::Function && loc._function->prototype->generator)
-							vmstack_push(stack, ((*this->function)[in.string]));
-						else
-							throw RuntimeException("Could not index a non array/object value!");
-					}
-					else
-					{
-						Value index = stack.Pop();
-						Value loc = stack.Pop();
-
-						if (loc.type == ValueType::Array)
-						{
-							int in = (int)index;
-							if (in >= (int)loc._array->data.size() || in < 0)
-								throw RuntimeException("Array index out of range!");
-							vmstack_push(stack, (loc._array->data[in]));
-						}
-						else if (loc.type == ValueType::Object)
-							vmstack_push(stack,((*loc._object).get(index)));
-						else if (loc.type == ValueType::String)
-						{
-							int in = (int)index;
-							if (in >= (int)loc.length || in < 0)
-								throw RuntimeException("String index out of range!");
-
-							vmstack_push(stack, Value(loc._string->data[in]));
-						}
-
-						else
-							throw RuntimeException("Could not index a non array/object value!");
-					}
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].value + sptr[in->src2].value));
+					vmnext;
 				}
-			case InstructionType::NewArray:
+			vmcase(LLoadLLoadSubReal):
 				{
-					auto arr = new JetArray();//GCVal<std::vector<Value>>();
-					arr->grey = arr->mark = false;
-					arr->refcount = 0;
-					arr->context = this;
-					arr->type = ValueType::Array;
-					this->gc.gen1.push_back((GarbageCollector::gcval*)arr);
-					arr->data.resize(in.value);
-					for (int i = in.value - 1; i >= 0; i--)
-					{
-						stack.Pop(arr->data[i]);
-					}
-					vmstack_push(stack,(Value(arr)));
-
-					if (gc.allocationCounter++%GC_INTERVAL == 0)
-						this->RunGC();
-
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].value - sptr[in->src2].value));
+					vmnext;
 				}
-			case InstructionType::NewObject:
+			vmcase(LLoadLLoadMulReal):
 				{
-					auto obj = new JetObject(this);
-					obj->grey = obj->mark = false;
-					obj->refcount = 0;
-					obj->type = ValueType::Object;
-					this->gc.gen1.push_back((GarbageCollector::gcval*)obj);
-					for (int i = in.value-1; i >= 0; i--)
-					{
-						const auto& value = vmstack_peek(stack);
-						const auto& key = vmstack_peekn(stack,2);
-						(*obj)[key] = value;
-						vmstack_popn(stack,2);
-					}
-					vmstack_push(stack,Value(obj));
-
-					if (gc.allocationCounter++%GC_INTERVAL == 0)
-						this->RunGC();
-
-					break;
+					vmstack_push(stack, Value(sptr[in->src1].value * sptr[in->src2].value));
+					vmnext;
 				}
-			default:
+			vmcase(LdIntAddInt):
+				{
+					vmstack_peek(stack).int_value += in->int_lit;
+					vmnext;
+				}
+			vmcase(LdIntSubInt):
+				{
+					vmstack_peek(stack).int_value -= in->int_lit;
+					vmnext;
+				}
+			vmcase(LdIntMulInt):
+				{
+					vmstack_peek(stack).int_value *= in->int_lit;
+					vmnext;
+				}
+			vmdefault:
 				throw RuntimeException("Unimplemented Instruction!");
 			}
 
+			in++;
+			}
+newframe:
 			iptr++;
 		}
 	}
 	catch(RuntimeException e)
 	{
+		if (in)
+			iptr = (int)(in - code);
+
 		if (e.processed == false)
 		{
 			m_OutputFunction("RuntimeException: %s\nCallstack:\n", e.reason.c_str());
@@ -1612,19 +3175,29 @@ Value JetContext::Execute(int iptr, Closure* frame)
 
 		//make sure I reset everything in the event of an error
 
+		//close what the unwound frames left open, nothing can point into them once they are gone
+		while (this->opencaptures.size() > startcaptures)
+		{
+			this->Close(this->opencaptures.back().capture);
+			this->opencaptures.pop_back();
+		}
+
+		//reset the local variable stack, the frame we started with remembers where it was
+		this->sptr = this->callstack._data[startcallstack].base;
+
 		//clear the stacks
 		this->callstack.QuickPop(this->callstack.size()-startcallstack);
 		this->stack.QuickPop(this->stack.size()-startstack);
 
-		//reset the local variable stack
-		this->sptr = startlocalstack;
-
 		//ok add the exception details to the exception as a string or something rather than just printing them
 		//maybe add more details to the exception when rethrowing
 		throw e;
 	}
 	catch(...)
 	{
+		if (in)
+			iptr = (int)(in - code);
+
 		//this doesnt work right
 		m_OutputFunction("Caught Some Other Exception\n\nCallstack:\n");
 
@@ -1636,13 +3209,19 @@ Value JetContext::Execute(int iptr, Closure* frame)
 			m_OutputFunction("%s = %s\n", ii.first.c_str(), vars[ii.second].ToString().c_str());
 		}
 
+		while (this->opencaptures.size() > startcaptures)
+		{
+			this->Close(this->opencaptures.back().capture);
+			this->opencaptures.pop_back();
+		}
+
+		//reset the local variable stack
+		this->sptr = this->callstack._data[startcallstack].base;
+
 		//ok, need to properly roll back callstack
 		this->callstack.QuickPop(this->callstack.size()-startcallstack);
 		this->stack.QuickPop(this->stack.size()-startstack);
 
-		//reset the local variable stack
-		this->sptr = startlocalstack;
-
 		//rethrow the exception
 		auto exception = RuntimeException("Unknown Exception Thrown From Native!");
 		exception.processed = true;
@@ -1663,21 +3242,39 @@ Value JetContext::Execute(int iptr, Closure* frame)
 	//debug checks for stack and what not
 	if (this->callstack.size() == 0)
 	{
-		if (this->sptr != this->localstack)
+		if (this->sptr != this->stack._data)
 			throw RuntimeException("FATAL ERROR: Local stack did not properly reset");
 	}
 
 	//check for stack leaks
-	if (this->stack.size() > startstack+1)
+	if (this->stack.size() > startstack+this->returned)
 	{
 		this->stack.QuickPop(stack.size());
 		throw RuntimeException("FATAL ERROR: Stack leak detected!");
 	}
 #endif
 
-	return stack.Pop();
+	//everything returned is on the stack, the first value is the result
+	Value* first = &stack._data[stack._size - this->returned];
+	if (results)
+		results->assign(first, &stack._data[stack._size]);
+	Value ret = this->returned ? *first : Value::Empty;
+	stack._size -= this->returned;
+	return ret;
 }
 
+#undef vmcase
+#undef vmdefault
+#undef vmdispatch
+#undef vmnext
+#undef vmjump
+#undef vmframe
+#undef vmrewrite
+#undef vmquicken
+#undef vmdeopt
+#undef vmnumber
+#undef vmcompare
+
 void JetContext::GetCode(int ptr, Closure* closure, std::string& ret, unsigned int& line)
 {
 	if (closure->prototype->debuginfo.size() == 0)//make sure we have debug info
@@ -1720,22 +3317,22 @@ void JetContext::StackTrace(int curiptr, Closure* cframe)
 {
 	auto tempcallstack = this->callstack.Copy();
 	if (curframe)
-		tempcallstack.Push(std::pair<unsigned int, Closure*>(curiptr,cframe));
+		tempcallstack.Push(CallFrame(curiptr, cframe, nullptr));
 
 	while(tempcallstack.size() > 0)
 	{
 		auto top = tempcallstack.Pop();
 		int greatest = -1;
 
-		if (top.first == JET_BAD_INSTRUCTION)
+		if (top.iptr == JET_BAD_INSTRUCTION)
 			m_OutputFunction("{Native}\n");
 		else
 		{
-			std::string fun = top.second->prototype->name;
+			std::string fun = top.closure->prototype->name;
 			std::string file;
 			unsigned int line;
-			this->GetCode(top.first, top.second, file, line);
-			m_OutputFunction("%s() %s Line %d (Instruction %d)\n", fun.c_str(), file.c_str(), line, top.first);
+			this->GetCode(top.iptr, top.closure, file, line);
+			m_OutputFunction("%s() %s Line %d (Instruction %d)\n", fun.c_str(), file.c_str(), line, top.iptr);
 		}
 	}
 }
@@ -1771,8 +3368,10 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 				func->upvals = inst.c;
 				func->name = inst.string;
 				func->context = this;
+				func->closure = 0;
 				func->generator = inst.d & 2 ? true : false;
 				func->vararg = inst.d & 1? true : false;
+				func->stackvarargs = inst.d & 4 ? true : false;
 
 				if (functions.find(inst.string) == functions.end())
 					functions[inst.string] = func;
@@ -1866,7 +3465,7 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 					{
 						if (variables.find(inst.string) == variables.end())
 						{
-							//ȫֱ
+							//添加全局变量
 							variables[inst.string] = (unsigned int)variables.size();
 							vars.push_back(Value::Empty);
 						}
@@ -1876,9 +3475,21 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 					}
 				case InstructionType::LdStr:
 					{
-						Value str = this->NewString(inst.string, false);
-						str.AddRef();
-						ins.strlit = str._string;
+						ins.strlit = this->Intern(inst.string);
+						this->Pin(ins.strlit);
+						delete[] inst.string;
+						break;
+					}
+				case InstructionType::LoadAt:
+				case InstructionType::StoreAt:
+					{
+						//constant keys are looked up by their interned string
+						if (inst.string)
+						{
+							ins.strlit = this->Intern(inst.string);
+							this->Pin(ins.strlit);
+							delete[] inst.string;
+						}
 						break;
 					}
 				case InstructionType::LdInt:
@@ -1891,6 +3502,51 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 						ins.lit = inst.second;
 						break;
 					}
+				case InstructionType::RLdInt:
+				case InstructionType::LdIntAdd:
+				case InstructionType::LdIntSub:
+				case InstructionType::LdIntMul:
+				case InstructionType::LdIntAddInt:
+				case InstructionType::LdIntSubInt:
+				case InstructionType::LdIntMulInt:
+					{
+						ins.int_lit = inst.int_second;
+						break;
+					}
+				case InstructionType::RLdReal:
+					{
+						ins.lit = inst.second;
+						break;
+					}
+				case InstructionType::RMove:
+				case InstructionType::RAdd:
+				case InstructionType::RSub:
+				case InstructionType::RMul:
+				case InstructionType::RDiv:
+				case InstructionType::RModulus:
+				case InstructionType::REq:
+				case InstructionType::RNotEq:
+				case InstructionType::RLt:
+				case InstructionType::RGt:
+				case InstructionType::RLtE:
+				case InstructionType::RGtE:
+				case InstructionType::LLoadLLoad:
+				case InstructionType::LLoadLLoadAdd:
+				case InstructionType::LLoadLLoadSub:
+				case InstructionType::LLoadLLoadMul:
+				case InstructionType::LLoadLLoadAddInt:
+				case InstructionType::LLoadLLoadSubInt:
+				case InstructionType::LLoadLLoadMulInt:
+				case InstructionType::LLoadLLoadAddReal:
+				case InstructionType::LLoadLLoadSubReal:
+				case InstructionType::LLoadLLoadMulReal:
+				case InstructionType::LLoadIncrLStore:
+				case InstructionType::LLoadDecrLStore:
+					{
+						ins.src1 = inst.a;
+						ins.src2 = inst.b;
+						break;
+					}
 				case InstructionType::LoadFunction:
 					{
 						ins.func = functions[inst.string];
@@ -1902,23 +3558,45 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 				case InstructionType::JumpTrue:
 				case InstructionType::JumpFalsePeek:
 				case InstructionType::JumpTruePeek:
+				case InstructionType::EqJumpFalse:
+				case InstructionType::NotEqJumpFalse:
+				case InstructionType::LtJumpFalse:
+				case InstructionType::GtJumpFalse:
+				case InstructionType::LtEJumpFalse:
+				case InstructionType::GtEJumpFalse:
+				case InstructionType::LtIntJumpFalse:
+				case InstructionType::GtIntJumpFalse:
+				case InstructionType::LtEIntJumpFalse:
+				case InstructionType::GtEIntJumpFalse:
+				case InstructionType::LtRealJumpFalse:
+				case InstructionType::GtRealJumpFalse:
+				case InstructionType::LtERealJumpFalse:
+				case InstructionType::GtERealJumpFalse:
 					{
 						if (labels.find(inst.string) == labels.end())
 							throw RuntimeException("Label '" + (std::string)inst.string + "' does not exist!");
 						ins.value = labels[inst.string];
 						break;
 					}
+				case InstructionType::ForIntPrep:
+				case InstructionType::ForIntLoop:
+					{
+						if (labels.find(inst.string) == labels.end())
+							throw RuntimeException("Label '" + (std::string)inst.string + "' does not exist!");
+						ins.value = inst.a | (inst.b << 8) | (inst.c << 16) | (inst.d << 24);
+						ins.value2 = labels[inst.string];
+
+						delete[] inst.string;
+						break;
+					}
 				case InstructionType::ForEach:
 					{
+						//value is the container local, value2 the end of the loop
 						if (labels.find(inst.string) == labels.end())
 							throw RuntimeException("Label '" + (std::string)inst.string + "' does not exist!");
-						ins.value = labels[inst.string];
-						if (labels.find(inst.string2) == labels.end())
-							throw RuntimeException("Label '" + (std::string)inst.string2 + "' does not exist!");
-						ins.value2 = labels[inst.string2];
+						ins.value2 = labels[inst.string];
 
 						delete[] inst.string;
-						delete[] inst.string2;
 						break;
 					}
 				}
@@ -1930,20 +3608,14 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 	if (labels.size() > 100000)
 		throw CompilerException("test", 5, "problem with labels!");
 
-	auto frame = new Closure;
-	frame->grey = frame->mark = false;
-	frame->refcount = 0;
-	frame->prev = 0;
-	frame->generator = 0;
-	frame->prototype = this->functions["{Entry Point}"];
-	frame->numupvals = frame->prototype->upvals;
-	frame->type = ValueType::Function;
-	//if (frame->numupvals)
-	//frame->upvals = new Value*[frame->numupvals];
-	//else
-	frame->upvals = 0;
-
-	gc.AddObject((GarbageCollector::gcval*)frame);
+	//decode all the newly assembled functions
+	for (auto ii: this->functions)
+	{
+		if (ii.second->code.size() != ii.second->instructions.size())
+			this->Decode(ii.second);
+	}
+
+	auto frame = this->AllocClosure(this->functions["{Entry Point}"]);
 
 #ifdef JET_TIME_EXECUTION
 	QueryPerformanceCounter( (LARGE_INTEGER *)&end );
@@ -1957,9 +3629,244 @@ Value JetContext::Assemble(const std::vector<IntermediateInstruction>& code)
 	return frame;
 };
 
+void JetContext::Decode(Function* func)
+{
+	//size these up front so jump targets and caches can be pointed into
+	func->code.resize(func->instructions.size());
+	unsigned int caches = 0;
+	for (auto& ins: func->instructions)
+	{
+		if ((ins.instruction == InstructionType::LoadAt || ins.instruction == InstructionType::StoreAt) && ins.strlit)
+			caches++;
+	}
+	func->caches.resize(caches);
+	caches = 0;
+	for (unsigned int i = 0; i < func->instructions.size(); i++)
+	{
+		const Instruction& ins = func->instructions[i];
+		DecodedInstruction& out = func->code[i];
+		out.instruction = ins.instruction;
+#ifdef JET_COMPUTED_GOTO
+		out.handler = handlers[(int)ins.instruction];
+#else
+		out.handler = nullptr;
+#endif
+		switch (ins.instruction)
+		{
+		case InstructionType::Jump:
+		case InstructionType::JumpFalse:
+		case InstructionType::JumpTrue:
+		case InstructionType::JumpFalsePeek:
+		case InstructionType::JumpTruePeek:
+		case InstructionType::EqJumpFalse:
+		case InstructionType::NotEqJumpFalse:
+		case InstructionType::LtJumpFalse:
+		case InstructionType::GtJumpFalse:
+		case InstructionType::LtEJumpFalse:
+		case InstructionType::GtEJumpFalse:
+		case InstructionType::LtIntJumpFalse:
+		case InstructionType::GtIntJumpFalse:
+		case InstructionType::LtEIntJumpFalse:
+		case InstructionType::GtEIntJumpFalse:
+		case InstructionType::LtRealJumpFalse:
+		case InstructionType::GtRealJumpFalse:
+		case InstructionType::LtERealJumpFalse:
+		case InstructionType::GtERealJumpFalse:
+			out.value = ins.value;
+			out.target = &func->code[ins.value];
+			//backward jumps are where loops go around, they check the budget
+			if (ins.instruction == InstructionType::Jump && ins.value <= (int)i)
+			{
+				out.instruction = InstructionType::Loop;
+#ifdef JET_COMPUTED_GOTO
+				out.handler = handlers[(int)InstructionType::Loop];
+#endif
+			}
+			break;
+		case InstructionType::ForEach:
+		case InstructionType::ForIntPrep:
+		case InstructionType::ForIntLoop:
+			out.value = ins.value;
+			out.target = &func->code[ins.value2];
+			break;
+		case InstructionType::LoadAt:
+		case InstructionType::StoreAt:
+			out.value = ins.strlit ? caches++ : ins.value;
+			out.strlit = ins.strlit;
+			break;
+		default:
+			out.value = ins.value;
+			out.string = ins.string;//copies the whole operand
+		}
+	}
+
+	func->maxstack = StackDepth(func);
+}
+
+unsigned int JetContext::StackDepth(const Function* func)
+{
+	//depth of the operand stack before each instruction relative to the function entry, -1 if not reached yet
+	//the compiler always leaves the stack balanced where paths meet, so each instruction only needs visiting once
+	std::vector<int> depths(func->instructions.size(), -1);
+	std::vector<std::pair<unsigned int, int>> work;
+	work.push_back(std::pair<unsigned int, int>(0, 0));
+	int max = 0;
+	while (work.size())
+	{
+		unsigned int i = work.back().first;
+		int depth = work.back().second;
+		work.pop_back();
+		for (; i < func->instructions.size() && depths[i] < 0; i++)
+		{
+			depths[i] = depth;
+			const Instruction& ins = func->instructions[i];
+			int branch = -1;//instruction index of a possible jump
+			int taken = 0;//depth at the jump target
+			bool falls = true;//if the next instruction can run after this one
+			switch (ins.instruction)
+			{
+			case InstructionType::LdInt:
+			case InstructionType::LdReal:
+			case InstructionType::LdNull:
+			case InstructionType::LdStr:
+			case InstructionType::LoadFunction:
+			case InstructionType::Load:
+			case InstructionType::LLoad:
+			case InstructionType::CLoad:
+			case InstructionType::Dup:
+			case InstructionType::LLoadLLoadAdd:
+			case InstructionType::LLoadLLoadSub:
+			case InstructionType::LLoadLLoadMul:
+			case InstructionType::LLoadLLoadAddInt: case InstructionType::LLoadLLoadSubInt:
+			case InstructionType::LLoadLLoadMulInt:
+			case InstructionType::LLoadLLoadAddReal: case InstructionType::LLoadLLoadSubReal:
+			case InstructionType::LLoadLLoadMulReal:
+				depth++;
+				break;
+			case InstructionType::LLoadLLoad:
+				depth += 2;
+				break;
+			case InstructionType::Add: case InstructionType::Sub:
+			case InstructionType::Mul: case InstructionType::Div:
+			case InstructionType::Modulus:
+			case InstructionType::BAnd: case InstructionType::BOr:
+			case InstructionType::Xor:
+			case InstructionType::LeftShift: case InstructionType::RightShift:
+			case InstructionType::Eq: case InstructionType::NotEq:
+			case InstructionType::Lt: case InstructionType::Gt:
+			case InstructionType::LtE: case InstructionType::GtE:
+			case InstructionType::AddInt: case InstructionType::SubInt:
+			case InstructionType::MulInt:
+			case InstructionType::AddReal: case InstructionType::SubReal:
+			case InstructionType::MulReal: case InstructionType::DivReal:
+			case InstructionType::LtInt: case InstructionType::GtInt:
+			case InstructionType::LtEInt: case InstructionType::GtEInt:
+			case InstructionType::LtReal: case InstructionType::GtReal:
+			case InstructionType::LtEReal: case InstructionType::GtEReal:
+			case InstructionType::Pop:
+			case InstructionType::Store:
+			case InstructionType::LStore:
+			case InstructionType::CStore:
+				depth--;
+				break;
+			case InstructionType::Jump:
+				branch = ins.value;
+				falls = false;
+				break;
+			case InstructionType::JumpTruePeek:
+			case InstructionType::JumpFalsePeek:
+				branch = ins.value;
+				break;
+			case InstructionType::JumpTrue:
+			case InstructionType::JumpFalse:
+				depth--;
+				branch = ins.value;
+				break;
+			case InstructionType::EqJumpFalse: case InstructionType::NotEqJumpFalse:
+			case InstructionType::LtJumpFalse: case InstructionType::GtJumpFalse:
+			case InstructionType::LtEJumpFalse: case InstructionType::GtEJumpFalse:
+			case InstructionType::LtIntJumpFalse: case InstructionType::GtIntJumpFalse:
+			case InstructionType::LtEIntJumpFalse: case InstructionType::GtEIntJumpFalse:
+			case InstructionType::LtRealJumpFalse: case InstructionType::GtRealJumpFalse:
+			case InstructionType::LtERealJumpFalse: case InstructionType::GtERealJumpFalse:
+				depth -= 2;
+				branch = ins.value;
+				break;
+			case InstructionType::ForEach:
+				//pushes the next value or jumps to the end with nothing
+				branch = ins.value2;
+				depth++;
+				taken = -1;
+				break;
+			case InstructionType::ForIntPrep:
+			case InstructionType::ForIntLoop:
+				branch = ins.value2;
+				break;
+			case InstructionType::NewArray:
+				depth += 1 - ins.value;
+				break;
+			case InstructionType::NewObject:
+				depth += 1 - 2*ins.value;
+				break;
+			case InstructionType::LoadAt:
+				if (ins.strlit == 0)
+					depth--;
+				break;
+			case InstructionType::StoreAt:
+				depth -= ins.strlit ? 2 : 3;
+				break;
+			case InstructionType::Call:
+				depth += 1 - ins.value2;
+				break;
+			case InstructionType::ECall:
+				depth -= ins.value;
+				break;
+			case InstructionType::TailCall:
+				depth -= ins.value + (ins.value2 ? 1 : 0);
+				break;
+			case InstructionType::VarArgCount:
+				depth++;
+				break;
+			case InstructionType::PushVarArgs:
+				//only the count is known here, the varargs themselves get checked when they are pushed
+				depth++;
+				break;
+			case InstructionType::VCall:
+				depth -= ins.value + 1;
+				if (ins.value2 > 1)
+					depth += ins.value2 - 1;
+				break;
+			case InstructionType::MCall:
+				depth += ins.value2 - ins.value - 1;
+				break;
+			case InstructionType::Return:
+			case InstructionType::ReturnN:
+				falls = false;
+				break;
+			default:
+				//everything else works in place or on locals only
+				break;
+			}
+			if (depth > max)
+				max = depth;
+			if (branch >= 0)
+				work.push_back(std::pair<unsigned int, int>(branch, depth + taken));
+			if (falls == false)
+				break;
+		}
+	}
+	return max;
+}
 
 Value JetContext::Call(const Value* fun, Value* args, unsigned int numargs)
 {
+	return this->Call(fun, args, numargs, nullptr);
+}
+
+Value JetContext::Call(const Value* fun, Value* args, unsigned int numargs, std::vector<Value>* results)
+{
+	if (results)
+		results->clear();
 	if (fun->type != ValueType::NativeFunction && fun->type != ValueType::Function)
 	{
 		m_OutputFunction("ERROR: Variable is not a function\n");
@@ -1968,112 +3875,105 @@ Value JetContext::Call(const Value* fun, Value* args, unsigned int numargs)
 	else if (fun->type == ValueType::NativeFunction)
 	{
 		//call it
-		int s = this->stack.size();
-		(*fun->func)(this,args,numargs);
-		if (s == this->stack.size())
-			return Value::Empty;
-
-		return this->stack.Pop();
+		Value ret = (*fun->func)(this,args,numargs);
+		if (results)
+			results->push_back(ret);
+		return ret;
 	}
-	else if (fun->_function->generator)
+	if (fun->_function->prototype->generator && fun->_function->generator == 0)
 	{
-		if (curframe)
-			sptr += curframe->prototype->locals;
-
-		if ((sptr - localstack) >= JET_STACK_SIZE)
+		//the generator takes its arguments off the stack
+		if (!this->Fits(numargs))
 			throw RuntimeException("Stack Overflow!");
+		for (unsigned int i = 0; i < numargs; i++)
+			vmstack_push(stack, args[i]);
 
-		curframe = fun->_function;
-
-		if (numargs == 0)
-			stack.Push(Value::Empty);
-		else if (numargs >= 1)
-			stack.Push(args[0]);
-		int iptr = fun->_function->generator->Resume(this);
-
-		return this->Execute(iptr, fun->_function);
-	}
-
-	if (fun->_function->prototype->generator)
-	{
 		//create generator and return it
-		Closure* closure = new Closure;
-		closure->grey = closure->mark = false;
-		closure->refcount = 0;
-
-		closure->prev = fun->_function->prev;
-		closure->numupvals = fun->_function->numupvals;
-		closure->generator = new Generator(fun->_function->prototype->context, fun->_function, numargs);
+		Closure* closure = this->AllocClosure(fun->_function->prototype);
+		closure->generator = new Generator(this, fun->_function, numargs);
 		if (closure->numupvals)
-		{
-			closure->upvals = new Capture*[closure->numupvals];
-			memset(closure->upvals, 0, sizeof(Capture*)*closure->numupvals);
-		}
-		closure->prototype = fun->_function->prototype;
-		closure->type = ValueType::Function;
-		this->gc.AddObject((GarbageCollector::gcval*)closure);
+			memcpy(closure->upvals, fun->_function->upvals, sizeof(Capture*)*closure->numupvals);
 
+		if (results)
+			results->push_back(Value(closure));
 		return Value(closure);
 	}
 
-	bool pushed = false;
-	if (this->curframe)
-	{
-		//need to advance stack pointer
-		sptr += curframe->prototype->locals;
-		pushed = true;
-		this->callstack.Push(std::pair<unsigned int, Closure*>(0, curframe));
-	}
-
-	//clear stack values for the gc
-	for (unsigned int i = 0; i < fun->_function->prototype->locals; i++)
-		sptr[i] = Value::Empty;
-
-	//push args onto stack
-	for (unsigned int i = 0; i < numargs; i++)
-		this->stack.Push(args[i]);
-
-	auto func = fun->_function;
-	if (numargs <= func->prototype->args)
-	{
-		for (int i = (int)func->prototype->args - 1; i >= 0; i--)
-		{
-			if (i < (int)numargs)
-				stack.Pop(sptr[i]);
-		}
-	}
-	else if (func->prototype->vararg)
+	Function* func = fun->_function->prototype;
+	if (!this->Fits(numargs + func->locals + func->maxstack + 1))
+		throw RuntimeException("Stack Overflow!");
+
+	//keep the frame we were called from, it goes back the way it was even if the script throws
+	//locals on the stack are found again by index in case it moves, a running generator's stay put
+	Closure* oldframe = this->curframe;
+	Value* oldsptr = sptr;
+	unsigned int oldbase = this->OnStack(sptr) ? (unsigned int)(sptr - stack._data) : JET_BAD_INSTRUCTION;
+	unsigned int oldsize = stack._size;
+	unsigned int oldcalls = callstack._size;
+	if (oldframe)
+		this->callstack.Push(CallFrame(0, oldframe, sptr));
+
+	int iptr = 0;
+	try
 	{
-		sptr[func->prototype->locals-1] = this->NewArray();
-		auto arr = &sptr[func->prototype->locals-1]._array->data;
-		arr->resize(numargs - func->prototype->args);
-		for (int i = (int)numargs - 1; i >= 0; i--)
+		if (fun->_function->generator)
 		{
-			if (i < (int)func->prototype->args)
-				stack.Pop(sptr[i]);
-			else
-				stack.Pop((*arr)[i]);
+			curframe = fun->_function;
+			iptr = fun->_function->generator->Resume(this, numargs ? args[0] : Value::Empty);
 		}
-	}
-	else
-	{
-		for (int i = (int)numargs-1; i >= 0; i--)
+		else
 		{
-			if (i < (int)func->prototype->args)
-				stack.Pop(sptr[i]);
+			//the arguments go right where the new frame's locals start
+			sptr = &stack._data[stack._size];
+			for (unsigned int i = 0; i < numargs && i < func->args; i++)
+				sptr[i] = args[i];
+
+			unsigned int i = numargs < func->args ? numargs : func->args;
+			unsigned int extra = numargs > func->args ? numargs - func->args : 0;
+			if (func->stackvarargs)
+			{
+				for (unsigned int v = 0; v < extra; v++)
+					sptr[func->locals + v] = args[func->args + v];
+				sptr[i++] = Value((int)extra);
+			}
+			else if (func->vararg)
+			{
+				Value arr = this->NewArray();
+				arr._array->data.assign(args + func->args, args + func->args + extra);
+				this->gc.Track(arr._array);
+				sptr[i++] = arr;
+				extra = 0;
+			}
 			else
-				stack.QuickPop();
+				extra = 0;
+			for (; i < func->locals; i++)
+				sptr[i] = Value::Empty;
+			stack._size += func->locals + extra;
+			curframe = fun->_function;
 		}
-	}
 
-	Value ret = this->Execute(0, fun->_function);
+		Value ret = this->Execute(iptr, fun->_function, results);
 
-	if (pushed)
-	{
-		curframe = this->callstack.Pop().second;//restore
-		sptr -= curframe->prototype->locals;
+		callstack._size = oldcalls;
+		stack._size = oldsize;
+		sptr = oldbase != JET_BAD_INSTRUCTION ? &stack._data[oldbase] : oldsptr;
+		curframe = oldframe;
+
+		//nothing can point into the arrays the stack moved out of once the outermost call is done
+		if (callstack._size == 0)
+			this->FreeOldStacks();
+		return ret;
+	}
+	catch (...)
+	{
+		callstack._size = oldcalls;
+		stack._size = oldsize;
+		sptr = oldbase != JET_BAD_INSTRUCTION ? &stack._data[oldbase] : oldsptr;
+		curframe = oldframe;
+		if (callstack._size == 0)
+			this->FreeOldStacks();
+		throw;
 	}
-	return ret;
 }
 
 //executes a function in the VM context
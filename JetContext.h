@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <string>
+#include <atomic>
 #include <map>
 #include <algorithm>
 
@@ -23,8 +24,27 @@
 #define GC_INTERVAL 200//number of allocations before running the GC
 #define GC_STEPS 4//number of g0 collections before a gen1 collection
 
-#define JET_STACK_SIZE 1024
-#define JET_MAX_CALLDEPTH 1024
+//the stacks start small and grow as calls need more, up to a limit that can be changed per context
+#define JET_STACK_SIZE 256//values the stack starts with, every frame keeps its locals and temporaries in it
+#define JET_MAX_STACK_SIZE (1024*1024)
+#define JET_CALLSTACK_SIZE 32//frames the call stack starts with
+#define JET_MAX_CALLDEPTH 100000
+#define JET_DEADLINE_CHECK 1024//backward jumps and calls between looking at the clock when there is a deadline
+
+#define JET_SHAPE_MAX_KEYS 64//objects with more keys than this get a shape of their own instead of a shared one
+
+//use labels as values for instruction dispatch where the compiler supports it
+//define JET_NO_COMPUTED_GOTO to force the plain switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(JET_NO_COMPUTED_GOTO)
+#define JET_COMPUTED_GOTO
+#endif
+
+//compile hot functions to machine code, only for x86-64 linux and values that are not nan boxed
+//define JET_NO_JIT to leave everything to the interpreter, contexts start with it switched off
+#if defined(__x86_64__) && defined(__linux__) && !defined(JET_NAN_BOXING) && !defined(JET_NO_JIT)
+#define JET_JIT
+#endif
+#define JET_JIT_THRESHOLD 1000//calls and loop iterations a function makes before it gets compiled
 
 namespace Jet
 {
@@ -44,14 +64,29 @@ namespace Jet
 	// output text
 	typedef int (__cdecl *OutputFunction) (const char* format, ...);
 
+	//where a call returns to, base is where the caller's locals start, on the stack or in a running generator
+	//results is how many values the caller wants back, missing ones are null, 0 keeps them all
+	struct CallFrame
+	{
+		Closure* closure;
+		Value* base;
+		unsigned int iptr;
+		unsigned int results;
+
+		CallFrame() {}
+		CallFrame(unsigned int iptr, Closure* closure, Value* base, unsigned int results = 1) : closure(closure), base(base), iptr(iptr), results(results) {}
+	};
+
 	class JetContext
 	{
 		friend struct Generator;
 		friend struct Value;
 		friend class JetObject;
+		friend struct JetShape;
 		friend class GarbageCollector;
+		friend class JetJIT;
 		VMStack<Value> stack;
-		VMStack<std::pair<unsigned int, Closure*> > callstack;
+		VMStack<CallFrame> callstack;
 
 		std::unordered_map<std::string, Function*> functions;
 		std::vector<Function*> entrypoints;
@@ -78,6 +113,15 @@ namespace Jet
 		GarbageCollector gc;
 		std::vector<JetObject*> prototypes;
 
+		//object shapes, freed with the context
+		JetShape* rootshape;
+		std::vector<JetShape*> shapes;
+		unsigned int protoepoch;//bumped whenever a prototype chain an inline cache relies on changes
+
+		//interned strings, hashed by their contents and chained through JetString::next
+		std::vector<JetString*> strings;
+		unsigned int numstrings;
+
 		Closure* lastadded;
 		struct OpenCapture
 		{
@@ -86,7 +130,7 @@ namespace Jet
 			Closure* creator;
 #endif
 		};
-		std::deque<OpenCapture> opencaptures;
+		std::vector<OpenCapture> opencaptures;//each frame's open captures are together at the back, newest frame last
 	public:
 		//use these
 		Value NewObject();
@@ -125,19 +169,105 @@ namespace Jet
 		//executes a function in the VM context
 		Value	Call(const char* function, Value* args = 0, unsigned int numargs = 0);
 		Value	Call(const Value* function, Value* args = 0, unsigned int numargs = 0);
+		Value	Call(const Value* function, Value* args, unsigned int numargs, std::vector<Value>* results);//results gets every value returned, the first is also returned
 
 		void	RunGC();//runs an iteration of the garbage collector
 
 		OutputFunction GetOutputFunction() const		{ return m_OutputFunction; }
 		void	SetOutputFunction(OutputFunction val);
+
+		//if enabled, arithmetic on locals is compiled to register instructions for scripts compiled after this
+		bool	GetRegisterCode() const					{ return compiler.registers; }
+		void	SetRegisterCode(bool enabled)			{ compiler.registers = enabled; }
+
+		//if enabled, functions that get called or loop often enough are compiled to machine code where that is supported
+#ifdef JET_JIT
+		bool	GetJIT() const							{ return jit; }
+		void	SetJIT(bool enabled)					{ jit = enabled; }
+#else
+		bool	GetJIT() const							{ return false; }
+		void	SetJIT(bool enabled)					{ }
+#endif
+
+		//scripts are stopped with a RuntimeException once they use up their budget, pass their deadline or get
+		//interrupted, this is checked on backward jumps and calls and stays that way until it is reset here
+		void	SetBudget(int64_t steps);//backward jumps and calls scripts may make from now on, <0 for no limit
+		void	SetDeadline(int64_t ns);//nanoseconds from now scripts may run for, <0 for no limit
+		void	SetStackLimits(unsigned int values, unsigned int calls);//most values and call frames the stacks may grow to, never less than they already have
+
+		void	Interrupt(bool stop = true)				{ interrupted.store(stop, std::memory_order_relaxed); }//safe to call from any thread
+
+		//going over the quota runs a full collection and scripts get an out of memory RuntimeException if that isn't enough
+		void	SetMemoryQuota(size_t bytes)			{ gc.quota = bytes; }//0 for no limit
+		size_t	GetMemoryUsage() const					{ return gc.allocated; }//bytes held by objects, arrays, strings, closures and shapes
+		size_t	GetPeakMemoryUsage() const				{ return gc.peak; }
 	private:
-		Value* sptr;//stack pointer
+		Value* sptr;//locals of the current frame, its temporaries are pushed on the stack right after them
 		Closure* curframe;
-		Value localstack[JET_STACK_SIZE];
+		unsigned int returned;//how many values the last return to a frame that keeps them all left
+
+		int64_t countdown;//steps left before the budget and deadline need to be looked at again
+		int64_t budget;//steps left after the countdown, <0 for no limit
+		int64_t deadline;//steady clock time in nanoseconds, <0 for none
+		std::atomic<bool> interrupted;
+#ifdef JET_JIT
+		bool jit;
+		std::vector<JitCode*> jitcode;//everything the JIT compiled, freed with the context
+#endif
+		void Check()//called on every backward jump and call
+		{
+			if (--this->countdown < 0 || this->interrupted.load(std::memory_order_relaxed))
+				this->Preempt();
+		}
+		void Preempt();//throws if the script has to stop, otherwise starts a new countdown
+		void Recheck()//makes the next check call Preempt, giving back what was left of the countdown
+		{
+			if (this->countdown > 0)
+			{
+				if (this->budget >= 0)
+					this->budget += this->countdown;
+				this->countdown = 0;
+			}
+		}
+
+		bool OnStack(const Value* v) const//generators keep their locals outside the stack, so they never move
+		{
+			return v >= this->stack._data && v <= this->stack._data + this->stack.capacity();
+		}
+		std::vector<Value*> oldstacks;//arrays the stack moved out of, freed once no native can be using them
+		bool Fits(unsigned int count)//makes room for count more values, this can move the stack
+		{
+			return this->stack.fits(count) || this->GrowStack(count);
+		}
+		bool GrowStack(unsigned int count);
+		void FreeOldStacks();
 		OutputFunction	m_OutputFunction = printf;
 		//begin executing instructions at iptr index
-		Value Execute(int iptr, Closure* frame);
-		unsigned int Call(const Value* function, unsigned int iptr, unsigned int args);//used for calls in the VM
+		Value Execute(int iptr, Closure* frame, std::vector<Value>* results = nullptr);
+		unsigned int Call(const Value* function, unsigned int iptr, unsigned int args, bool tail = false);//used for calls in the VM, a tail call replaces the current frame
+		void Close(int local);//closes the open captures of the current frame from local up
+		void Close(Capture* capture);//copies the value into the capture so it no longer points at the stack
+		void Results(unsigned int count, unsigned int wanted);//makes the count values on top of the stack what the caller wanted
+		void LoadAt(const DecodedInstruction* in, InlineCache* caches);//indexes the value on top of the stack
+		void StoreAt(const DecodedInstruction* in, InlineCache* caches);//stores the value under the top two at the index on top
+
+		static Value GetMember(const Value& v, const char* key);//looks up a key on an object or userdata and down its prototype chain
+
+		//builds the decoded instruction stream that Execute runs from the assembled instructions
+		void Decode(Function* func);
+		//works out how deep the operand stack can get in the function by following every path through it
+		static unsigned int StackDepth(const Function* func);
+
+		//string table, interned strings are dropped from it when they get collected
+		JetString* AllocString(const char* string, unsigned int length);
+		Closure* AllocClosure(Function* prototype);//the upvalue array goes right after the closure in the same block
+		JetString* Intern(const char* string);
+		JetString* Intern(JetString* str);//returns the interned copy, str becomes it if there is none yet
+		void Unintern(JetString* str);
+		void Pin(JetString* str);//keeps a string alive for as long as the context
+#ifdef JET_COMPUTED_GOTO
+		static const void* const* handlers;//handler address for each instruction type, filled in by Execute
+#endif
 
 		//debug functions
 		void GetCode(int ptr, Closure* closure, std::string& ret, unsigned int& line);
@@ -56,8 +56,11 @@ namespace Jet
 		"CStore",
 		"CLoad",
 		"CInit",
+		"CCopy",
 
 		"ForEach",
+		"ForIntPrep",
+		"ForIntLoop",
 
 		//index functions
 		"LoadAt",
@@ -65,13 +68,124 @@ namespace Jet
 
 		//these all work on the last value in the stack
 		"ECall",
+		"MCall",
 
 		"Call",
+		"TailCall",
 		"Return",
+		"ReturnN",
 		"Resume",
 		"Yield",
 		"Close",
 
+		"VarArg",
+		"VarArgCount",
+		"PushVarArgs",
+		"VCall",
+
+		//register instructions
+		"RMove",
+		"RIncr",
+		"RDecr",
+		"RLdInt",
+		"RLdReal",
+		"RAdd",
+		"RSub",
+		"RMul",
+		"RDiv",
+		"RModulus",
+		"REq",
+		"RNotEq",
+		"RLt",
+		"RGt",
+		"RLtE",
+		"RGtE",
+
+		//superinstructions
+		"LLoadLLoad",
+		"LLoadLLoadAdd",
+		"LLoadLLoadSub",
+		"LLoadLLoadMul",
+		"LdIntAdd",
+		"LdIntSub",
+		"LdIntMul",
+		"LLoadIncrLStore",
+		"LLoadDecrLStore",
+		"EqJumpFalse",
+		"NotEqJumpFalse",
+		"LtJumpFalse",
+		"GtJumpFalse",
+		"LtEJumpFalse",
+		"GtEJumpFalse",
+
+		//quickened instructions
+		"AddIntInt",
+		"AddRealReal",
+		"SubIntInt",
+		"SubRealReal",
+		"MulIntInt",
+		"MulRealReal",
+		"DivIntInt",
+		"DivRealReal",
+		"LtIntInt",
+		"LtRealReal",
+		"GtIntInt",
+		"GtRealReal",
+		"LtEIntInt",
+		"LtERealReal",
+		"GtEIntInt",
+		"GtERealReal",
+		"LtJumpFalseIntInt",
+		"LtJumpFalseRealReal",
+		"GtJumpFalseIntInt",
+		"GtJumpFalseRealReal",
+		"LtEJumpFalseIntInt",
+		"LtEJumpFalseRealReal",
+		"GtEJumpFalseIntInt",
+		"GtEJumpFalseRealReal",
+		"LLoadLLoadAddIntInt",
+		"LLoadLLoadAddRealReal",
+		"LLoadLLoadSubIntInt",
+		"LLoadLLoadSubRealReal",
+		"LLoadLLoadMulIntInt",
+		"LLoadLLoadMulRealReal",
+
+		//typed instructions
+		"AddInt",
+		"SubInt",
+		"MulInt",
+		"AddReal",
+		"SubReal",
+		"MulReal",
+		"DivReal",
+		"LtInt",
+		"GtInt",
+		"LtEInt",
+		"GtEInt",
+		"LtReal",
+		"GtReal",
+		"LtEReal",
+		"GtEReal",
+		"LtIntJumpFalse",
+		"GtIntJumpFalse",
+		"LtEIntJumpFalse",
+		"GtEIntJumpFalse",
+		"LtRealJumpFalse",
+		"GtRealJumpFalse",
+		"LtERealJumpFalse",
+		"GtERealJumpFalse",
+		"LLoadLLoadAddInt",
+		"LLoadLLoadSubInt",
+		"LLoadLLoadMulInt",
+		"LLoadLLoadAddReal",
+		"LLoadLLoadSubReal",
+		"LLoadLLoadMulReal",
+		"LdIntAddInt",
+		"LdIntSubInt",
+		"LdIntMulInt",
+
+		"Loop",
+
 		//dummy instructions for the assembler/debugging
 		"Label",
 		"Local",
@@ -117,9 +231,13 @@ namespace Jet
 		CStore,CLoad,	//captures
 
 		CInit, //to setup captures
+		CCopy, //shares a capture of the current function with the closure being made
 
-		//loop instruction
+		//loop instructions
 		ForEach,
+		//counting loops, value packs the counter local, limit local, comparison and step (one byte each)
+		ForIntPrep,//jumps to the end if the loop shouldnt run at all
+		ForIntLoop,//steps the counter and jumps back to the body while the comparison holds
 
 		//index functions
 		LoadAt,
@@ -127,9 +245,12 @@ namespace Jet
 
 		//these all work on the last value in the stack
 		ECall,
+		MCall,//like ECall, but value2 is the number of results the caller wants left on the stack
 		
 		Call,
+		TailCall,//like ECall, but reuses the current frame for script functions
 		Return,
+		ReturnN,//returns the top value values, the caller's frame decides how many it keeps
 
 		//generator stuff
 		Resume,
@@ -137,6 +258,56 @@ namespace Jet
 
 		Close, //closes all opened closures in a function
 
+		//varargs, value is the local of the ... parameter, they are read where the caller left them
+		VarArg,//pushes the vararg at the index on the stack
+		VarArgCount,
+		PushVarArgs,//pushes all varargs followed by their count
+		VCall,//like ECall, but the count pushed by PushVarArgs gets added to the arguments
+
+		//register instructions, these work directly on local slots instead of the stack
+		//value is the destination local and src1/src2 the source locals
+		RMove,
+		RIncr, RDecr,
+		RLdInt, RLdReal,
+		RAdd, RSub, RMul, RDiv, RModulus,
+		REq, RNotEq,
+		RLt, RGt,
+		RLtE, RGtE,
+
+		//superinstructions, fused from common sequences by CompilerContext::Optimize
+		LLoadLLoad,		//push locals src1 and src2
+		LLoadLLoadAdd, LLoadLLoadSub, LLoadLLoadMul,//push src1 op src2
+		LdIntAdd, LdIntSub, LdIntMul,//top op= int literal
+		LLoadIncrLStore, LLoadDecrLStore,//local value = local src1 +/- 1
+		EqJumpFalse, NotEqJumpFalse,//compare the top two values and jump if false, same order as Eq to GtE
+		LtJumpFalse, GtJumpFalse,
+		LtEJumpFalse, GtEJumpFalse,
+
+		//quickened instructions, Execute rewrites a generic instruction to one of these once it has seen
+		//its operand types, if the guard on the types ever fails the site goes back to the generic one
+		AddIntInt, AddRealReal, SubIntInt, SubRealReal,
+		MulIntInt, MulRealReal, DivIntInt, DivRealReal,
+		LtIntInt, LtRealReal, GtIntInt, GtRealReal,
+		LtEIntInt, LtERealReal, GtEIntInt, GtERealReal,
+		LtJumpFalseIntInt, LtJumpFalseRealReal, GtJumpFalseIntInt, GtJumpFalseRealReal,
+		LtEJumpFalseIntInt, LtEJumpFalseRealReal, GtEJumpFalseIntInt, GtEJumpFalseRealReal,
+		LLoadLLoadAddIntInt, LLoadLLoadAddRealReal,
+		LLoadLLoadSubIntInt, LLoadLLoadSubRealReal,
+		LLoadLLoadMulIntInt, LLoadLLoadMulRealReal,
+
+		//typed instructions, the compiler proved the types of both operands so they have no guard
+		AddInt, SubInt, MulInt,
+		AddReal, SubReal, MulReal, DivReal,
+		LtInt, GtInt, LtEInt, GtEInt,//same order as the real ones and the jumps, Optimize relies on it
+		LtReal, GtReal, LtEReal, GtEReal,
+		LtIntJumpFalse, GtIntJumpFalse, LtEIntJumpFalse, GtEIntJumpFalse,
+		LtRealJumpFalse, GtRealJumpFalse, LtERealJumpFalse, GtERealJumpFalse,
+		LLoadLLoadAddInt, LLoadLLoadSubInt, LLoadLLoadMulInt,
+		LLoadLLoadAddReal, LLoadLLoadSubReal, LLoadLLoadMulReal,
+		LdIntAddInt, LdIntSubInt, LdIntMulInt,
+
+		Loop,//a Jump backwards, Decode makes these so loops check the execution budget
+
 		//dummy instructions for the assembler/debugging
 		Label,
 		Local,
@@ -0,0 +1,1452 @@
+#include "JetJIT.h"
+
+#ifdef JET_JIT
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <map>
+
+using namespace Jet;
+
+namespace Jet
+{
+	//what the machine code works with, rbx points to it while it runs
+	struct JitState
+	{
+		JetContext* context;
+		Value* sptr;//locals of the current frame, kept in r12
+		Value* top;//first free value on the stack, kept in r13 and only written back here around helpers and exits
+		int64_t* countdown;
+		std::atomic<bool>* interrupted;
+		const void* leave;//returns from the machine code with exit
+		int exit;//instruction the interpreter carries on from
+		double one;
+		Value operand;//literal operand of instructions that need a second value
+		Value result;//what helpers worked out, it stays put when the stack moves
+		std::exception_ptr error;
+	};
+
+	struct JitCode
+	{
+		unsigned char* memory;
+		size_t size;
+		int (*enter)(JitState* state, const void* address);//saves registers and jumps into the code at address
+		const void* leave;
+		std::vector<const void*> entry;//where each instruction starts
+	};
+
+	static_assert(sizeof(Value) == 24, "the JIT expects unboxed 24 byte values");
+	static_assert(sizeof(ValueType) == 1, "the JIT expects one byte value types");
+
+	const int JitType = (int)offsetof(Value, type);
+	const int JitData = (int)offsetof(Value, int_value);
+	const int JitLength = (int)offsetof(Value, length);
+
+	const int JitSptr = (int)offsetof(JitState, sptr);
+	const int JitTop = (int)offsetof(JitState, top);
+	const int JitCountdown = (int)offsetof(JitState, countdown);
+	const int JitInterrupted = (int)offsetof(JitState, interrupted);
+	const int JitExit = (int)offsetof(JitState, exit);
+	const int JitOne = (int)offsetof(JitState, one);
+	const int JitOperand = (int)offsetof(JitState, operand);
+	const int JitResult = (int)offsetof(JitState, result);
+
+	enum JitRegister { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+	enum JitCondition { CondB = 2, CondAE = 3, CondE = 4, CondNE = 5, CondBE = 6, CondA = 7, CondS = 8, CondP = 10, CondNP = 11, CondL = 12, CondGE = 13, CondLE = 14, CondG = 15 };
+
+	//memory at a register plus an offset
+	struct JitSlot
+	{
+		int base;
+		int disp;
+
+		JitSlot Field(int offset) const { return { base, disp + offset }; }
+		bool operator==(const JitSlot& other) const { return base == other.base && disp == other.disp; }
+	};
+
+	//encodes the few x86-64 instructions the stubs are made of, jumps go to labels that get patched at the end
+	class JitAssembler
+	{
+	public:
+		std::vector<unsigned char> code;
+		std::vector<int> labels;//position of each label, -1 until it is bound
+		std::vector<std::pair<size_t, int>> fixups;//rel32 to patch and the label it goes to
+
+		int Label()
+		{
+			labels.push_back(-1);
+			return (int)labels.size() - 1;
+		}
+		void Bind(int label) { labels[label] = (int)code.size(); }
+		void Link()
+		{
+			for (auto ii: fixups)
+			{
+				int rel = labels[ii.second] - (int)(ii.first + 4);
+				memcpy(&code[ii.first], &rel, 4);
+			}
+		}
+
+		void Byte(int b) { code.push_back((unsigned char)b); }
+		void Dword(int v) { for (int i = 0; i < 32; i += 8) Byte(v >> i); }
+		void Qword(uint64_t v) { for (int i = 0; i < 64; i += 8) Byte((int)(v >> i)); }
+
+		//prefix, rex and opcode, opcodes above 0xFF get the 0F escape
+		void Opcode(int prefix, bool wide, int opcode, int reg, int rm)
+		{
+			if (prefix)
+				Byte(prefix);
+			int rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+			if (rex != 0x40)
+				Byte(rex);
+			if (opcode > 0xFF)
+				Byte(opcode >> 8);
+			Byte(opcode & 0xFF);
+		}
+		void Mem(int prefix, bool wide, int opcode, int reg, JitSlot m)
+		{
+			Opcode(prefix, wide, opcode, reg, m.base);
+			int mod = m.disp == 0 && (m.base & 7) != RBP ? 0 : (m.disp >= -128 && m.disp < 128 ? 1 : 2);
+			Byte((mod << 6) | ((reg & 7) << 3) | (m.base & 7));
+			if ((m.base & 7) == RSP)
+				Byte(0x24);
+			if (mod == 1)
+				Byte(m.disp);
+			else if (mod == 2)
+				Dword(m.disp);
+		}
+		void Reg(int prefix, bool wide, int opcode, int reg, int rm)
+		{
+			Opcode(prefix, wide, opcode, reg, rm);
+			Byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+
+		void Load(int reg, JitSlot m) { Mem(0, true, 0x8B, reg, m); }
+		void Load32(int reg, JitSlot m) { Mem(0, false, 0x8B, reg, m); }
+		void Store(JitSlot m, int reg) { Mem(0, true, 0x89, reg, m); }
+		void Lea(int reg, JitSlot m) { Mem(0, true, 0x8D, reg, m); }
+		void Move(int dst, int src) { Reg(0, true, 0x89, src, dst); }
+		void MoveImm(int reg, int64_t v)
+		{
+			if (v == (int32_t)v)
+			{
+				Reg(0, true, 0xC7, 0, reg);
+				Dword((int)v);
+			}
+			else
+			{
+				Opcode(0, true, 0xB8 + (reg & 7), 0, reg);
+				Qword((uint64_t)v);
+			}
+		}
+		void StoreImm(JitSlot m, int v) { Mem(0, true, 0xC7, 0, m); Dword(v); }
+		void StoreImm32(JitSlot m, int v) { Mem(0, false, 0xC7, 0, m); Dword(v); }
+		void StoreByte(JitSlot m, int v) { Mem(0, false, 0xC6, 0, m); Byte(v); }
+		void CompareByte(JitSlot m, int v) { Mem(0, false, 0x80, 7, m); Byte(v); }
+		void CompareZero(JitSlot m) { Mem(0, true, 0x83, 7, m); Byte(0); }
+		void SubOne(JitSlot m) { Mem(0, true, 0x83, 5, m); Byte(1); }
+		void AddImm(int reg, int v) { Reg(0, true, 0x81, 0, reg); Dword(v); }
+		void Alu(int opcode, int reg, JitSlot m) { Mem(0, true, opcode, reg, m); }//0x03 add, 0x2B sub, 0x3B cmp, 0x0FAF imul
+		void AluReg(int opcode, int reg, int rm) { Reg(0, true, opcode, reg, rm); }
+		void Test32(int reg) { Reg(0, false, 0x85, reg, reg); }
+		void Compare32(int reg, int v) { Reg(0, false, 0x83, 7, reg); Byte(v); }
+		void ZeroExtend32(int reg) { Reg(0, false, 0x89, reg, reg); }
+		void Set(int cond, int reg) { Reg(0, false, 0x0F90 | cond, 0, reg); }//al or cl
+		void ZeroExtend8(int reg) { Reg(0, false, 0x0FB6, reg, reg); }
+		void Jump(int label) { Byte(0xE9); Fixup(label); }
+		void Jump(int cond, int label) { Byte(0x0F); Byte(0x80 | cond); Fixup(label); }
+		void Fixup(int label) { fixups.push_back({ code.size(), label }); Dword(0); }
+		void JumpReg(int reg) { Reg(0, false, 0xFF, 4, reg); }
+		void CallReg(int reg) { Reg(0, false, 0xFF, 2, reg); }
+		void Push(int reg) { Opcode(0, false, 0x50 + (reg & 7), 0, reg); }
+		void Pop(int reg) { Opcode(0, false, 0x58 + (reg & 7), 0, reg); }
+		void Ret() { Byte(0xC3); }
+
+		//scalar doubles in xmm registers, numbered from 0
+		void LoadReal(int x, JitSlot m) { Mem(0xF2, false, 0x0F10, x, m); }
+		void StoreReal(JitSlot m, int x) { Mem(0xF2, false, 0x0F11, x, m); }
+		void RealOp(int opcode, int x, JitSlot m) { Mem(0xF2, false, opcode, x, m); }//0x0F58 add, 0x0F59 mul, 0x0F5C sub, 0x0F5E div
+		void RealReg(int opcode, int x, int y) { Reg(0xF2, false, opcode, x, y); }
+		void CompareReal(int x, JitSlot m) { Mem(0x66, false, 0x0F2E, x, m); }
+		void CompareRealReg(int x, int y) { Reg(0x66, false, 0x0F2E, x, y); }
+		void ZeroReal(int x) { Reg(0x66, false, 0x0F57, x, x); }
+		void IntToReal(int x, int reg) { Reg(0xF2, true, 0x0F2A, x, reg); }
+	};
+
+	//turns each instruction of a function into a stub, the label of instruction i is i
+	//the stubs keep the state in rbx, the locals in r12 and the top of the stack in r13
+	class JitCompiler : public JitAssembler
+	{
+		enum Kind { Generic, Int, Real };
+
+		Function* func;
+		int leave;
+		std::vector<std::function<void()>> cold;//slow paths go after all the instructions
+		std::map<int, int> errors;//label for each instruction that can throw
+
+	public:
+		JitCompiler(Function* func) : func(func)
+		{
+			for (size_t i = 0; i <= func->code.size(); i++)
+				this->Label();
+			this->leave = this->Label();
+		}
+
+		std::vector<unsigned char>& Compile(int& enter, int& leave)
+		{
+			//int enter(JitState* state, const void* address)
+			enter = (int)code.size();
+			Push(RBX);
+			Push(R12);
+			Push(R13);
+			Move(RBX, RDI);
+			Load(R12, State(JitSptr));
+			Load(R13, State(JitTop));
+			JumpReg(RSI);
+
+			Bind(this->leave);
+			leave = (int)code.size();
+			Load32(RAX, State(JitExit));
+			Pop(R13);
+			Pop(R12);
+			Pop(RBX);
+			Ret();
+
+			int count = (int)func->code.size();
+			for (int i = 0; i < count; i++)
+			{
+				Bind(i);
+				Emit(i);
+			}
+			Bind(count);
+			Exit(count);
+
+			for (size_t i = 0; i < cold.size(); i++)
+				cold[i]();
+			for (auto ii: errors)
+			{
+				//the helper already gave the stack back to the context
+				Bind(ii.second);
+				StoreImm32(State(JitExit), ii.first);
+				Jump(this->leave);
+			}
+			Link();
+			return code;
+		}
+
+	private:
+		static JitSlot State(int offset) { return { RBX, offset }; }
+		static JitSlot Local(int i) { return { R12, i * (int)sizeof(Value) }; }
+		static JitSlot Stack(int i) { return { R13, -i * (int)sizeof(Value) }; }//1 is the top of the stack, 0 the first free value
+		static JitSlot Type(JitSlot v) { return v.Field(JitType); }
+		static JitSlot Data(JitSlot v) { return v.Field(JitData); }
+
+		void Grow(int values) { Lea(R13, Stack(-values)); }
+
+		int Error(int iptr)
+		{
+			auto ii = errors.find(iptr);
+			if (ii != errors.end())
+				return ii->second;
+			return errors[iptr] = Label();
+		}
+
+		//hands the rest to the interpreter starting at iptr
+		void Exit(int iptr)
+		{
+			Store(State(JitTop), R13);
+			StoreImm32(State(JitExit), iptr);
+			Jump(this->leave);
+		}
+
+		//calls a helper with the state as its first argument, the others have to be in rsi, rdx and rcx already
+		//the stack can move or change size in there, so the locals and top are loaded again after
+		void Helper(const void* function)
+		{
+			Store(State(JitTop), R13);
+			Move(RDI, RBX);
+			MoveImm(RAX, (int64_t)function);
+			CallReg(RAX);
+			Load(R12, State(JitSptr));
+			Load(R13, State(JitTop));
+		}
+
+		void Copy(JitSlot dst, JitSlot src)
+		{
+			Load(RAX, src);
+			Load(RCX, src.Field(8));
+			Load(RDX, src.Field(16));
+			Store(dst, RAX);
+			Store(dst.Field(8), RCX);
+			Store(dst.Field(16), RDX);
+		}
+
+		void SetInt(JitSlot dst, int reg)
+		{
+			StoreByte(Type(dst), (int)ValueType::Int);
+			Store(Data(dst), reg);
+		}
+
+		void SetLiteral(JitSlot dst, ValueType type, int64_t bits)
+		{
+			StoreByte(Type(dst), (int)type);
+			MoveImm(RAX, bits);
+			Store(Data(dst), RAX);
+		}
+
+		static int IntOpcode(InstructionType op)
+		{
+			return op == InstructionType::Add ? 0x03 : op == InstructionType::Sub ? 0x2B : 0x0FAF;
+		}
+		static int RealOpcode(InstructionType op)
+		{
+			switch (op)
+			{
+			case InstructionType::Add: return 0x0F58;
+			case InstructionType::Sub: return 0x0F5C;
+			case InstructionType::Mul: return 0x0F59;
+			default: return 0x0F5E;
+			}
+		}
+
+		//dst = a op b, kind says what the compiler already knows the operands are
+		void Arith(InstructionType op, JitSlot a, JitSlot b, JitSlot dst, Kind kind, int iptr)
+		{
+			bool inlined = op == InstructionType::Add || op == InstructionType::Sub || op == InstructionType::Mul || op == InstructionType::Div;
+			bool ints = op != InstructionType::Div;//int division stays with the Value operator
+			if (inlined && kind == Int)
+			{
+				Load(RAX, Data(a));
+				Alu(IntOpcode(op), RAX, Data(b));
+				if (!(dst == a))
+					StoreByte(Type(dst), (int)ValueType::Int);
+				Store(Data(dst), RAX);
+				return;
+			}
+			if (inlined && kind == Real)
+			{
+				LoadReal(0, Data(a));
+				RealOp(RealOpcode(op), 0, Data(b));
+				if (!(dst == a))
+					StoreByte(Type(dst), (int)ValueType::Real);
+				StoreReal(Data(dst), 0);
+				return;
+			}
+
+			if (!inlined)
+			{
+				ArithHelper(op, a, b, dst, iptr);
+				return;
+			}
+
+			int slow = Label(), real = ints ? Label() : slow, done = Label();
+			if (ints)
+			{
+				CompareByte(Type(a), (int)ValueType::Int);
+				Jump(CondNE, real);
+				CompareByte(Type(b), (int)ValueType::Int);
+				Jump(CondNE, slow);
+				Arith(op, a, b, dst, Int, iptr);
+				Bind(done);
+			}
+			auto reals = [=]()
+			{
+				if (ints)
+					Bind(real);
+				CompareByte(Type(a), (int)ValueType::Real);
+				Jump(CondNE, slow);
+				CompareByte(Type(b), (int)ValueType::Real);
+				Jump(CondNE, slow);
+				Arith(op, a, b, dst, Real, iptr);
+				if (ints)
+					Jump(done);
+			};
+			if (ints)
+				cold.push_back(reals);
+			else
+			{
+				reals();
+				Bind(done);
+			}
+			cold.push_back([=]()
+			{
+				Bind(slow);
+				ArithHelper(op, a, b, dst, iptr);
+				Jump(done);
+			});
+		}
+
+		//dst = a op b through the Value operators
+		void ArithHelper(InstructionType op, JitSlot a, JitSlot b, JitSlot dst, int iptr)
+		{
+			Lea(RSI, a);
+			Lea(RDX, b);
+			MoveImm(RCX, (int)op);
+			Helper((const void*)&JetJIT::Arith);
+			Test32(RAX);
+			Jump(CondNE, Error(iptr));
+			Copy(dst, State(JitResult));
+		}
+
+		//the value on top of the stack op an int literal
+		void ArithLiteral(InstructionType op, int64_t literal, Kind kind, int iptr)
+		{
+			JitSlot a = Stack(1);
+			if (kind == Int)
+			{
+				Load(RAX, Data(a));
+				MoveImm(RCX, literal);
+				AluReg(IntOpcode(op), RAX, RCX);
+				Store(Data(a), RAX);
+				return;
+			}
+
+			int real = Label(), slow = Label(), done = Label();
+			CompareByte(Type(a), (int)ValueType::Int);
+			Jump(CondNE, real);
+			ArithLiteral(op, literal, Int, iptr);
+			Bind(done);
+			cold.push_back([=]()
+			{
+				Bind(real);
+				CompareByte(Type(a), (int)ValueType::Real);
+				Jump(CondNE, slow);
+				LoadReal(0, Data(a));
+				MoveImm(RAX, literal);
+				IntToReal(1, RAX);
+				RealReg(RealOpcode(op), 0, 1);
+				StoreReal(Data(a), 0);
+				Jump(done);
+
+				Bind(slow);
+				SetLiteral(State(JitOperand), ValueType::Int, literal);
+				ArithHelper(op, a, State(JitOperand), a, iptr);
+				Jump(done);
+			});
+		}
+
+		//Incr, Decr, Negate and BNot of a into dst, BNot only has the helper
+		void Unary(InstructionType op, JitSlot a, JitSlot dst, int iptr)
+		{
+			if (op == InstructionType::BNot)
+			{
+				UnaryHelper(op, a, dst, iptr);
+				return;
+			}
+
+			int real = Label(), slow = Label(), done = Label();
+			CompareByte(Type(a), (int)ValueType::Int);
+			Jump(CondNE, real);
+			Load(RAX, Data(a));
+			if (op == InstructionType::Negate)
+				Reg(0, true, 0xF7, 3, RAX);//neg
+			else
+				AddImm(RAX, op == InstructionType::Incr ? 1 : -1);
+			if (!(dst == a))
+				StoreByte(Type(dst), (int)ValueType::Int);
+			Store(Data(dst), RAX);
+			Bind(done);
+			cold.push_back([=]()
+			{
+				Bind(real);
+				CompareByte(Type(a), (int)ValueType::Real);
+				Jump(CondNE, slow);
+				if (op == InstructionType::Negate)
+				{
+					Load(RAX, Data(a));
+					Reg(0, true, 0x0FBA, 7, RAX);//btc of the sign bit
+					Byte(63);
+					Store(Data(dst), RAX);
+				}
+				else
+				{
+					LoadReal(0, Data(a));
+					RealOp(op == InstructionType::Incr ? 0x0F58 : 0x0F5C, 0, State(JitOne));
+					StoreReal(Data(dst), 0);
+				}
+				if (!(dst == a))
+					StoreByte(Type(dst), (int)ValueType::Real);
+				Jump(done);
+
+				Bind(slow);
+				UnaryHelper(op, a, dst, iptr);
+				Jump(done);
+			});
+		}
+
+		void UnaryHelper(InstructionType op, JitSlot a, JitSlot dst, int iptr)
+		{
+			Lea(RSI, a);
+			MoveImm(RDX, (int)op);
+			Helper((const void*)&JetJIT::Unary);
+			Test32(RAX);
+			Jump(CondNE, Error(iptr));
+			Copy(dst, State(JitResult));
+		}
+
+		static int IntCondition(InstructionType op)
+		{
+			switch (op)
+			{
+			case InstructionType::Eq: return CondE;
+			case InstructionType::NotEq: return CondNE;
+			case InstructionType::Lt: return CondL;
+			case InstructionType::Gt: return CondG;
+			case InstructionType::LtE: return CondLE;
+			default: return CondGE;
+			}
+		}
+
+		//a op b, stored as an int in dst or, with a target, jumping there when it is false
+		//pop is how many values come off the stack once the operands have been looked at
+		void Compare(InstructionType op, JitSlot a, JitSlot b, Kind kind, JitSlot dst, int target, int pop, int iptr)
+		{
+			int real = Label(), slow = Label(), done = Label();
+			if (kind != Real)
+			{
+				if (kind == Generic)
+				{
+					CompareByte(Type(a), (int)ValueType::Int);
+					Jump(CondNE, real);
+					CompareByte(Type(b), (int)ValueType::Int);
+					Jump(CondNE, slow);
+				}
+				Load(RAX, Data(a));
+				Alu(0x3B, RAX, Data(b));
+				if (pop)
+					Grow(-pop);//lea leaves the flags alone
+				if (target >= 0)
+					Jump(IntCondition(op) ^ 1, target);
+				else
+				{
+					Set(IntCondition(op), RAX);
+					ZeroExtend8(RAX);
+					SetInt(dst, RAX);
+				}
+				Bind(done);
+			}
+
+			auto reals = [=]()
+			{
+				if (kind == Generic)
+				{
+					Bind(real);
+					CompareByte(Type(a), (int)ValueType::Real);
+					Jump(CondNE, slow);
+					CompareByte(Type(b), (int)ValueType::Real);
+					Jump(CondNE, slow);
+				}
+				//unordered sets ZF, PF and CF, so only above and equal without parity can be true
+				bool swap = op == InstructionType::Lt || op == InstructionType::LtE;
+				LoadReal(0, Data(swap ? b : a));
+				CompareReal(0, Data(swap ? a : b));
+				if (pop)
+					Grow(-pop);
+				if (target >= 0)
+				{
+					switch (op)
+					{
+					case InstructionType::Eq:
+						Jump(CondNE, target);
+						Jump(CondP, target);
+						break;
+					case InstructionType::NotEq:
+						{
+							int skip = Label();
+							Jump(CondP, skip);
+							Jump(CondE, target);
+							Bind(skip);
+							break;
+						}
+					case InstructionType::Lt:
+					case InstructionType::Gt:
+						Jump(CondBE, target);
+						break;
+					default:
+						Jump(CondB, target);
+					}
+				}
+				else
+				{
+					switch (op)
+					{
+					case InstructionType::Eq:
+						Set(CondE, RAX);
+						Set(CondNP, RCX);
+						Reg(0, false, 0x20, RCX, RAX);//and al, cl
+						break;
+					case InstructionType::NotEq:
+						Set(CondNE, RAX);
+						Set(CondP, RCX);
+						Reg(0, false, 0x08, RCX, RAX);//or al, cl
+						break;
+					case InstructionType::Lt:
+					case InstructionType::Gt:
+						Set(CondA, RAX);
+						break;
+					default:
+						Set(CondAE, RAX);
+					}
+					ZeroExtend8(RAX);
+					SetInt(dst, RAX);
+				}
+				if (kind == Generic)
+					Jump(done);
+			};
+			if (kind == Real)
+			{
+				reals();
+				return;
+			}
+			if (kind == Int)
+				return;
+
+			cold.push_back(reals);
+			cold.push_back([=]()
+			{
+				Bind(slow);
+				Lea(RSI, a);
+				Lea(RDX, b);
+				MoveImm(RCX, (int)op);
+				Helper((const void*)&JetJIT::Compare);
+				Compare32(RAX, 2);
+				Jump(CondE, Error(iptr));
+				if (pop)
+					Grow(-pop);
+				if (target >= 0)
+				{
+					Test32(RAX);
+					Jump(CondE, target);
+				}
+				else
+				{
+					ZeroExtend32(RAX);
+					SetInt(dst, RAX);
+				}
+				Jump(done);
+			});
+		}
+
+		//jumps to target if the value is as true as when, ints and reals are true when not 0 and null is false
+		void Branch(bool when, bool pop, int target)
+		{
+			JitSlot v = Stack(1);
+			int notint = Label(), notreal = Label(), done = Label();
+			CompareByte(Type(v), (int)ValueType::Int);
+			Jump(CondNE, notint);
+			CompareZero(Data(v));
+			if (pop)
+				Grow(-1);
+			Jump(when ? CondNE : CondE, target);
+			Jump(done);
+
+			Bind(notint);
+			CompareByte(Type(v), (int)ValueType::Real);
+			Jump(CondNE, notreal);
+			ZeroReal(1);
+			CompareReal(1, Data(v));
+			if (pop)
+				Grow(-1);
+			if (when)
+			{
+				Jump(CondNE, target);
+				Jump(CondP, target);
+			}
+			else
+			{
+				Jump(CondP, done);
+				Jump(CondE, target);
+			}
+			Jump(done);
+
+			Bind(notreal);
+			CompareByte(Type(v), (int)ValueType::Null);
+			if (pop)
+				Grow(-1);
+			Jump(when ? CondNE : CondE, target);
+			Bind(done);
+		}
+
+		//the countdown and interrupt part of Check inline, Preempt through a helper
+		void Check(int target, int iptr)
+		{
+			int preempt = Label();
+			Load(RAX, State(JitCountdown));
+			SubOne({ RAX, 0 });
+			Jump(CondS, preempt);
+			Load(RAX, State(JitInterrupted));
+			CompareByte({ RAX, 0 }, 0);
+			Jump(CondNE, preempt);
+			Jump(target);
+			cold.push_back([=]()
+			{
+				Bind(preempt);
+				Helper((const void*)&JetJIT::Check);
+				Test32(RAX);
+				Jump(CondNE, Error(iptr));
+				Jump(target);
+			});
+		}
+
+		void ForInt(const DecodedInstruction* in, int iptr, int target)
+		{
+			JitSlot i = Local(in->value & 0xFF);
+			JitSlot limit = Local((in->value >> 8) & 0xFF);
+			static const int conditions[] = { CondL, CondLE, CondG, CondGE };
+			int condition = conditions[((in->value >> 16) & 0xFF) > 3 ? 3 : (in->value >> 16) & 0xFF];
+			bool loop = in->instruction == InstructionType::ForIntLoop;
+			int slow = Label(), run = Label();
+
+			CompareByte(Type(i), (int)ValueType::Int);
+			Jump(CondNE, slow);
+			CompareByte(Type(limit), (int)ValueType::Int);
+			Jump(CondNE, slow);
+			Load(RAX, Data(i));
+			if (loop)
+			{
+				AddImm(RAX, (signed char)(in->value >> 24));
+				Store(Data(i), RAX);
+			}
+			Alu(0x3B, RAX, Data(limit));
+			if (loop)
+			{
+				Jump(condition ^ 1, iptr + 1);
+				Bind(run);
+				Check(target, iptr);
+			}
+			else
+				Jump(condition ^ 1, target);
+
+			cold.push_back([=]()
+			{
+				Bind(slow);
+				MoveImm(RSI, (int64_t)in);
+				Helper((const void*)&JetJIT::ForInt);
+				Compare32(RAX, 2);
+				Jump(CondE, Error(iptr));
+				Test32(RAX);
+				if (loop)
+				{
+					Jump(CondNE, run);
+					Jump(iptr + 1);
+				}
+				else
+				{
+					Jump(CondE, target);
+					Jump(iptr + 1);
+				}
+			});
+		}
+
+		void Instruction(const DecodedInstruction* in, int iptr)
+		{
+			MoveImm(RSI, (int64_t)in);
+			Helper((const void*)&JetJIT::Instruction);
+			Test32(RAX);
+			Jump(CondNE, Error(iptr));
+		}
+
+		void Flow(const void* helper, const DecodedInstruction* in, int iptr)
+		{
+			MoveImm(RSI, (int64_t)in);
+			MoveImm(RDX, iptr);
+			Helper(helper);
+			JumpReg(RAX);
+		}
+
+		void Emit(int iptr)
+		{
+			const DecodedInstruction* in = &func->code[iptr];
+			//only read by the jumps, where the union holds their destination
+			int target = (int)(in->target - func->code.data());
+			const JitSlot top = Stack(0);
+
+			switch (in->instruction)
+			{
+			case InstructionType::Add:
+			case InstructionType::AddIntInt:
+			case InstructionType::AddRealReal:
+				Grow(-1);
+				Arith(InstructionType::Add, Stack(1), top, Stack(1), Generic, iptr);
+				break;
+			case InstructionType::Sub:
+			case InstructionType::SubIntInt:
+			case InstructionType::SubRealReal:
+				Grow(-1);
+				Arith(InstructionType::Sub, Stack(1), top, Stack(1), Generic, iptr);
+				break;
+			case InstructionType::Mul:
+			case InstructionType::MulIntInt:
+			case InstructionType::MulRealReal:
+				Grow(-1);
+				Arith(InstructionType::Mul, Stack(1), top, Stack(1), Generic, iptr);
+				break;
+			case InstructionType::Div:
+			case InstructionType::DivIntInt:
+			case InstructionType::DivRealReal:
+				Grow(-1);
+				Arith(InstructionType::Div, Stack(1), top, Stack(1), Generic, iptr);
+				break;
+			case InstructionType::Modulus:
+			case InstructionType::BAnd:
+			case InstructionType::BOr:
+			case InstructionType::Xor:
+			case InstructionType::LeftShift:
+			case InstructionType::RightShift:
+				Grow(-1);
+				Arith(in->instruction, Stack(1), top, Stack(1), Generic, iptr);
+				break;
+			case InstructionType::AddInt:
+			case InstructionType::SubInt:
+			case InstructionType::MulInt:
+				Grow(-1);
+				Arith(in->instruction == InstructionType::AddInt ? InstructionType::Add : in->instruction == InstructionType::SubInt ? InstructionType::Sub : InstructionType::Mul,
+					Stack(1), top, Stack(1), Int, iptr);
+				break;
+			case InstructionType::AddReal:
+			case InstructionType::SubReal:
+			case InstructionType::MulReal:
+			case InstructionType::DivReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul, InstructionType::Div };
+					Grow(-1);
+					Arith(ops[(int)in->instruction - (int)InstructionType::AddReal], Stack(1), top, Stack(1), Real, iptr);
+					break;
+				}
+
+			case InstructionType::Incr:
+			case InstructionType::Decr:
+			case InstructionType::Negate:
+			case InstructionType::BNot:
+				Unary(in->instruction, Stack(1), Stack(1), iptr);
+				break;
+
+			case InstructionType::Eq:
+			case InstructionType::NotEq:
+			case InstructionType::Lt:
+			case InstructionType::Gt:
+			case InstructionType::LtE:
+			case InstructionType::GtE:
+				Grow(-1);
+				Compare(in->instruction, Stack(1), top, Generic, Stack(1), -1, 0, iptr);
+				break;
+			case InstructionType::LtIntInt:
+			case InstructionType::GtIntInt:
+			case InstructionType::LtEIntInt:
+			case InstructionType::GtEIntInt:
+			case InstructionType::LtRealReal:
+			case InstructionType::GtRealReal:
+			case InstructionType::LtERealReal:
+			case InstructionType::GtERealReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Lt, InstructionType::Lt, InstructionType::Gt, InstructionType::Gt,
+						InstructionType::LtE, InstructionType::LtE, InstructionType::GtE, InstructionType::GtE };
+					Grow(-1);
+					Compare(ops[(int)in->instruction - (int)InstructionType::LtIntInt], Stack(1), top, Generic, Stack(1), -1, 0, iptr);
+					break;
+				}
+			case InstructionType::LtInt:
+			case InstructionType::GtInt:
+			case InstructionType::LtEInt:
+			case InstructionType::GtEInt:
+			case InstructionType::LtReal:
+			case InstructionType::GtReal:
+			case InstructionType::LtEReal:
+			case InstructionType::GtEReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Lt, InstructionType::Gt, InstructionType::LtE, InstructionType::GtE };
+					int index = (int)in->instruction - (int)InstructionType::LtInt;
+					Grow(-1);
+					Compare(ops[index % 4], Stack(1), top, index < 4 ? Int : Real, Stack(1), -1, 0, iptr);
+					break;
+				}
+
+			case InstructionType::EqJumpFalse:
+			case InstructionType::NotEqJumpFalse:
+			case InstructionType::LtJumpFalse:
+			case InstructionType::GtJumpFalse:
+			case InstructionType::LtEJumpFalse:
+			case InstructionType::GtEJumpFalse:
+				{
+					static const InstructionType ops[] = { InstructionType::Eq, InstructionType::NotEq, InstructionType::Lt, InstructionType::Gt, InstructionType::LtE, InstructionType::GtE };
+					Compare(ops[(int)in->instruction - (int)InstructionType::EqJumpFalse], Stack(2), Stack(1), Generic, top, target, 2, iptr);
+					break;
+				}
+			case InstructionType::LtJumpFalseIntInt:
+			case InstructionType::LtJumpFalseRealReal:
+			case InstructionType::GtJumpFalseIntInt:
+			case InstructionType::GtJumpFalseRealReal:
+			case InstructionType::LtEJumpFalseIntInt:
+			case InstructionType::LtEJumpFalseRealReal:
+			case InstructionType::GtEJumpFalseIntInt:
+			case InstructionType::GtEJumpFalseRealReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Lt, InstructionType::Gt, InstructionType::LtE, InstructionType::GtE };
+					Compare(ops[((int)in->instruction - (int)InstructionType::LtJumpFalseIntInt) / 2], Stack(2), Stack(1), Generic, top, target, 2, iptr);
+					break;
+				}
+			case InstructionType::LtIntJumpFalse:
+			case InstructionType::GtIntJumpFalse:
+			case InstructionType::LtEIntJumpFalse:
+			case InstructionType::GtEIntJumpFalse:
+			case InstructionType::LtRealJumpFalse:
+			case InstructionType::GtRealJumpFalse:
+			case InstructionType::LtERealJumpFalse:
+			case InstructionType::GtERealJumpFalse:
+				{
+					static const InstructionType ops[] = { InstructionType::Lt, InstructionType::Gt, InstructionType::LtE, InstructionType::GtE };
+					int index = (int)in->instruction - (int)InstructionType::LtIntJumpFalse;
+					Compare(ops[index % 4], Stack(2), Stack(1), index < 4 ? Int : Real, top, target, 2, iptr);
+					break;
+				}
+
+			case InstructionType::Dup:
+				Copy(top, Stack(1));
+				Grow(1);
+				break;
+			case InstructionType::Pop:
+				Grow(-1);
+				break;
+			case InstructionType::LdInt:
+				SetLiteral(top, ValueType::Int, in->int_lit);
+				Grow(1);
+				break;
+			case InstructionType::LdReal:
+				{
+					int64_t bits;
+					memcpy(&bits, &in->lit, sizeof(bits));
+					SetLiteral(top, ValueType::Real, bits);
+					Grow(1);
+					break;
+				}
+			case InstructionType::LdNull:
+				MoveImm(RSI, (int64_t)&Value::Empty);
+				Copy(top, { RSI, 0 });
+				Grow(1);
+				break;
+			case InstructionType::LdStr:
+				if (in->strlit == nullptr)
+				{
+					Exit(iptr);
+					break;
+				}
+				SetLiteral(top, ValueType::String, (int64_t)in->strlit);
+				StoreImm32(top.Field(JitLength), (int)in->strlit->length);
+				Grow(1);
+				break;
+
+			case InstructionType::Jump:
+				Jump(target);
+				break;
+			case InstructionType::Loop:
+				Check(target, iptr);
+				break;
+			case InstructionType::JumpTrue:
+				Branch(true, true, target);
+				break;
+			case InstructionType::JumpTruePeek:
+				Branch(true, false, target);
+				break;
+			case InstructionType::JumpFalse:
+				Branch(false, true, target);
+				break;
+			case InstructionType::JumpFalsePeek:
+				Branch(false, false, target);
+				break;
+
+			case InstructionType::LLoad:
+				Copy(top, Local(in->value));
+				Grow(1);
+				break;
+			case InstructionType::LStore:
+				Grow(-1);
+				Copy(Local(in->value), top);
+				break;
+			case InstructionType::Load:
+			case InstructionType::Store:
+			case InstructionType::CLoad:
+			case InstructionType::CStore:
+			case InstructionType::Close:
+			case InstructionType::LoadAt:
+			case InstructionType::StoreAt:
+				Instruction(in, iptr);
+				break;
+
+			case InstructionType::ForIntPrep:
+			case InstructionType::ForIntLoop:
+				ForInt(in, iptr, target);
+				break;
+
+			case InstructionType::Call:
+			case InstructionType::ECall:
+			case InstructionType::MCall:
+				Flow((const void*)&JetJIT::Call, in, iptr);
+				break;
+			case InstructionType::Return:
+				if (func->generator)
+					Exit(iptr);
+				else
+					Flow((const void*)&JetJIT::Return, in, iptr);
+				break;
+
+			case InstructionType::RMove:
+				Copy(Local(in->value), Local(in->src1));
+				break;
+			case InstructionType::RIncr:
+				Unary(InstructionType::Incr, Local(in->value), Local(in->value), iptr);
+				break;
+			case InstructionType::RDecr:
+				Unary(InstructionType::Decr, Local(in->value), Local(in->value), iptr);
+				break;
+			case InstructionType::RLdInt:
+				SetLiteral(Local(in->value), ValueType::Int, in->int_lit);
+				break;
+			case InstructionType::RLdReal:
+				{
+					int64_t bits;
+					memcpy(&bits, &in->lit, sizeof(bits));
+					SetLiteral(Local(in->value), ValueType::Real, bits);
+					break;
+				}
+			case InstructionType::RAdd:
+			case InstructionType::RSub:
+			case InstructionType::RMul:
+			case InstructionType::RDiv:
+			case InstructionType::RModulus:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul, InstructionType::Div, InstructionType::Modulus };
+					Arith(ops[(int)in->instruction - (int)InstructionType::RAdd], Local(in->src1), Local(in->src2), Local(in->value), Generic, iptr);
+					break;
+				}
+			case InstructionType::REq:
+			case InstructionType::RNotEq:
+			case InstructionType::RLt:
+			case InstructionType::RGt:
+			case InstructionType::RLtE:
+			case InstructionType::RGtE:
+				{
+					static const InstructionType ops[] = { InstructionType::Eq, InstructionType::NotEq, InstructionType::Lt, InstructionType::Gt, InstructionType::LtE, InstructionType::GtE };
+					Compare(ops[(int)in->instruction - (int)InstructionType::REq], Local(in->src1), Local(in->src2), Generic, Local(in->value), -1, 0, iptr);
+					break;
+				}
+
+			case InstructionType::LLoadLLoad:
+				Copy(top, Local(in->src1));
+				Copy(Stack(-1), Local(in->src2));
+				Grow(2);
+				break;
+			case InstructionType::LLoadLLoadAdd:
+			case InstructionType::LLoadLLoadSub:
+			case InstructionType::LLoadLLoadMul:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul };
+					Arith(ops[(int)in->instruction - (int)InstructionType::LLoadLLoadAdd], Local(in->src1), Local(in->src2), top, Generic, iptr);
+					Grow(1);
+					break;
+				}
+			case InstructionType::LLoadLLoadAddIntInt:
+			case InstructionType::LLoadLLoadAddRealReal:
+			case InstructionType::LLoadLLoadSubIntInt:
+			case InstructionType::LLoadLLoadSubRealReal:
+			case InstructionType::LLoadLLoadMulIntInt:
+			case InstructionType::LLoadLLoadMulRealReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul };
+					Arith(ops[((int)in->instruction - (int)InstructionType::LLoadLLoadAddIntInt) / 2], Local(in->src1), Local(in->src2), top, Generic, iptr);
+					Grow(1);
+					break;
+				}
+			case InstructionType::LLoadLLoadAddInt:
+			case InstructionType::LLoadLLoadSubInt:
+			case InstructionType::LLoadLLoadMulInt:
+			case InstructionType::LLoadLLoadAddReal:
+			case InstructionType::LLoadLLoadSubReal:
+			case InstructionType::LLoadLLoadMulReal:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul };
+					int index = (int)in->instruction - (int)InstructionType::LLoadLLoadAddInt;
+					Arith(ops[index % 3], Local(in->src1), Local(in->src2), top, index < 3 ? Int : Real, iptr);
+					Grow(1);
+					break;
+				}
+			case InstructionType::LdIntAdd:
+			case InstructionType::LdIntSub:
+			case InstructionType::LdIntMul:
+			case InstructionType::LdIntAddInt:
+			case InstructionType::LdIntSubInt:
+			case InstructionType::LdIntMulInt:
+				{
+					static const InstructionType ops[] = { InstructionType::Add, InstructionType::Sub, InstructionType::Mul };
+					bool typed = in->instruction >= InstructionType::LdIntAddInt;
+					int index = (int)in->instruction - (int)(typed ? InstructionType::LdIntAddInt : InstructionType::LdIntAdd);
+					ArithLiteral(ops[index], in->int_lit, typed ? Int : Generic, iptr);
+					break;
+				}
+			case InstructionType::LLoadIncrLStore:
+			case InstructionType::LLoadDecrLStore:
+				Unary(in->instruction == InstructionType::LLoadIncrLStore ? InstructionType::Incr : InstructionType::Decr, Local(in->src1), Local(in->value), iptr);
+				break;
+
+			default:
+				//allocation, closures, iteration, varargs, tail calls and generators stay with the interpreter
+				Exit(iptr);
+			}
+		}
+	};
+}
+
+JitCode* JetJIT::Compile(JetContext* context, Function* func)
+{
+	JitCompiler compiler(func);
+	int enter, leave;
+	std::vector<unsigned char>& bytes = compiler.Compile(enter, leave);
+
+	//code is written then made executable, it never changes after that
+	size_t size = (bytes.size() + 4095) & ~(size_t)4095;
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		//try again once it has been hot for a while longer
+		func->calls = 0;
+		return nullptr;
+	}
+	memcpy(memory, bytes.data(), bytes.size());
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, size);
+		func->calls = 0;
+		return nullptr;
+	}
+
+	JitCode* code = new JitCode;
+	code->memory = (unsigned char*)memory;
+	code->size = size;
+	code->enter = (int (*)(JitState*, const void*))(code->memory + enter);
+	code->leave = code->memory + leave;
+	code->entry.resize(func->code.size());
+	for (size_t i = 0; i < func->code.size(); i++)
+		code->entry[i] = code->memory + compiler.labels[i];
+
+	context->jitcode.push_back(code);
+	func->native = code;
+	return code;
+}
+
+void JetJIT::Free(JitCode* code)
+{
+	munmap(code->memory, code->size);
+	delete code;
+}
+
+int JetJIT::Run(JetContext* context, int iptr, std::exception_ptr& error)
+{
+	JitCode* code = context->curframe->prototype->native;
+
+	JitState state;
+	state.context = context;
+	state.sptr = context->sptr;
+	state.top = context->stack._data + context->stack._size;
+	state.countdown = &context->countdown;
+	state.interrupted = &context->interrupted;
+	state.leave = code->leave;
+	state.exit = iptr;
+	state.one = 1.0;
+
+	iptr = code->enter(&state, code->entry[iptr]);
+	if (state.error)
+		error = state.error;
+	else
+		context->stack._size = (unsigned int)(state.top - context->stack._data);
+	return iptr;
+}
+
+void JetJIT::Sync(JitState* state)
+{
+	state->context->stack._size = (unsigned int)(state->top - state->context->stack._data);
+}
+
+void JetJIT::Reload(JitState* state)
+{
+	JetContext* context = state->context;
+	state->sptr = context->sptr;
+	state->top = context->stack._data + context->stack._size;
+}
+
+int JetJIT::Arith(JitState* state, const Value* a, const Value* b, int op)
+{
+	Sync(state);
+	try
+	{
+		Value r = *a;
+		switch ((InstructionType)op)
+		{
+		case InstructionType::Add: r += *b; break;
+		case InstructionType::Sub: r -= *b; break;
+		case InstructionType::Mul: r *= *b; break;
+		case InstructionType::Div: r /= *b; break;
+		case InstructionType::Modulus: r %= *b; break;
+		case InstructionType::BAnd: r &= *b; break;
+		case InstructionType::BOr: r |= *b; break;
+		case InstructionType::Xor: r ^= *b; break;
+		case InstructionType::LeftShift: r <<= *b; break;
+		default: r >>= *b; break;
+		}
+		state->result = r;
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 1;
+	}
+	Reload(state);
+	return 0;
+}
+
+int JetJIT::Unary(JitState* state, const Value* a, int op)
+{
+	Sync(state);
+	try
+	{
+		Value r = *a;
+		switch ((InstructionType)op)
+		{
+		case InstructionType::Incr: r.Increase(); break;
+		case InstructionType::Decr: r.Decrease(); break;
+		case InstructionType::Negate: r.Negate(); break;
+		default: r = ~r; break;
+		}
+		state->result = r;
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 1;
+	}
+	Reload(state);
+	return 0;
+}
+
+int JetJIT::Compare(JitState* state, const Value* a, const Value* b, int op)
+{
+	Sync(state);
+	bool r;
+	try
+	{
+		switch ((InstructionType)op)
+		{
+		case InstructionType::Eq: r = *a == *b; break;
+		case InstructionType::NotEq: r = !(*a == *b); break;
+		case InstructionType::Lt: r = vmcompare((*a), (*b), <); break;
+		case InstructionType::Gt: r = vmcompare((*a), (*b), >); break;
+		case InstructionType::LtE: r = vmcompare((*a), (*b), <=); break;
+		default: r = vmcompare((*a), (*b), >=); break;
+		}
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 2;
+	}
+	Reload(state);
+	return r ? 1 : 0;
+}
+
+int JetJIT::ForInt(JitState* state, const DecodedInstruction* in)
+{
+	JetContext* context = state->context;
+	Sync(state);
+	bool run;
+	try
+	{
+		//the counter or the limit is not an int, do what the interpreter does then
+		Value& i = context->sptr[in->value & 0xFF];
+		const Value& limit = context->sptr[(in->value >> 8) & 0xFF];
+		if (in->instruction == InstructionType::ForIntLoop)
+			i += Value((int)(signed char)(in->value >> 24));
+		switch ((in->value >> 16) & 0xFF)
+		{
+		case 0: run = vmcompare(i, limit, <); break;
+		case 1: run = vmcompare(i, limit, <=); break;
+		case 2: run = vmcompare(i, limit, >); break;
+		default: run = vmcompare(i, limit, >=); break;
+		}
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 2;
+	}
+	Reload(state);
+	return run ? 1 : 0;
+}
+
+int JetJIT::Instruction(JitState* state, const DecodedInstruction* in)
+{
+	JetContext* context = state->context;
+	Sync(state);
+	try
+	{
+		switch (in->instruction)
+		{
+		case InstructionType::Load:
+			vmstack_push(context->stack, context->vars[in->value]);
+			break;
+		case InstructionType::Store:
+			vmstack_pop_to(context->stack, context->vars[in->value]);
+			break;
+		case InstructionType::CLoad:
+			vmstack_push(context->stack, *context->curframe->upvals[in->value]->v);
+			break;
+		case InstructionType::CStore:
+			{
+				Closure* frame = context->curframe;
+				if (frame->mark)
+				{
+					frame->mark = false;
+					context->gc.greys.Push(frame);
+				}
+				Capture* capture = frame->upvals[in->value];
+				if (capture->closed)
+					vmstack_pop_to(context->stack, capture->value);
+				else
+					vmstack_pop_to(context->stack, *capture->v);
+				break;
+			}
+		case InstructionType::Close:
+			if (context->opencaptures.size() > 0)
+				context->Close(in->value);
+			break;
+		case InstructionType::LoadAt:
+			context->LoadAt(in, context->curframe->prototype->caches.data());
+			break;
+		default:
+			context->StoreAt(in, context->curframe->prototype->caches.data());
+			break;
+		}
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 1;
+	}
+	Reload(state);
+	return 0;
+}
+
+int JetJIT::Check(JitState* state)
+{
+	Sync(state);
+	try
+	{
+		state->context->Preempt();
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		return 1;
+	}
+	Reload(state);
+	return 0;
+}
+
+const void* JetJIT::Call(JitState* state, const DecodedInstruction* in, int iptr)
+{
+	JetContext* context = state->context;
+	Sync(state);
+	try
+	{
+		int next;
+		switch (in->instruction)
+		{
+		case InstructionType::Call:
+			next = (int)context->Call(&context->vars[in->value], iptr, in->value2);
+			break;
+		case InstructionType::ECall:
+			{
+				Value one;
+				vmstack_pop_to(context->stack, one);
+				next = (int)context->Call(&one, iptr, in->value);
+				break;
+			}
+		default:
+			{
+				Value one;
+				vmstack_pop_to(context->stack, one);
+				unsigned int calls = context->callstack._size;
+				next = (int)context->Call(&one, iptr, in->value);
+
+				//script functions and generators return later through their frame, anything else already did
+				if (context->callstack._size > calls)
+					vmstack_peek(context->callstack).results = in->value2;
+				else
+					context->Results(1, in->value2);
+				break;
+			}
+		}
+		return Continue(state, next + 1);
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		state->exit = iptr;
+		return state->leave;
+	}
+}
+
+const void* JetJIT::Return(JitState* state, const DecodedInstruction* in, int iptr)
+{
+	JetContext* context = state->context;
+	Sync(state);
+
+	//generators get put away by the interpreter
+	if (context->curframe->generator)
+	{
+		state->exit = iptr;
+		return state->leave;
+	}
+
+	try
+	{
+		const CallFrame& oframe = vmstack_peek(context->callstack);
+		int next = (int)oframe.iptr;
+
+		//drop the frame and leave the return value where the arguments were
+		Value ret = vmstack_peek(context->stack);
+		context->stack._size = (unsigned int)(context->sptr - context->stack._data);
+		vmstack_push(context->stack, ret);
+		if (oframe.results != 1)
+			context->Results(1, oframe.results);
+
+		context->sptr = oframe.base;
+		context->curframe = oframe.closure;
+		vmstack_pop(context->callstack);
+		return Continue(state, next + 1);
+	}
+	catch (...)
+	{
+		state->error = std::current_exception();
+		state->exit = iptr;
+		return state->leave;
+	}
+}
+
+const void* JetJIT::Continue(JitState* state, int iptr)
+{
+	JetContext* context = state->context;
+	Reload(state);
+
+	//keep going in machine code if the frame we ended up in has it, otherwise the interpreter takes over
+	Closure* frame = context->curframe;
+	if (context->jit && frame && iptr >= 0 && iptr < (int)frame->prototype->code.size())
+	{
+		Function* func = frame->prototype;
+		if (func->native == nullptr && func->calls >= JET_JIT_THRESHOLD)
+			Compile(context, func);
+		if (func->native)
+			return func->native->entry[iptr];
+	}
+	state->exit = iptr;
+	return state->leave;
+}
+#endif
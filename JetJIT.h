@@ -0,0 +1,49 @@
+#ifndef _JET_JIT_HEADER
+#define _JET_JIT_HEADER
+
+#include "JetContext.h"
+
+#ifdef JET_JIT
+#include <exception>
+
+namespace Jet
+{
+	struct JitState;
+
+	//template JIT for x86-64, every instruction of a hot function becomes a stub of machine code
+	//ints and reals are worked on inline, everything else goes through the same Value operators
+	//and JetContext functions as the interpreter, which runs whatever the stubs leave to it
+	class JetJIT
+	{
+	public:
+		static JitCode* Compile(JetContext* context, Function* func);//sets func->native, leaves it null if there is no memory for the code
+		static void Free(JitCode* code);
+
+		//runs the current frame from iptr until something is left to the interpreter, returns where it has to carry on
+		//error gets the exception if an instruction threw, it happened at the instruction returned
+		static int Run(JetContext* context, int iptr, std::exception_ptr& error);
+
+	private:
+		//called from the machine code, these return nonzero if they threw
+		static int Arith(JitState* state, const Value* a, const Value* b, int op);//state->result = a op b
+		static int Unary(JitState* state, const Value* a, int op);//state->result = op a
+		static int Compare(JitState* state, const Value* a, const Value* b, int op);//2 if it threw
+		static int ForInt(JitState* state, const DecodedInstruction* in);//if the loop runs, 2 if it threw
+		static int Instruction(JitState* state, const DecodedInstruction* in);
+		static int Check(JitState* state);
+
+		//calls and returns, these give back the machine code to carry on with
+		static const void* Call(JitState* state, const DecodedInstruction* in, int iptr);
+		static const void* Return(JitState* state, const DecodedInstruction* in, int iptr);
+		static const void* Continue(JitState* state, int iptr);
+
+		//hands the stack to the context before a helper and takes it back after
+		static void Sync(JitState* state);
+		static void Reload(JitState* state);
+
+		friend class JitCompiler;
+	};
+}
+#endif
+
+#endif
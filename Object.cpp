@@ -3,19 +3,104 @@
 
 using namespace Jet;
 
-size_t stringhash(const char* str)
+size_t JetString::Hash(const char* str, unsigned int length)
 {
-	/*size_t hash = *str;
-	while (*(str++))
-	hash += *str;*/
-
 	size_t hash = 5381;
-	char c;
-	while (c = *str++)
-		hash = ((hash << 5) + hash) + c;
+	for (unsigned int i = 0; i < length; i++)
+		hash = ((hash << 5) + hash) + str[i];
 	return hash;
 }
 
+JetShape::JetShape(bool shared)
+{
+	this->shared = shared;
+}
+
+int JetShape::find(const Value* key) const
+{
+	if (this->table.size() == 0)
+		return -1;
+
+	size_t mask = this->table.size() - 1;
+	size_t pos = JetObject::key(key) & mask;
+	while (this->table[pos] >= 0)
+	{
+		if (this->keys[this->table[pos]] == *key)
+			return this->table[pos];//we found it
+		pos = (pos + 1) & mask;
+	}
+	return -1;
+}
+
+int JetShape::find(const char* key) const
+{
+	if (this->table.size() == 0)
+		return -1;
+
+	size_t mask = this->table.size() - 1;
+	unsigned int length = (unsigned int)strlen(key);
+	size_t pos = JetString::Hash(key, length) & mask;
+	while (this->table[pos] >= 0)
+	{
+		const Value& k = this->keys[this->table[pos]];
+		if (k.type == ValueType::String && k._string->length == length && memcmp(k._string->data, key, length) == 0)
+			return this->table[pos];//we found it
+		pos = (pos + 1) & mask;
+	}
+	return -1;
+}
+
+void JetShape::insert(const Value& key)
+{
+	this->keys.push_back(key);
+
+	//keep the table at most half full, rehash everything when it grows
+	unsigned int first = (unsigned int)this->keys.size() - 1;
+	if (this->keys.size()*2 > this->table.size())
+	{
+		this->table.assign(this->table.size() ? this->table.size()*2 : 8, -1);
+		first = 0;
+	}
+
+	size_t mask = this->table.size() - 1;
+	for (unsigned int i = first; i < this->keys.size(); i++)
+	{
+		size_t pos = JetObject::key(&this->keys[i]) & mask;
+		while (this->table[pos] >= 0)
+			pos = (pos + 1) & mask;
+		this->table[pos] = i;
+	}
+}
+
+JetShape* JetShape::transition(JetContext* context, JetString* key)
+{
+	//keys are interned so the transition can be found by pointer
+	for (auto ii: this->transitions)
+		if (ii.first == key)
+			return ii.second;
+
+	JetShape* shape = new JetShape(true);
+	shape->keys = this->keys;
+	shape->table = this->table;
+
+	//shared shapes outlive any one object, so keep their key strings alive with the context
+	context->Pin(key);
+	shape->insert(Value(key));
+
+	this->transitions.push_back(std::pair<JetString*, JetShape*>(key, shape));
+	context->shapes.push_back(shape);
+
+	//shared shapes live as long as the context, but scripts still pay for them
+	context->gc.Account((ptrdiff_t)(shape->Size() + sizeof(std::pair<JetString*, JetShape*>)));
+	return shape;
+}
+
+size_t JetShape::Size() const
+{
+	return sizeof(JetShape) + this->keys.capacity()*sizeof(Value) + this->table.capacity()*sizeof(int)
+		+ this->transitions.capacity()*sizeof(std::pair<JetString*, JetShape*>);
+}
+
 JetObject::JetObject(JetContext* jcontext)
 {
 	grey = this->mark = false;
@@ -24,17 +109,25 @@ JetObject::JetObject(JetContext* jcontext)
 
 	prototype = jcontext->object;
 	context = jcontext;
-	Size = 0;
-	nodecount = 2;
-	nodes = new ObjNode[2];
+	shape = jcontext->rootshape;
+	isprototype = false;
+	slots = 0;
+	capacity = 0;
 }
 
 JetObject::~JetObject()
 {
-	delete[] nodes;
+	delete[] slots;
+	if (shape->shared == false)
+		delete shape;
+}
+
+size_t JetObject::Size() const
+{
+	return sizeof(JetObject) + this->capacity*sizeof(Value) + (this->shape->shared ? 0 : this->shape->Size());
 }
 
-std::size_t JetObject::key(const Value* v) const
+std::size_t JetObject::key(const Value* v)
 {
 	switch(v->type)
 	{
@@ -50,235 +143,116 @@ std::size_t JetObject::key(const Value* v) const
 	case ValueType::Real:
 		return (size_t)v->value;
 	case ValueType::String:
-		return stringhash(v->_string->data);
+		return v->_string->hash;
 	case ValueType::NativeFunction:
 		return (size_t)v->func;
 	}
 	return 0;
 }
 
-//just looks for a node
-ObjNode* JetObject::findNode(const Value* key)
+//finds slot for key or creates one if doesnt exist
+Value* JetObject::getSlot(const Value* key)
 {
-	ObjNode* node = &this->nodes[this->key(key)%this->nodecount];
-	if (node->first.type != ValueType::Null)
-	{
-		do
-		{
-			if (node->first == *key)
-				return node;//we found it
-			else
-				node = node->next;
-		}
-		while(node);
-	}	
-	return 0;
+	int i = this->shape->find(key);
+	if (i >= 0)
+		return &this->slots[i];
+
+	return this->addSlot(*key, 0);
 }
 
-ObjNode* JetObject::findNode(const char* key)
+//this method allocates new key strings
+Value* JetObject::getSlot(const char* key)
 {
-	ObjNode* node = &this->nodes[stringhash(key)%this->nodecount];
-	if (node->first.type != ValueType::Null)
-	{
-		do
-		{
-			if (node->first.type == ValueType::String && strcmp(node->first._string->data, key) == 0)
-				return node;//we found it
-			else
-				node = node->next;
-		}
-		while(node);
-	}	
-	return 0;
+	int i = this->shape->find(key);
+	if (i >= 0)
+		return &this->slots[i];
+
+	return this->addSlot(Value(), key);
 }
 
-//finds node for key or creates one if doesnt exist
-ObjNode* JetObject::getNode(const Value* key)
+//name is set instead of key when adding a c string key
+Value* JetObject::addSlot(const Value& key, const char* name)
 {
-	ObjNode* mpnode = &this->nodes[this->key(key)%this->nodecount];//node in the main position
-	if (mpnode->first.type != ValueType::Null)
-	{
-		ObjNode* node = mpnode;
-		while(node->next)//go down the linked list of nodes
-		{
-			if (node->first == *key)
-				return node;//we found it
-			else
-				node = node->next;
-		}
-		if (node->first == *key)
-			return node;//we found it
+	//this could now shadow a key that an inline cache found further down the chain
+	if (this->isprototype)
+		this->context->protoepoch++;
 
-		if (this->Size == this->nodecount)//regrow if we are out of room
-		{
-			this->resize();
-			return this->getNode(key);
-		}
+	//string keys are always interned, which makes finding them again a pointer compare
+	Value k = name ? Value(context->Intern(name)) : key;
+	if (k.type == ValueType::String && k._string->interned == false)
+		k = Value(context->Intern(k._string));
 
-		ObjNode* onode = &this->nodes[this->key(&mpnode->first)%this->nodecount];//get the main position of the node in our main position
+	size_t size = this->Size();
 
-		ObjNode* newnode = this->getFreePosition();//find an open node to insert into
-
-		if (onode != mpnode)//is this node not in the main position?
+	if (this->shape->shared)
+	{
+		if (k.type == ValueType::String && this->shape->keys.size() < JET_SHAPE_MAX_KEYS)
 		{
-			//relocate the node and relink it in, then insert the new node at its position
-			while (onode->next != mpnode) onode = onode->next;
-
-			this->Barrier();
-
-			onode->next = newnode;
-			*newnode = *mpnode;
-			mpnode->next = 0;
-			mpnode->second = Value();
-			mpnode->first = *key;
-			Size++;
-
-			return mpnode;
+			this->shape = this->shape->transition(this->context, k._string);
 		}
 		else
 		{
-			this->Barrier();
-
-			//insert the new node and just link in, we had a hash collision
-			newnode->first = *key;
-			newnode->next = 0;
-			node->next = newnode;//link the new one into the chain
-			Size++;
-
-			return newnode;
+			//too many keys or not a string, give this object its own shape to add to
+			JetShape* shape = new JetShape(*this->shape);
+			shape->shared = false;
+			shape->transitions.clear();
+			shape->insert(k);
+			this->shape = shape;
 		}
 	}
-
-	this->Barrier();
-
-	//main position for key is open, just insert
-	mpnode->first = *key;
-	mpnode->next = 0;
-	Size++;
-
-	return mpnode;
-}
-
-//this method allocates new key strings
-ObjNode* JetObject::getNode(const char* key)
-{
-	ObjNode* mpnode = &this->nodes[stringhash(key)%this->nodecount];//node in the main position
-	if (mpnode->first.type != ValueType::Null)
+	else
 	{
-		ObjNode* node = mpnode;
-		while (node->next)
-		{
-			if (node->first.type == ValueType::String && strcmp(node->first._string->data, key) == 0)
-				return node;//we found it
-			else
-				node = node->next;
-		}
-
-		if (node->first.type == ValueType::String && strcmp(node->first._string->data, key) == 0)
-			return node;//we found it
-
-		if (this->Size == this->nodecount)//regrow if we are out of room
-		{
-			this->resize();
-			return this->getNode(key);
-		}
-
-		ObjNode* onode = &this->nodes[this->key(&mpnode->first)%this->nodecount];//get the main position of the node in our main position
-
-		ObjNode* newnode = this->getFreePosition();//find an open node to insert into
-
-		if (onode != mpnode)//is this node not in the main position?
-		{
-			//relocate the node and relink it in, then insert the new node at its position
-			while (onode->next != mpnode) onode = onode->next;
-
-			this->Barrier();
-
-			onode->next = newnode;
-			*newnode = *mpnode;
-			mpnode->next = 0;
-			mpnode->second = Value();
-			mpnode->first = context->NewString(key);
-			Size++;
-
-			return mpnode;
-		}
-		else
-		{
-			this->Barrier();
-
-			//insert the new node and just link in, we had a hash collision
-			newnode->first = context->NewString(key);
-			newnode->next = 0;
-			node->next = newnode;//link the new one into the chain
-			Size++;
+		this->shape->insert(k);
+	}
 
-			return newnode;
-		}
+	unsigned int slot = (unsigned int)this->shape->keys.size() - 1;
+	if (slot >= this->capacity)
+	{
+		//regrow the slots
+		unsigned int capacity = this->capacity ? this->capacity*2 : 2;
+		Value* slots = new Value[capacity];
+		for (unsigned int i = 0; i < this->capacity; i++)
+			slots[i] = this->slots[i];
+
+		delete[] this->slots;
+		this->slots = slots;
+		this->capacity = capacity;
 	}
+	this->context->gc.Account((ptrdiff_t)this->Size() - (ptrdiff_t)size);
 
 	this->Barrier();
 
-	//main position for key is open, just insert
-	mpnode->first = context->NewString(key);
-	mpnode->next = 0;
-	Size++;
-
-	return mpnode;
-}
-
-ObjNode* JetObject::getFreePosition()
-{
-	for (unsigned int i = 0; i < this->nodecount; i++)
-	{
-		if (this->nodes[i].first.type == ValueType::Null)
-			return &this->nodes[i];
-	}
-	return 0;
+	return &this->slots[slot];
 }
 
-void JetObject::resize()
+void JetObject::SetPrototype(JetObject* obj)
 {
-	//change resize rate, this is just a quickie
-	auto t = this->nodes;
-	this->nodes = new ObjNode[this->nodecount*2];//lets be dumb atm
-	auto osize = this->nodecount;
-	this->nodecount *= 2;
-	this->Size = 0;//cheat
-	for (unsigned int i = 0; i < osize; i++)
-	{
-		//reinsert into hashtable
-		ObjNode* n = &t[i];
-
-		ObjNode* np = this->getNode(&n->first);
-		np->second = n->second;
-	}
+	this->prototype = obj;
 
-	delete[] t;
+	//inline caches remember prototypes, so they all have to look again
+	this->context->protoepoch++;
 }
 
 //try not to use these in the vm
 Value& JetObject::operator [](const Value& key)
 {
-	ObjNode* node = this->getNode(&key);
-	return node->second;
+	return *this->getSlot(&key);
 }
 
 //special operator for strings to deal with insertions
 Value& JetObject::operator [](const char* key)
 {
-	ObjNode* node = this->getNode(key);
-	return node->second;
+	return *this->getSlot(key);
 }
 
 void JetObject::DebugPrint()
 {
 	printf("JetObject Changed:\n");
-	for (unsigned int i = 0; i < this->nodecount; i++)
+	for (unsigned int i = 0; i < this->size(); i++)
 	{
-		auto k = this->nodes[i].first.ToString();
-		auto v = this->nodes[i].second.ToString();
-		printf("[%d] %s    %s   Hash: %i\n", i, k.c_str(), v.c_str(), (this->key(&this->nodes[i].first)%this->nodecount));
+		auto k = this->shape->keys[i].ToString();
+		auto v = this->slots[i].ToString();
+		printf("[%d] %s    %s   Hash: %i\n", i, k.c_str(), v.c_str(), (int)this->key(&this->shape->keys[i]));
 	}
 }
 
@@ -245,17 +245,24 @@ Expression* CallParselet::parse(Parser* parser, Expression* left, Token token)
 {
 	UniquePtr<std::vector<Expression*>*> arguments = new std::vector<Expression*>;
 
+	NameExpression* varargs = 0;
 	if (!parser->MatchAndConsume(TokenType::RightParen))
 	{
 		do
 		{
+			if (parser->MatchAndConsume(TokenType::Ellipses))
+			{
+				//forward the varargs, this has to be the last argument
+				varargs = new NameExpression(parser->Consume(TokenType::Name).getText());
+				break;
+			}
 			arguments->push_back(parser->parseExpression(Precedence::ASSIGNMENT));
 		}
 		while( parser->MatchAndConsume(TokenType::Comma));
 
 		parser->Consume(TokenType::RightParen);
 	}
-	return new CallExpression(token, left, arguments.Release());
+	return new CallExpression(token, left, arguments.Release(), varargs);
 }
 
 Expression* ReturnParselet::parse(Parser* parser, Token token)
@@ -264,6 +271,16 @@ Expression* ReturnParselet::parse(Parser* parser, Token token)
 	if (parser->Match(TokenType::Semicolon) == false)
 		right = parser->parseExpression(Precedence::ASSIGNMENT);
 
+	if (right && parser->Match(TokenType::Comma))
+	{
+		//returning more than one value
+		UniquePtr<std::vector<Expression*>*> values = new std::vector<Expression*>;
+		values->push_back(right);
+		while (parser->MatchAndConsume(TokenType::Comma))
+			values->push_back(parser->parseExpression(Precedence::ASSIGNMENT));
+
+		return new ReturnExpression(token, 0, values.Release());
+	}
 	return new ReturnExpression(token, right);
 }
 
@@ -277,7 +294,7 @@ Expression* LocalParselet::parse(Parser* parser, Token token)
 		vd.m_Name = parser->Consume(TokenType::Name);
 		if (parser->MatchAndConsume(TokenType::Assign))
 		{
-			//ֵ
+			//变量赋初值
 			vd.m_Experssion = parser->parseExpression(Precedence::ASSIGNMENT - 1/*assignment prcedence -1 */);
 		}
 		names->push_back(vd);
@@ -299,7 +316,7 @@ Expression* Jet::GlobalParselet::parse(Parser* parser, Token token)
 		vd.m_Name = parser->Consume(TokenType::Name);
 		if (parser->MatchAndConsume(TokenType::Assign))
 		{
-			//ֵ
+			//变量赋初值
 			vd.m_Experssion = parser->parseExpression(Precedence::ASSIGNMENT - 1/*assignment prcedence -1 */);
 		}
 		names->push_back(vd);
@@ -429,13 +446,13 @@ Expression* Jet::ClassParselet::parse(Parser* parser, Token token)
 	
 	if (parser->MatchAndConsume(TokenType::Colon))
 	{
-		// ':',ʾл
+		// 如果类名后面有':',表示类型有基类
 		m_Base = parser->Consume(TokenType::Name).getText();
 	}
 
 	parser->Consume(TokenType::LeftBrace);
 
-	//ֶ
+	//字段
 	UniquePtr<std::vector<VarDefine>*> fields = new std::vector<VarDefine>;
 	if (!parser->MatchAndConsume(TokenType::RightBrace))
 	{
@@ -444,19 +461,19 @@ Expression* Jet::ClassParselet::parse(Parser* parser, Token token)
 			auto lookAhead = parser->LookAhead();
 			if (lookAhead.type == TokenType::Local)
 			{
-				//Ա
+				//成员变量
 				parser->Consume();
 				ParseFields(parser);
 			}
 			else if (lookAhead.type == TokenType::Function)
 			{
-				//Ա
+				//成员函数
 				auto t=parser->Consume();
 				ParseFunction(parser,t);
 			}
 			else
 			{
-				//
+				//报错
 				std::string str = "Class: TokenType not as expected! Expected: var or function ,but got: " + lookAhead.text;
 				throw CompilerException(parser->filename, token.line, str);
 			}
@@ -476,7 +493,7 @@ void Jet::ClassParselet::ParseFields(Parser* parser)
 		vd.m_Name = parser->Consume(TokenType::Name);
 		if (parser->MatchAndConsume(TokenType::Assign))
 		{
-			//ֵ
+			//变量赋初值
 			vd.m_Experssion = parser->parseExpression(Precedence::ASSIGNMENT - 1/*assignment prcedence -1 */);
 		}
 		if (IsExist(vd.m_Name.text))
@@ -506,7 +523,7 @@ void Jet::ClassParselet::ParseFunction(Parser* parser, const Token& token)
 	NameExpression* varargs = 0;
 	parser->Consume(TokenType::LeftParen);
 
-	//this
+	//添加隐含的this参数
 	arguments->push_back(new NameExpression("this"));
 	if (!parser->MatchAndConsume(TokenType::RightParen))
 	{
@@ -402,7 +402,7 @@ namespace Jet
 
 		Expression* parse(Parser* parser, Token token);
 
-		//Ƿӵֵֶָλ
+		//是否拥有指定名字的字段或函数
 		bool IsExist(const std::string& name) const
 		{
 			auto i = m_Functions.find(name);
@@ -414,10 +414,10 @@ namespace Jet
 			return false;
 		}
 
-		//ֶ
+		//解析字段
 		void ParseFields(Parser* parser);
 
-		//
+		//解析函数
 		void ParseFunction(Parser* parser, const Token& token);
 	};
 };
@@ -70,7 +70,7 @@ namespace Jet
 
 		Function,	// function
 		For,		// for
-		Local,		// var  local
+		Local,		// var 或 local
 		Global,		// global
 		Break,		// break
 		Continue,	// continue
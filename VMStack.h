@@ -8,11 +8,13 @@ namespace Jet
 {
 	const int MaxStackSize = 1024;
 
+	//starts out small and grows by moving to a bigger array until it reaches its limit
 	template<class T>
 	class VMStack
 	{
 		const char* overflow_error;
-		unsigned int _max;
+		unsigned int _max;//room in the current array
+		unsigned int _limit;//most it can grow to
 	public:
 		T*	_data=nullptr;
 		unsigned int _size;
@@ -22,28 +24,28 @@ namespace Jet
 			overflow_error = "Stack Overflow";
 			_size = 0;
 			_max = MaxStackSize;
+			_limit = 0xFFFFFFFF;
 			_data = new T[_max];
 		}
 
-		VMStack(unsigned int size)
+		VMStack(unsigned int size, unsigned int limit, const char* error = "Stack Overflow")
 		{
 			_size = 0;
 			_max = size;
-			overflow_error = "Stack Overflow";
+			_limit = limit;
+			overflow_error = error;
 			_data = new T[_max];
 		}
 
-		VMStack(unsigned int size, const char* error)
+		VMStack(VMStack&& other) : overflow_error(other.overflow_error), _max(other._max), _limit(other._limit), _data(other._data), _size(other._size)
 		{
-			_size = 0;
-			_max = size;
-			overflow_error = error;
-			_data = new T[_max];
+			other._data = nullptr;
 		}
 
 		VMStack<T> Copy()
 		{
-			VMStack<T> ns;
+			//leave room for one more so a full stack can still be copied and added to
+			VMStack<T> ns(this->_size + 1, this->_limit + 1, this->overflow_error);
 			for (unsigned int i = 0; i < this->_size; i++)
 				ns._data[i] = this->_data[i];
 
@@ -96,10 +98,16 @@ namespace Jet
 			v= _data[_size - 1];
 		}
 
+		//pushing can move the stack, so nothing may point into it
 		void Push(const T& item)
 		{
 			if (_size >= _max)
-				throw RuntimeException(overflow_error);
+			{
+				T* old = Grow(1);
+				if (old == nullptr)
+					throw RuntimeException(overflow_error);
+				delete[] old;
+			}
 
 			_data[_size++] = item;
 		}
@@ -108,6 +116,44 @@ namespace Jet
 		{
 			return _size;
 		}
+
+		//if count more values can be pushed without growing
+		bool fits(unsigned int count) const
+		{
+			return count <= _max - _size;
+		}
+
+		//moves to an array with room for at least count more, returns the old one for the caller to free
+		//once nothing points into it anymore, or null if the stack would go over its limit
+		T* Grow(unsigned int count)
+		{
+			if (count > _limit - _size)
+				return nullptr;
+
+			unsigned int size = _max;
+			while (size - _size < count && size < _limit)
+				size = size > _limit / 2 ? _limit : size * 2;
+
+			T* data = new T[size];
+			for (unsigned int i = 0; i < _size; i++)
+				data[i] = _data[i];
+
+			T* old = _data;
+			_data = data;
+			_max = size;
+			return old;
+		}
+
+		unsigned int capacity() const
+		{
+			return _max;
+		}
+
+		void limit(unsigned int limit)
+		{
+			//it never shrinks below what is already in use
+			_limit = limit > _max ? limit : _max;
+		}
 	};
 
 	// use macro to avoid function call
@@ -117,5 +163,6 @@ namespace Jet
 #define vmstack_popn(stack,n) stack._size-=n
 #define vmstack_push(stack,v) stack._data[stack._size++] = v
 #define vmstack_push_top(stack) stack._data[stack._size++] = stack._data[stack._size - 1];
+#define vmstack_pop_to(stack,v) v = stack._data[--stack._size]
 }
 #endif
\ No newline at end of file
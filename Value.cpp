@@ -13,27 +13,30 @@ Generator::Generator(JetContext* context, Closure* closure, unsigned int args)
 	this->stack = new Value[closure->prototype->locals];
 
 	//pass in arguments
-	if (args <= closure->prototype->args)
+	if (closure->prototype->vararg)
 	{
-		for (int i = closure->prototype->args-1; i >= 0; i--)
+		//generators always keep their varargs in an array, their locals have no room above them
+		unsigned int fixed = closure->prototype->args;
+		stack[fixed] = context->NewArray();
+		auto arr = &stack[fixed]._array->data;
+		arr->resize(args > fixed ? args - fixed : 0);
+		context->gc.Track(stack[fixed]._array);
+		for (int i = (int)args - 1; i >= 0; i--)
 		{
-			if (i < (int)args)
+			if (i < (int)fixed)
 				stack[i] = context->stack.Pop();
 			else
-				stack[i] = Value();
+				(*arr)[i - fixed] = context->stack.Pop();
 		}
 	}
-	else if (closure->prototype->vararg)
+	else if (args <= closure->prototype->args)
 	{
-		stack[closure->prototype->locals-1] = context->NewArray();
-		auto arr = &stack[closure->prototype->locals-1]._array->data;
-		arr->resize(args - closure->prototype->args);
-		for (int i = (int)args - 1; i >= 0; i--)
+		for (int i = closure->prototype->args-1; i >= 0; i--)
 		{
-			if (i < (int)closure->prototype->args)
+			if (i < (int)args)
 				stack[i] = context->stack.Pop();
 			else
-				(*arr)[i] = context->stack.Pop();
+				stack[i] = Value();
 		}
 	}
 	else
@@ -50,7 +53,12 @@ Generator::Generator(JetContext* context, Closure* closure, unsigned int args)
 	this->curiptr = 0;//set current position to start of function
 }
 
-void Generator::Yield(JetContext* context, unsigned int iptr)
+Generator::~Generator()
+{
+	delete[] this->stack;
+}
+
+Value* Generator::Yield(JetContext* context, unsigned int iptr)
 {
 	this->state = GeneratorState::Suspended;
 	//store the iptr
@@ -58,12 +66,29 @@ void Generator::Yield(JetContext* context, unsigned int iptr)
 
 	this->lastyielded = context->stack.Peek();
 
-	//store stack
-	for (unsigned int i = 0; i < this->closure->prototype->locals; i++)
-		this->stack[i] = context->sptr[i];
+	//captures of the locals stay open, but they come off the context's list until it runs again
+	//they were the last ones opened, and the generator holds a reference so they cant be freed before it
+	Value* end = this->stack + this->closure->prototype->locals;
+	while (context->opencaptures.size() > 0)
+	{
+		Capture* capture = context->opencaptures.back().capture;
+		if (capture->v < this->stack || capture->v >= end)
+			break;
+
+		capture->refcount++;
+		this->captures.push_back(capture);
+		context->opencaptures.pop_back();
+	}
+	return &context->stack._data[this->base];
 }
 
-unsigned int Generator::Resume(JetContext* context)
+Value* Generator::Kill(JetContext* context)
+{
+	this->state = GeneratorState::Dead;
+	return &context->stack._data[this->base];
+}
+
+unsigned int Generator::Resume(JetContext* context, const Value& arg)
 {
 	if (this->state == GeneratorState::Dead)
 		throw RuntimeException("Cannot resume dead generator");
@@ -72,16 +97,40 @@ unsigned int Generator::Resume(JetContext* context)
 
 	this->state = GeneratorState::Running;
 
-	//restore stack
-	for (unsigned int i = 0; i < this->closure->prototype->locals; i++)
-		context->sptr[i] = this->stack[i];
+	//run with the locals where they are, only the temporaries go on the stack
+	context->sptr = this->stack;
+	this->base = context->stack._size;
+	while (this->captures.size() > 0)
+	{
+		JetContext::OpenCapture c;
+		c.capture = this->captures.back();
+#ifdef _DEBUG
+		c.creator = this->closure;
+#endif
+		c.capture->refcount--;
+		context->opencaptures.push_back(c);
+		this->captures.pop_back();
+	}
 
-	if (this->curiptr == 0)
-		context->stack.Pop();
+	//the first resume starts the function, there is no yield waiting for a value
+	if (this->curiptr != 0)
+		vmstack_push(context->stack, arg);
 
 	return this->curiptr;
 }
 
+void Generator::Close()
+{
+	for (auto capture: this->captures)
+	{
+		capture->closed = true;
+		capture->value = *capture->v;
+		capture->v = &capture->value;
+		capture->refcount--;
+	}
+	this->captures.clear();
+}
+
 //---------------------------------------------------------------------
 Jet::Value Jet::Value::Empty;
 Jet::Value Jet::Value::Zero(0);
@@ -89,8 +138,9 @@ Jet::Value Jet::Value::One(1);
 
 Value::Value()
 {
-	this->type = ValueType::Null;
+	//clear the data first, setting the type keeps it
 	this->int_value = 0;
+	this->type = ValueType::Null;
 }
 
 Value::Value(JetString* str)
@@ -99,7 +149,7 @@ Value::Value(JetString* str)
 		return;
 
 	type = ValueType::String;
-	length = (unsigned int)strlen(str->data);
+	length = str->length;
 	_string = str;
 }
 
@@ -117,20 +167,20 @@ Value::Value(JetArray* arr)
 
 Value::Value(double val)
 {
-	type = ValueType::Real;
 	value = val;
+	type = ValueType::Real;
 }
 
 Value::Value(int val)
 {
-	type = ValueType::Int;
 	int_value = val;
+	type = ValueType::Int;
 }
 
 Value::Value(int64_t val)
 {
-	type = ValueType::Int;
 	int_value = val;
+	type = ValueType::Int;
 }
 
 Value::Value(JetNativeFunc a)
@@ -273,15 +323,15 @@ std::string Value::ToString(int depth) const
 	case ValueType::String:
 		return this->_string->data;
 	case ValueType::Function:
-		return "[Function "+this->_function->prototype->name+" " + std::to_string((unsigned int)this->_function)+"]";
+		return "[Function "+this->_function->prototype->name+" " + std::to_string((uintptr_t)this->_function)+"]";
 	case ValueType::NativeFunction:
-		return "[NativeFunction "+std::to_string((unsigned int)this->func)+"]";
+		return "[NativeFunction "+std::to_string((uintptr_t)this->func)+"]";
 	case ValueType::Array:
 		{
 			std::string str = "[\n";
 
 			if (depth++ > 3)
-				return "[Array " + std::to_string((int)this->_array)+"]";
+				return "[Array " + std::to_string((uintptr_t)this->_array)+"]";
 
 			int i = 0;
 			for (auto ii: this->_array->data)
@@ -299,7 +349,7 @@ std::string Value::ToString(int depth) const
 			std::string str = "{\n";
 
 			if (depth++ > 3)
-				return "[Object " + std::to_string((int)this->_object)+"]";
+				return "[Object " + std::to_string((uintptr_t)this->_object)+"]";
 
 			for (auto ii: *this->_object)
 			{
@@ -313,7 +363,7 @@ std::string Value::ToString(int depth) const
 		}
 	case ValueType::Userdata:
 		{
-			return "[Userdata "+std::to_string((int)this->_userdata)+"]";
+			return "[Userdata "+std::to_string((uintptr_t)this->_userdata)+"]";
 		}
 	default:
 		return "";
@@ -325,7 +375,7 @@ void Value::SetPrototype(JetObject* obj)
 	switch (this->type)
 	{
 	case ValueType::Object:
-		this->_object->prototype = obj;
+		this->_object->SetPrototype(obj);
 	case ValueType::Userdata:
 		this->_userdata->prototype = obj;
 	default:
@@ -335,13 +385,13 @@ void Value::SetPrototype(JetObject* obj)
 
 Value Value::CallMetamethod(JetObject* table, const char* name, const Value* other)
 {
-	auto node = table->prototype->findNode(name);
+	auto node = table->prototype->findSlot(name);
 	if (node == 0)
 	{
 		auto obj = table->prototype;
 		while(obj)
 		{
-			node = obj->findNode(name);
+			node = obj->findSlot(name);
 			if (node)
 				break;
 			obj = obj->prototype;
@@ -354,7 +404,7 @@ Value Value::CallMetamethod(JetObject* table, const char* name, const Value* oth
 		args[0] = *this;
 		if (other)
 			args[1] = *other;
-		return table->prototype->context->Call(&node->second, (Value*)&args, other ? 2 : 1);
+		return table->prototype->context->Call(node, (Value*)&args, other ? 2 : 1);
 	}
 
 	throw RuntimeException("Cannot " + (std::string)(name+1) + " two non-numeric types! " + (std::string)ValueTypes[(int)this->type] + " and " + (std::string)ValueTypes[(int)other->type]);
@@ -362,13 +412,13 @@ Value Value::CallMetamethod(JetObject* table, const char* name, const Value* oth
 
 Value Value::CallMetamethod(const char* name, const Value* other)
 {
-	auto node = this->_object->prototype->findNode(name);
+	auto node = this->_object->prototype->findSlot(name);
 	if (node == 0)
 	{
 		auto obj = this->_object->prototype;
 		while(obj)
 		{
-			node = obj->findNode(name);
+			node = obj->findSlot(name);
 			if (node)
 				break;
 			obj = obj->prototype;
@@ -381,7 +431,7 @@ Value Value::CallMetamethod(const char* name, const Value* other)
 		args[0] = *this;
 		if (other)
 			args[1] = *other;
-		return this->_object->prototype->context->Call(&node->second, (Value*)&args, other ? 2 : 1);
+		return this->_object->prototype->context->Call(node, (Value*)&args, other ? 2 : 1);
 	}
 
 	throw RuntimeException("Cannot " + (std::string)(name+1) + " two non-numeric types! " + (std::string)ValueTypes[(int)this->type] + " and " + (std::string)ValueTypes[(int)other->type]);
@@ -389,13 +439,13 @@ Value Value::CallMetamethod(const char* name, const Value* other)
 
 bool Value::TryCallMetamethod(const char* name, const Value* iargs, int numargs, Value* out) const
 {
-	auto node = this->_object->prototype->findNode(name);
+	auto node = this->_object->prototype->findSlot(name);
 	if (node == 0)
 	{
 		auto obj = this->_object->prototype;
 		while(obj)
 		{
-			node = obj->findNode(name);
+			node = obj->findSlot(name);
 			if (node)
 				break;
 			obj = obj->prototype;
@@ -412,7 +462,7 @@ bool Value::TryCallMetamethod(const char* name, const Value* iargs, int numargs,
 			args[i] = iargs[i];
 
 		//help, calling this derps up curframe
-		*out = this->_object->prototype->context->Call(&node->second, args, numargs+1);
+		*out = this->_object->prototype->context->Call(node, args, numargs+1);
 		return true;
 	}
 	return false;
@@ -455,7 +505,12 @@ bool Value::operator== (const Value& other) const
 	case ValueType::NativeFunction:
 		return other.func == this->func;
 	case ValueType::String:
-		return strcmp(other._string->data, this->_string->data) == 0;
+		if (other._string == this->_string)
+			return true;
+		if (other._string->interned && this->_string->interned)
+			return false;//there is only one interned copy of each string
+		return other._string->length == this->_string->length && other._string->hash == this->_string->hash
+			&& memcmp(other._string->data, this->_string->data, this->_string->length) == 0;
 	case ValueType::Null:
 		return true;
 	case ValueType::Object:
@@ -831,6 +886,7 @@ Value Value::operator>>( const Value &other )
 };
 
 
+//the in place operators set the result before the type, when NaN boxed they share the same bits
 void Value::operator+=(const Value &other)
 {
 	switch (this->type)
@@ -841,8 +897,8 @@ void Value::operator+=(const Value &other)
 			{
 				case ValueType::Real:
 				{
-					type = ValueType::Real;
 					value = (double)int_value + other.value;
+					type = ValueType::Real;
 					return;
 				}
 				case ValueType::Int:
@@ -923,8 +979,8 @@ void Value::operator-=(const Value &other)
 		{
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Real;
 				value = (double)int_value - other.value;
+				type = ValueType::Real;
 				return;
 			}
 			else if (other.type == ValueType::Int)
@@ -943,7 +999,7 @@ void Value::operator-=(const Value &other)
 			}
 			else if (other.type == ValueType::Int)
 			{
-				value -= (double)other.value;
+				value -= (double)other.int_value;
 				return;
 			}
 			break;
@@ -978,8 +1034,8 @@ void Value::operator*=(const Value &other)
 		case ValueType::Int:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Real;
 				value = (double)int_value * other.value;
+				type = ValueType::Real;
 				return;
 			}
 			else if (other.type == ValueType::Int)
@@ -996,7 +1052,7 @@ void Value::operator*=(const Value &other)
 			}
 			else if (other.type == ValueType::Int)
 			{
-				value *= (double)other.value;
+				value *= (double)other.int_value;
 				return;
 			}
 			break;
@@ -1026,8 +1082,8 @@ void Value::operator/=(const Value &other)
 		case ValueType::Int:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Real;
 				value = (double)int_value/other.value;
+				type = ValueType::Real;
 				return;
 			}
 			else if (other.type == ValueType::Int)
@@ -1044,7 +1100,7 @@ void Value::operator/=(const Value &other)
 			}
 			else if (other.type == ValueType::Int)
 			{
-				value /= (double)other.value;
+				value /= (double)other.int_value;
 				return;
 			}
 			break;
@@ -1074,8 +1130,8 @@ void Value::operator%=(const Value &other)
 		case ValueType::Int:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Real;
 				value = fmod((double)int_value, other.value);
+				type = ValueType::Real;
 				return;
 			}
 			else if (other.type == ValueType::Int)
@@ -1134,14 +1190,14 @@ void Value::operator|=(const Value &other)
 		case ValueType::Real:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value | (int64_t)other.value;
+				type = ValueType::Int;
 				return;
 			}
 			else if (other.type == ValueType::Int)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value | other.int_value;
+				type = ValueType::Int;
 				return;
 			}
 			break;
@@ -1183,14 +1239,14 @@ void Value::operator&=(const Value &other)
 		case ValueType::Real:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value & (int64_t)other.value;
+				type = ValueType::Int;
 				return;
 			}
 			else if (other.type == ValueType::Int)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value & other.int_value;
+				type = ValueType::Int;
 				return;
 			}
 			break;
@@ -1232,14 +1288,14 @@ void Value::operator^=(const Value &other)
 		case ValueType::Real:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value ^ (int64_t)other.value;
+				type = ValueType::Int;
 				return;
 			}
 			else if (other.type == ValueType::Int)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value ^ other.int_value;
+				type = ValueType::Int;
 				return;
 			}
 			break;
@@ -1281,14 +1337,14 @@ void Value::operator<<=(const Value &other)
 		case ValueType::Real:
 			if (other.type == ValueType::Real)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value << (int64_t)other.value;
+				type = ValueType::Int;
 				return;
 			}
 			else if (other.type == ValueType::Int)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value << other.int_value;
+				type = ValueType::Int;
 				return;
 			}
 			break;
@@ -1336,8 +1392,8 @@ void Value::operator>>=(const Value &other)
 			}
 			else if (other.type == ValueType::Int)
 			{
-				type = ValueType::Int;
 				int_value = (int64_t)value >> other.int_value;
+				type = ValueType::Int;
 				return;
 			}
 			break;
@@ -10,16 +10,23 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
+#include <cstring>
 
 #undef Yield
 
+//define JET_NAN_BOXING to pack each value into 8 bytes instead of 24
+//reals are stored as they are and every other type lives in the payload of a NaN,
+//which limits ints to 48 bits and needs pointers that fit in 48 bits
+//#define JET_NAN_BOXING
+
 namespace Jet
 {
 	class JetContext;
 	class GarbageCollector;
 
 	/// <summary>
-	/// ֵ
+	/// 值的类型
 	/// </summary>
 	enum class ValueType:char
 	{
@@ -38,7 +45,7 @@ namespace Jet
 	};
 	
 	/// <summary>
-	/// GCֵ
+	/// GC值
 	/// </summary>
 	template<class t>
 	struct GCVal
@@ -63,14 +70,24 @@ namespace Jet
 
 	static const char* ValueTypes[] = { "Null", "Int", "Real", "NativeFunction", "String" , "Object", "Array", "Function", "Userdata"};
 
-	struct String
+	//strings keep their length, hash and characters in a single allocation
+	//interned strings are unique within their context, so two of them are only equal if they are the same string
+	struct JetString
 	{
 		bool mark, grey;
+		ValueType type;
 		unsigned char refcount;
 
+		bool interned;//in the context's string table, its characters must not change
+		bool constant;//referenced by code or a shared shape, never collected
 		unsigned int length;
-		unsigned int hash;
-		//string data would be stored after this point
+		size_t hash;
+		JetContext* context;
+		JetString* next;//next string in the same string table bucket
+
+		char data[1];//the characters and null terminator continue past the end of the struct
+
+		static size_t Hash(const char* str, unsigned int length);
 	};
 
 	class JetObject;
@@ -80,6 +97,7 @@ namespace Jet
 		bool mark, grey;
 		ValueType type;
 		unsigned char refcount;
+		unsigned int accounted;//capacity of data counted in the context's memory usage
 		
 		JetContext* context;
 
@@ -104,14 +122,14 @@ namespace Jet
 		}
 	};
 
-	typedef GCVal<char*> JetString;
-
 	typedef void _JetFunction;
 	typedef Value(*JetNativeFunc)(JetContext*,Value*, int);
 
 	class JetContext;
 	struct Function;
-	//each instruction can have a double, or two integers
+	struct Closure;
+	struct JitCode;
+	//each instruction has an integer and a second integer, pointer or literal
 	struct Instruction
 	{
 		InstructionType instruction;
@@ -129,11 +147,87 @@ namespace Jet
 					Function* func;
 					JetString* strlit;
 					const char* string;
+
+					int64_t int_lit;	//int literal for pushing numbers
+					double	lit;		//double literal for pushing numbers
+
+					//source locals for register instructions, value is the destination
+					struct
+					{
+						unsigned short src1, src2;
+					};
 				};
 			};
+		};
+	};
 
-			int64_t int_lit;	//int literal for pushing numbers
-			double	lit;		//double literal for pushing numbers
+	struct JetShape;
+
+#define JET_INLINE_CACHE_SIZE 4//receiver shapes remembered by each inline cache
+
+	//inline cache for a LoadAt or StoreAt with a constant key, remembers where the key was
+	//found for the last few receiver shapes so a hit never has to hash the key
+	//only shared shapes are cached since they never change or get freed
+	struct InlineCache
+	{
+		struct Entry
+		{
+			JetShape* shape;//shape of the receiver
+			JetObject* prototype;//receiver's prototype when the key was inherited
+			JetObject* holder;//object holding the key, null if it was the receiver
+			unsigned int epoch;//context prototype epoch when an inherited key was cached
+			int slot;
+		};
+		Entry entries[JET_INLINE_CACHE_SIZE];
+		unsigned int next;//entry to replace once they are all used
+
+		InlineCache()
+		{
+			for (unsigned int i = 0; i < JET_INLINE_CACHE_SIZE; i++)
+				this->entries[i].shape = 0;
+			this->next = 0;
+		}
+
+		//returns the cached slot for this receiver or null on a miss
+		inline Value* Get(JetObject* obj, unsigned int epoch);
+
+		//remembers the slot the key was found at for this receiver
+		inline void Set(JetObject* obj, JetObject* holder, int slot, unsigned int epoch);
+	};
+
+	//pre-decoded form of an instruction that the interpreter actually runs
+	//handler is the address of the instruction's code in Execute (when using computed gotos)
+	//and jumps point straight at the instruction they go to
+	struct DecodedInstruction
+	{
+		const void* handler;
+		InstructionType instruction;
+		//data part
+		union
+		{
+			struct
+			{
+				int value;
+
+				union
+				{
+					int value2;
+
+					Function* func;
+					JetString* strlit;
+					const char* string;
+					const DecodedInstruction* target;//jump destination
+
+					int64_t int_lit;	//int literal for pushing numbers
+					double	lit;		//double literal for pushing numbers
+
+					//source locals for register instructions, value is the destination
+					struct
+					{
+						unsigned short src1, src2;
+					};
+				};
+			};
 		};
 	};
 
@@ -141,24 +235,50 @@ namespace Jet
 	{
 		~Function()
 		{
+			//only jump labels keep their strings
 			for (auto ii: this->instructions)
-				if (ii.instruction != InstructionType::CLoad 
-					&& ii.instruction != InstructionType::CInit
-					&& ii.instruction != InstructionType::LoadFunction 
-					&& ii.instruction != InstructionType::LdStr 
-					&& ii.instruction != InstructionType::LdInt
-					&& ii.instruction != InstructionType::LdReal 
-					&& ii.instruction != InstructionType::Call
-					&& ii.instruction != InstructionType::Load
-					&& ii.instruction != InstructionType::Store
-					&& ii.instruction != InstructionType::CStore)
+			{
+				switch (ii.instruction)
+				{
+				case InstructionType::Jump:
+				case InstructionType::JumpTrue:
+				case InstructionType::JumpTruePeek:
+				case InstructionType::JumpFalse:
+				case InstructionType::JumpFalsePeek:
+				case InstructionType::EqJumpFalse:
+				case InstructionType::NotEqJumpFalse:
+				case InstructionType::LtJumpFalse:
+				case InstructionType::GtJumpFalse:
+				case InstructionType::LtEJumpFalse:
+				case InstructionType::GtEJumpFalse:
+				case InstructionType::LtIntJumpFalse:
+				case InstructionType::GtIntJumpFalse:
+				case InstructionType::LtEIntJumpFalse:
+				case InstructionType::GtEIntJumpFalse:
+				case InstructionType::LtRealJumpFalse:
+				case InstructionType::GtRealJumpFalse:
+				case InstructionType::LtERealJumpFalse:
+				case InstructionType::GtERealJumpFalse:
 					delete[] ii.string;
+					break;
+				default:
+					break;
+				}
+			}
 		}
 
 		unsigned int args, locals, upvals;
+		unsigned int maxstack;//deepest the operand stack gets in this function, checked once on entry
 		bool vararg; bool generator;
+		bool stackvarargs;//the varargs never escape, they stay on the stack above the locals and the vararg local holds their count
 		JetContext* context;//context where this function was created
+		Closure* closure;//shared by every LoadFunction of it when it captures nothing, the reference it holds keeps it alive
 		std::vector<Instruction> instructions;//list of all instructions in the function
+		std::vector<DecodedInstruction> code;//decoded instructions, this is what gets executed
+		std::vector<InlineCache> caches;//one for each LoadAt/StoreAt with a constant key, value is its index
+
+		unsigned int calls = 0;//calls and loop iterations so far, the JIT compiles the function once there are enough
+		JitCode* native = nullptr;//machine code for the function if it has been compiled, freed with the context
 
 		//debug info
 		std::string name;//the name of the function in code
@@ -188,14 +308,171 @@ namespace Jet
 		Generator* generator;
 
 		unsigned char numupvals;
-		Capture** upvals;//captured values
-	
-		Closure* prev;//parent closure, used for searching for captures
+		Capture** upvals;//every capture the function uses, shared with the closure it was made in when it came from there
 	};
 
+#ifdef JET_NAN_BOXING
+	static_assert(sizeof(void*) == 8, "JET_NAN_BOXING needs 64 bit pointers");
+
+	//each field of a boxed value is one of these views of the same 64 bits
+	//so code can keep using type, int_value, _object... like with the unpacked value
+	namespace NanBox
+	{
+		const uint64_t PayloadMask = 0x0000FFFFFFFFFFFFull;
+		const uint64_t TagMask = 0xFFFF000000000000ull;
+		const uint64_t FirstTag = 0xFFF8;//top 16 bits of a boxed null, the other types follow it in order
+		const uint64_t CanonicalNaN = 0x7FF8000000000000ull;//every real NaN becomes this so it cant look boxed
+
+		inline uint64_t Tag(ValueType type)
+		{
+			int t = (int)type;
+			return (FirstTag + t - (t > (int)ValueType::Real)) << 48;//reals have no tag
+		}
+
+		inline ValueType TypeOf(uint64_t bits)
+		{
+			uint64_t top = bits >> 48;
+			if (top < FirstTag)
+				return ValueType::Real;
+			int t = (int)(top - FirstTag);
+			return (ValueType)(t + (t > (int)ValueType::Int));
+		}
+
+		inline uint64_t FromReal(double d)
+		{
+			uint64_t bits;
+			memcpy(&bits, &d, sizeof(d));
+			return d == d ? bits : CanonicalNaN;
+		}
+
+		inline double ToReal(uint64_t bits)
+		{
+			double d;
+			memcpy(&d, &bits, sizeof(d));
+			return d;
+		}
+
+		struct TypeField
+		{
+			uint64_t bits;
+
+			inline operator ValueType() const { return TypeOf(bits); }
+			explicit inline operator int() const { return (int)TypeOf(bits); }
+
+			//keeps the payload so the type and the data can be set in either order
+			inline TypeField& operator=(ValueType type)
+			{
+				if (type != ValueType::Real)
+					bits = Tag(type) | (bits & PayloadMask);
+				else if ((bits >> 48) >= FirstTag)
+					bits = 0;
+				return *this;
+			}
+		};
+
+		struct IntField
+		{
+			uint64_t bits;
+
+			inline operator int64_t() const { return ((int64_t)(bits << 16)) >> 16; }
+
+			inline IntField& operator=(int64_t v)
+			{
+				bits = Tag(ValueType::Int) | ((uint64_t)v & PayloadMask);
+				return *this;
+			}
+
+			inline IntField& operator+=(int64_t v) { return *this = (int64_t)*this + v; }
+			inline IntField& operator-=(int64_t v) { return *this = (int64_t)*this - v; }
+			inline IntField& operator*=(int64_t v) { return *this = (int64_t)*this * v; }
+			inline IntField& operator/=(int64_t v) { return *this = (int64_t)*this / v; }
+			inline IntField& operator%=(int64_t v) { return *this = (int64_t)*this % v; }
+			inline IntField& operator|=(int64_t v) { return *this = (int64_t)*this | v; }
+			inline IntField& operator&=(int64_t v) { return *this = (int64_t)*this & v; }
+			inline IntField& operator^=(int64_t v) { return *this = (int64_t)*this ^ v; }
+			inline IntField& operator<<=(int64_t v) { return *this = (int64_t)*this << v; }
+			inline IntField& operator>>=(int64_t v) { return *this = (int64_t)*this >> v; }
+			inline IntField& operator++() { return *this += 1; }
+			inline IntField& operator--() { return *this -= 1; }
+			inline int64_t operator++(int) { int64_t v = *this; *this += 1; return v; }
+			inline int64_t operator--(int) { int64_t v = *this; *this -= 1; return v; }
+		};
+
+		struct RealField
+		{
+			uint64_t bits;
+
+			inline operator double() const { return ToReal(bits); }
+
+			inline RealField& operator=(double v)
+			{
+				bits = FromReal(v);
+				return *this;
+			}
+
+			inline RealField& operator+=(double v) { return *this = ToReal(bits) + v; }
+			inline RealField& operator-=(double v) { return *this = ToReal(bits) - v; }
+			inline RealField& operator*=(double v) { return *this = ToReal(bits) * v; }
+			inline RealField& operator/=(double v) { return *this = ToReal(bits) / v; }
+			inline RealField& operator++() { return *this += 1; }
+			inline RealField& operator--() { return *this -= 1; }
+			inline double operator++(int) { double v = *this; *this += 1; return v; }
+			inline double operator--(int) { double v = *this; *this -= 1; return v; }
+		};
+
+		//T is the pointer type, setting it keeps the tag like setting the type keeps the payload
+		template<class T>
+		struct PointerField
+		{
+			uint64_t bits;
+
+			inline operator T() const { return (T)(bits & PayloadMask); }
+			inline T operator->() const { return (T)(bits & PayloadMask); }
+			explicit inline operator uintptr_t() const { return (uintptr_t)(bits & PayloadMask); }
+
+			inline PointerField& operator=(T p)
+			{
+				bits = (bits & TagMask) | ((uint64_t)p & PayloadMask);
+				return *this;
+			}
+
+			template<class... Args>
+			inline auto operator()(Args... args) const -> decltype(((T)0)(args...))
+			{
+				return ((T)(bits & PayloadMask))(args...);
+			}
+		};
+
+		//the length is only kept in the string itself
+		struct LengthField
+		{
+			uint64_t bits;
+
+			inline operator unsigned int() const { return ((JetString*)(bits & PayloadMask))->length; }
+			inline LengthField& operator=(unsigned int) { return *this; }
+		};
+	}
+#endif
+
 	struct _JetObject;
 	struct Value
 	{
+#ifdef JET_NAN_BOXING
+		union
+		{
+			uint64_t						bits;
+			NanBox::TypeField				type;
+			NanBox::RealField				value;
+			NanBox::IntField				int_value;
+			NanBox::PointerField<JetString*>	_string;
+			NanBox::PointerField<JetObject*>	_object;
+			NanBox::PointerField<JetArray*>		_array;
+			NanBox::PointerField<JetUserdata*>	_userdata;
+			NanBox::PointerField<Closure*>		_function;	//jet function
+			NanBox::LengthField				length;		//used for strings
+			NanBox::PointerField<JetNativeFunc>	func;		//native func
+		};
+#else
 		ValueType				type;
 		union
 		{
@@ -220,6 +497,7 @@ namespace Jet
 
 			JetNativeFunc		func;		//native func
 		};
+#endif
 
 		Value();
 
@@ -351,7 +629,7 @@ namespace Jet
 		// --
 		void	Decrease();
 
-		//ֵ
+		//空值
 		static Value	Empty;
 		static Value	Zero;
 		static Value	One;
@@ -364,9 +642,17 @@ namespace Jet
 		friend class JetContext;
 	};
 
+#ifdef JET_NAN_BOXING
+	static_assert(sizeof(Value) == 8, "NaN boxed values should be 8 bytes");
+#endif
+
 // use macro to avoid function call
 #define set_value_bool(v,b)	v.type=ValueType::Int;v.int_value=b?1:0;
 
+//ordering for Lt/Gt/LtE/GtE, once a real is involved both sides compare as doubles
+#define vmnumber(v) (v.type == ValueType::Real ? v.value : (double)v.int_value)
+#define vmcompare(a, b, op) ((a.type == ValueType::Real || b.type == ValueType::Real) ? vmnumber(a) op vmnumber(b) : a.int_value op b.int_value)
+
 	struct Capture
 	{
 		//garbage collector header
@@ -386,12 +672,38 @@ namespace Jet
 #endif
 	};
 
+	//key and value pair handed out when iterating over an object
 	struct ObjNode
 	{
 		Value first;
 		Value second;
+	};
+
+	//hidden class for objects, maps each key to a slot in the object's value array
+	//shared shapes belong to the context and only ever hold string keys, objects that get the
+	//same keys in the same order end up sharing one by following the transitions
+	//an object that outgrows them gets a private shape that it extends in place
+	struct JetShape
+	{
+		std::vector<Value> keys;//key for each slot
+		std::vector<int> table;//open addressed hash of slot indices, -1 when empty
+		std::vector<std::pair<JetString*, JetShape*>> transitions;//shapes with one more key
+		bool shared;
+
+		JetShape(bool shared);
+
+		//returns the slot for a key or -1
+		int find(const Value* key) const;
+		int find(const char* key) const;
 
-		ObjNode* next;
+		//adds a key in the next slot
+		void insert(const Value& key);
+
+		//gets the shared shape with this interned key added, making it if it doesnt exist
+		JetShape* transition(JetContext* context, JetString* key);
+
+		//bytes held by the shape for memory accounting
+		size_t Size() const;
 	};
 
 	template <class T>
@@ -399,62 +711,58 @@ namespace Jet
 	{
 		typedef ObjNode Node;
 		typedef ObjIterator<T> Iterator;
-		Node* ptr;
 		JetObject* parent;
+		int index;//slot, -1 at the end
+		Node node;
 	public:
 		ObjIterator()
 		{
 			this->parent = 0;
-			this->ptr = 0;
+			this->index = -1;
 		}
 
 		ObjIterator(JetObject* p)
 		{
 			this->parent = p;
-			this->ptr = 0;
+			this->index = -1;
 		}
 
-		ObjIterator(JetObject* p, Node* node)
+		ObjIterator(JetObject* p, int slot)
 		{
 			this->parent = p;
-			this->ptr = node;
+			this->index = slot;
 		}
 
 		bool operator==(const Iterator& other)
 		{
-			return ptr == other.ptr;
+			return index == other.index;
 		}
 
 		bool operator!=(const Iterator& other)
 		{
-			return this->ptr != other.ptr;
+			return this->index != other.index;
 		}
 
 		Iterator& operator++()
 		{
-			if (ptr && ((this->ptr-this->parent->nodes) < ((int)this->parent->nodecount-1)))
-			{
-				do
-				{
-					this->ptr++;
-					if (ptr->first.type != ValueType::Null)
-						return *this;
-				}
-				while ((this->ptr-this->parent->nodes) < ((int)this->parent->nodecount-1));
-			}
-			this->ptr = 0;
+			if (this->index >= 0 && this->index + 1 < (int)this->parent->size())
+				this->index++;
+			else
+				this->index = -1;
 
 			return *this;
 		};
 
-		Node*& operator->() const
-		{	// return pointer to class object
-			return (Node*&)this->ptr;//this does pointer magic and gives a reference to the pair containing the key and value
+		Node* operator->()
+		{
+			return &**this;
 		}
 
 		Node& operator*()
 		{
-			return *this->ptr;
+			node.first = this->parent->shape->keys[this->index];
+			node.second = this->parent->slots[this->index];
+			return node;
 		}
 	};
 
@@ -462,6 +770,7 @@ namespace Jet
 	class JetObject
 	{
 		friend class ObjIterator<Value>;
+		friend struct InlineCache;
 		friend struct Value;
 		friend class GarbageCollector;
 		friend class JetContext;
@@ -471,51 +780,62 @@ namespace Jet
 		Jet::ValueType type;
 		unsigned char refcount;
 
+		bool isprototype;//set once an inline cache looked past this object, adding keys to it then invalidates them
+
 		JetContext* context;
-		ObjNode* nodes;
+		JetShape* shape;
+		Value* slots;
 		JetObject* prototype;
 
-		unsigned int Size;
-		unsigned int nodecount;
+		unsigned int capacity;//number of slots allocated
 	public:
 		typedef ObjIterator<Value> Iterator;
 
 		JetObject(JetContext* context);
 		~JetObject();
 
-		std::size_t key(const Value* v) const;
+		//bytes held by the object, its slots and its private shape
+		size_t Size() const;
+
+		static std::size_t key(const Value* v);
 
 		Iterator find(const Value& key)
 		{
-			ObjNode* node = this->findNode(&key);
-			return Iterator(this, node);
+			return Iterator(this, this->shape->find(&key));
 		}
 
 		Iterator find(const char* key)
 		{
-			ObjNode* node = this->findNode(key);
-			return Iterator(this, node);
+			return Iterator(this, this->shape->find(key));
 		}
 
 		//this are faster versions used in the VM
 		Value get(const Value& key)
 		{
-			auto node = this->findNode(&key);
-			return node ? node->second : Value();
+			auto slot = this->findSlot(&key);
+			return slot ? *slot : Value();
 		}
 		Value get(const char* key)
 		{
-			auto node = this->findNode(key);
-			return node ? node->second : Value();
+			auto slot = this->findSlot(key);
+			return slot ? *slot : Value();
 		}
 
-		//just looks for a node
-		ObjNode* findNode(const Value* key);
-		ObjNode* findNode(const char* key);
+		//just looks for a slot
+		inline Value* findSlot(const Value* key)
+		{
+			int i = this->shape->find(key);
+			return i >= 0 ? &this->slots[i] : 0;
+		}
+		inline Value* findSlot(const char* key)
+		{
+			int i = this->shape->find(key);
+			return i >= 0 ? &this->slots[i] : 0;
+		}
 
-		//finds node for key or creates one if doesnt exist
-		ObjNode* getNode(const Value* key);
-		ObjNode* getNode(const char* key);
+		//finds slot for key or creates one if doesnt exist
+		Value* getSlot(const Value* key);
+		Value* getSlot(const char* key);
 
 		//try not to use these in the vm
 		Value& operator [](const Value& key);
@@ -528,35 +848,62 @@ namespace Jet
 
 		Iterator begin()
 		{
-			for (unsigned int i = 0; i < this->nodecount; i++)
-				if (this->nodes[i].first.type != ValueType::Null)
-					return Iterator(this, &nodes[i]);
-			return end();
+			return Iterator(this, this->size() ? 0 : -1);
 		}
 
 		inline size_t size()
 		{
-			return this->Size;
+			return this->shape->keys.size();
 		}
 
-		inline void SetPrototype(JetObject* obj)
-		{
-			this->prototype = obj;
-		}
+		void SetPrototype(JetObject* obj);
 
 		void DebugPrint();
 
 	private:
-		//finds an open node in the table for inserting
-		ObjNode* getFreePosition();
-
-		//increases the size to fit new keys
-		void resize();
+		//moves to the shape with this key added and makes room for its slot
+		Value* addSlot(const Value& key, const char* name);
 
 		//memory barrier
 		void Barrier();
 	};
 
+	inline Value* InlineCache::Get(JetObject* obj, unsigned int epoch)
+	{
+		for (unsigned int i = 0; i < JET_INLINE_CACHE_SIZE; i++)
+		{
+			Entry& e = this->entries[i];
+			if (e.shape == obj->shape)
+			{
+				if (e.holder == 0)
+					return &obj->slots[e.slot];
+				else if (e.prototype == obj->prototype && e.epoch == epoch)
+					return &e.holder->slots[e.slot];
+			}
+		}
+		return 0;
+	}
+
+	inline void InlineCache::Set(JetObject* obj, JetObject* holder, int slot, unsigned int epoch)
+	{
+		Entry* e = 0;
+		for (unsigned int i = 0; i < JET_INLINE_CACHE_SIZE; i++)
+		{
+			if (this->entries[i].shape == obj->shape)
+				e = &this->entries[i];
+		}
+		if (e == 0)
+		{
+			e = &this->entries[this->next];
+			this->next = (this->next + 1) % JET_INLINE_CACHE_SIZE;
+		}
+		e->shape = obj->shape;
+		e->prototype = obj->prototype;
+		e->holder = holder;
+		e->epoch = epoch;
+		e->slot = slot;
+	}
+
 	//basically a unique_ptr for values
 	class ValueRef
 	{
@@ -615,21 +962,23 @@ namespace Jet
 		};
 
 		Generator(JetContext* context, Closure* closure, unsigned int args);
+		~Generator();
 
-		void Yield(JetContext* context, unsigned int iptr);
+		//the frame runs right in the generator's own locals, so suspending and resuming it copies nothing
+		//both of these return where its temporaries started on the context stack
+		Value* Yield(JetContext* context, unsigned int iptr);
+		Value* Kill(JetContext* context);//what happens when you return
 
-		unsigned int Resume(JetContext* context);
+		unsigned int Resume(JetContext* context, const Value& arg);//points the stack pointer at the locals and sends arg as the result of the last yield
 
-		void Kill()//what happens when you return
-		{
-			this->state = GeneratorState::Dead;
-			//restore iptr
-		}
+		void Close();//closes the captures still open when the generator gets freed
 
 		int curiptr;
 		GeneratorState state;
 		Closure* closure;
 		Value* stack;
+		unsigned int base;//where its temporaries start on the context stack while it is running
+		std::vector<Capture*> captures;//captures of its locals kept open while it is suspended
 		Value lastyielded;//used for acting like an iterator
 	};
 }